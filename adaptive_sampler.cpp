@@ -0,0 +1,119 @@
+﻿#include "adaptive_sampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace raytracer {
+
+	namespace {
+		constexpr int MIN_SAMPLES = 8; //fewer samples do not tell the variance of a pixel apart from luck
+		constexpr int MAX_PASSES = 4; //passes of one frame, each of them is a full round through the renderer
+	}
+
+	void adaptive_sampler::tile_rect(const int tile, int& x0, int& y0, int& x1, int& y1) const {
+		x0 = (tile % _tilesX) * _tileSize;
+		y0 = (tile / _tilesX) * _tileSize;
+		x1 = std::min(x0 + _tileSize, _width);
+		y1 = std::min(y0 + _tileSize, _height);
+	}
+
+	size_t adaptive_sampler::tile_pixels(const int tile) const {
+		int x0, y0, x1, y1;
+		tile_rect(tile, x0, y0, x1, y1);
+		return (size_t) (x1 - x0) * (y1 - y0);
+	}
+
+	void adaptive_sampler::reset(const int width, const int height, const int tileSize) {
+		_width = width;
+		_height = height;
+		_tileSize = tileSize;
+		_tilesX = (width + tileSize - 1) / tileSize;
+		const int tiles = _tilesX * ((height + tileSize - 1) / tileSize);
+
+		_sums.assign((size_t) width * height, 0.0f);
+		_squares.assign((size_t) width * height, 0.0f);
+		_samples.assign(tiles, 0);
+		_errors.assign(tiles, std::numeric_limits<float>::infinity());
+		_sampled.assign(tiles, 0);
+		_passes.clear();
+	}
+
+	const std::vector<std::vector<int>>& adaptive_sampler::plan(const float threshold, const int maxSamples, const size_t budget) {
+		_passes.clear();
+
+		std::vector<int> open;
+		for (int tile = 0; tile < (int) _samples.size(); ++tile) {
+			if (_samples[tile] < maxSamples && !(_errors[tile] < threshold)) open.push_back(tile);
+		}
+
+		if (open.empty()) return _passes;
+
+		//tiles without an estimate yet come first, they may need samples the most
+		std::stable_sort(open.begin(), open.end(), [this](const int a, const int b) { return _errors[a] > _errors[b]; });
+		_passes.push_back(open);
+
+		size_t spent = 0;
+		for (const int tile : open) spent += tile_pixels(tile);
+
+		for (int pass = 1; pass < MAX_PASSES && spent < budget; ++pass) {
+			std::vector<int> next;
+			for (const int tile : _passes.back()) {
+				const size_t pixels = tile_pixels(tile);
+				if (_samples[tile] + pass >= maxSamples || spent + pixels > budget) continue;
+
+				next.push_back(tile);
+				spent += pixels;
+			}
+
+			if (next.empty()) break;
+			_passes.push_back(std::move(next));
+		}
+
+		return _passes;
+	}
+
+	size_t adaptive_sampler::begin_pass(const int pass) {
+		size_t pixels = 0;
+		for (const int tile : _passes[pass]) {
+			++_samples[tile];
+			_sampled[tile] = 1;
+			pixels += tile_pixels(tile);
+		}
+
+		return pixels;
+	}
+
+	bool adaptive_sampler::end_frame(const int tile) {
+		if (!_sampled[tile]) return false;
+		_sampled[tile] = 0;
+
+		const int n = _samples[tile];
+		if (n < MIN_SAMPLES) return true;
+
+		//unbiased variance of the samples, divided by n once more for the variance of their mean
+		int x0, y0, x1, y1;
+		tile_rect(tile, x0, y0, x1, y1);
+		const float invN = 1.0f / n;
+		double total = 0.0;
+		for (int y = y0; y < y1; ++y) {
+			for (int x = x0; x < x1; ++x) {
+				const size_t i = (size_t) y * _width + x;
+				const float mean = _sums[i] * invN;
+				const float variance = std::max(0.0f, _squares[i] * invN - mean * mean) * n / (n - 1);
+				total += variance * invN;
+			}
+		}
+
+		_errors[tile] = (float) std::sqrt(total / tile_pixels(tile));
+		return true;
+	}
+
+	float adaptive_sampler::average_samples() const {
+		if (_width <= 0 || _height <= 0) return 0.0f;
+
+		double total = 0.0;
+		for (int tile = 0; tile < (int) _samples.size(); ++tile) total += (double) _samples[tile] * tile_pixels(tile);
+		return (float) (total / ((double) _width * _height));
+	}
+}
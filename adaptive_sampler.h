@@ -0,0 +1,59 @@
+﻿#pragma once
+#include "maths.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace raytracer {
+	//variance driven sampling of an accumulated image in square tiles. next to the accumulation every pixel keeps
+	//the sum and the sum of squares of its samples' luminance, clamped to what the display shows, which gives the
+	//standard error of the pixel's mean. the error of a tile is the root mean square over its pixels. tiles whose
+	//error fell below the threshold are retired and not sampled again until accumulation restarts. a frame gets
+	//the samples of a full image as its budget, one pass over the tiles still sampled spends part of it and the
+	//rest goes to further passes over the tiles with the largest error
+	struct adaptive_sampler {
+		private:
+		int _width = 0;
+		int _height = 0;
+		int _tileSize = 1;
+		int _tilesX = 0;
+
+		std::vector<float> _sums;
+		std::vector<float> _squares;
+		std::vector<int> _samples; //per tile
+		std::vector<float> _errors; //per tile, infinite until there are enough samples to tell
+		std::vector<uint8_t> _sampled; //tiles sampled by the current frame, bytes since end_frame clears them from several threads
+		std::vector<std::vector<int>> _passes;
+
+		void tile_rect(const int tile, int& x0, int& y0, int& x1, int& y1) const;
+		size_t tile_pixels(const int tile) const;
+
+		public:
+		//forgets all samples, for an image of width x height in tiles of tileSize pixels in rows
+		void reset(const int width, const int height, const int tileSize);
+
+		//splits the next frame into passes, lists of tiles worst first that together cover at most budget pixels
+		//(except the first pass, which has every tile that is neither retired nor has maxSamples). no passes
+		//are left once the image converged
+		const std::vector<std::vector<int>>& plan(const float threshold, const int maxSamples, const size_t budget);
+
+		//counts a sample for every tile of a planned pass before it is rendered, returns the pixels it covers
+		size_t begin_pass(const int pass);
+
+		//adds a sample of pixel i, from the thread rendering its tile
+		void add(const int i, const vec3f& color) {
+			const float l = std::min(1.0f, std::max(0.0f, 0.2126f * color.x() + 0.7152f * color.y() + 0.0722f * color.z()));
+			_sums[i] += l;
+			_squares[i] += l * l;
+		}
+
+		//recomputes the error of tile if the frame sampled it, returns whether it did. threads may call it for
+		//different tiles at the same time
+		bool end_frame(const int tile);
+
+		int samples(const int tile) const { return _samples[tile]; }
+
+		//samples per pixel over the whole image
+		float average_samples() const;
+	};
+}
@@ -0,0 +1,540 @@
+﻿#include "benchmark.h"
+#include "benchmark_vec.inl"
+#include "kernels.h"
+#include "measurements.h"
+#include "mesh_import.h"
+#include "packet.h"
+#include "path_tracer.h"
+#include "rasterizer.h"
+#include "raytracer.h"
+#include "scene.h"
+#include "test_scene.h"
+#include "thread_pool.h"
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <utility>
+
+namespace raytracer {
+
+	namespace {
+		void print_row(const char* name, const double scalar, const double simd) {
+			printf("  %-12s %10.3f ns %10.3f ns %8.2fx\n", name, scalar, simd, scalar / simd);
+		}
+
+		void vec_suite() {
+			constexpr int iterations = 20000;
+			const vec_benchmark_result scalar = benchmark_vec_scalar(iterations);
+			const vec_benchmark_result simd = benchmark_vec_simd(iterations);
+
+			printf("vec: generic template vs sse specialization, per operation\n");
+			printf("  %-12s %13s %13s %9s\n", "kernel", "generic", "sse", "speedup");
+			print_row("dot", scalar.dot, simd.dot);
+			print_row("cross", scalar.cross, simd.cross);
+			print_row("normalize", scalar.normalize, simd.normalize);
+			print_row("madd", scalar.madd, simd.madd);
+			print_row("triangle", scalar.triangle, simd.triangle);
+		}
+
+		//renders the frame a few times and returns the steady state primary rays per second in millions
+		double measure_frames(std::vector<byte>& pixels, const int width, const int height, const int frames) {
+			run(pixels.data(), width, height); //builds the scene on the first call
+			const double ms = lamda_timer([&]() {
+				for (int i = 0; i < frames; ++i) run(pixels.data(), width, height);
+			});
+			return (double) width * height * frames / ms * 1e-3;
+		}
+
+		void packet_suite() {
+			constexpr int width = 1920, height = 1080, frames = 10;
+			const size_t triangles = add_test_scene(20);
+			std::vector<byte> pixels((size_t) width * height * 4);
+
+			//every frame traces new rays, accumulation would stop tracing once converged
+			render_settings settings = get_render_settings();
+			settings.accumulate = false;
+			settings.packets = false;
+			set_render_settings(settings);
+			const double single = measure_frames(pixels, width, height, frames);
+
+			settings.packets = true;
+			set_render_settings(settings);
+			const double packets = measure_frames(pixels, width, height, frames);
+
+			printf("packet: primary rays at %dx%d, %zu triangles\n", width, height, triangles);
+			printf("  single rays  %8.2f Mrays/s\n", single);
+			printf("  8x8 packets  %8.2f Mrays/s %8.2fx\n", packets, packets / single);
+		}
+
+		void instance_suite() {
+			constexpr int side = 100, updates = 20;
+			const std::vector<float> sphere = test_sphere();
+
+			scene s;
+			const int mesh = s.add_mesh(sphere.data(), sphere.size(), false);
+			for (int i = 0; i < side * side; ++i) s.add_instance(mesh, transform::translate(vec3f(2.5f * (i % side), 0.0f, 2.5f * (i / side))));
+			const double first = lamda_timer([&]() { s.update(); });
+
+			//small per instance motion keeps the refit below the rebuild threshold
+			double refit = 0.0;
+			for (int k = 1; k <= updates; ++k) {
+				for (int i = 0; i < side * side; ++i) {
+					const float wobble = 0.2f * std::sin(0.1f * k + i);
+					s.set_transform(i, transform::translate(vec3f(2.5f * (i % side) + wobble, wobble, 2.5f * (i / side))));
+				}
+				refit += lamda_timer([&]() { s.update(); });
+			}
+
+			double rebuild = 0.0;
+			for (int k = 0; k < updates; ++k) {
+				s.add_instance(mesh, transform::translate(vec3f(-2.5f * (k + 1), 0.0f, 0.0f)));
+				rebuild += lamda_timer([&]() { s.update(); });
+			}
+
+			const double perTriangle = (double) s.geometry_bytes() / s.triangle_count();
+			printf("instances: %zu instances of a %zu triangle mesh, %zu triangles in the world\n", s.instance_count(), s.triangle_count(), s.instanced_triangle_count());
+			printf("  first update (blas + tlas) %10.3f ms\n", first);
+			printf("  tlas refit                 %10.3f ms\n", refit / updates);
+			printf("  tlas rebuild               %10.3f ms\n", rebuild / updates);
+			printf("  memory                     %10.2f MB geometry, %.2f MB instances, %.2f MB flattened\n",
+				s.geometry_bytes() / 1048576.0, s.instance_bytes() / 1048576.0, perTriangle * s.instanced_triangle_count() / 1048576.0);
+		}
+
+		void build_suite() {
+			constexpr int detail = 40;
+			const std::vector<float> spheres = test_spheres(detail);
+			const size_t triangles = spheres.size() / 9;
+
+			std::vector<aabb> bounds(triangles);
+			for (size_t i = 0; i < triangles; ++i) {
+				for (int corner = 0; corner < 3; ++corner) bounds[i].grow(vec3f(spheres[9 * i + 3 * corner], spheres[9 * i + 3 * corner + 1], spheres[9 * i + 3 * corner + 2]));
+			}
+
+			printf("build: bvh over %zu triangles, %d workers\n", triangles, default_pool().size());
+			printf("  %-16s %10s %10s %10s %10s\n", "builder", "ms", "Mtris/s", "nodes", "sah cost");
+			const struct {
+				const char* name;
+				bvh_builder builder;
+				bool parallel;
+			} builds[] = {
+				{ "sah serial", BVH_BUILDER_SAH, false },
+				{ "sah parallel", BVH_BUILDER_SAH, true },
+				{ "lbvh serial", BVH_BUILDER_LBVH, false },
+				{ "lbvh parallel", BVH_BUILDER_LBVH, true },
+			};
+
+			bvh tree;
+			for (const auto& b : builds) {
+				build_bvh(tree, bounds.data(), triangles, TRIANGLE_BLOCK_WIDTH, b.builder, b.parallel ? &default_pool() : nullptr); //warm up
+				const double ms = lamda_timer([&]() { build_bvh(tree, bounds.data(), triangles, TRIANGLE_BLOCK_WIDTH, b.builder, b.parallel ? &default_pool() : nullptr); });
+				printf("  %-16s %10.3f %10.2f %10zu %10.2f\n", b.name, ms, triangles / (ms * 1000.0), tree.nodes.size(), sah_cost(tree));
+			}
+
+			//soup as test_spheres makes it against the welded mesh the test scene adds
+			std::vector<float> vertices;
+			std::vector<unsigned> indices;
+			const double weldMs = lamda_timer([&]() { weld_vertices(spheres.data(), 3 * triangles, vertices, indices); });
+			triangle_mesh mesh;
+			mesh.vertices = vertices.data();
+			mesh.indices = indices.data();
+			mesh.vertexCount = vertices.size() / 3;
+			mesh.triangles = triangles;
+			printf("  %-16s %10.3f ms, %zu of %zu vertices left\n", "weld", weldMs, mesh.vertexCount, 3 * triangles);
+			printf("  vertex memory: %.1f bytes per triangle as soup, %.1f indexed, %.1f quantized\n", 9.0 * sizeof(float),
+				(double) (mesh.vertex_bytes() + mesh.index_bytes()) / triangles, (double) (mesh.vertex_bytes() / 2 + mesh.index_bytes()) / triangles);
+
+			//the last tree is collapsed as the scene does it for its bottom levels
+			std::vector<triangle_block> blocks;
+			build_triangle_blocks(tree, mesh, blocks);
+			const size_t binaryBytes = tree.nodes.size() * sizeof(bvh_node);
+
+			bvh8 wide;
+			const double collapseMs = lamda_timer([&]() { collapse_bvh8(tree, blocks, wide); });
+			const size_t wideBytes = wide.nodes.size() * sizeof(bvh8_node);
+			printf("  collapse to bvh8 %10.3f ms, %zu nodes, sah cost %.2f\n", collapseMs, wide.nodes.size(), sah_cost(wide));
+			printf("  node memory      %10.2f bytes per triangle binary, %.2f bvh8, %.2f in triangle blocks\n",
+				(double) binaryBytes / triangles, (double) wideBytes / triangles, (double) blocks.size() * sizeof(triangle_block) / triangles);
+		}
+
+		//xorshift in [0, 1), the suites only need repeatable noise
+		float random_float(uint32_t& state) {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			return (state >> 8) * (1.0f / (1 << 24));
+		}
+
+		//rays from random points of the scene box in random directions, and line of sight from the same points to a light
+		void ray_suite() {
+			constexpr size_t count = 1 << 18;
+			const std::vector<float> spheres = test_spheres(20);
+			scene s;
+			s.add_instance(s.add_mesh(spheres.data(), spheres.size(), false), transform());
+			s.update();
+
+			const aabb b = s.bounds();
+			const vec3f light = b.center() + vec3f(0.0f, 4.0f * b.extent().y() + 10.0f, 0.0f);
+			std::vector<ray> rays(count), shadows(count);
+			uint32_t state = 0x9E3779B9u;
+			for (size_t i = 0; i < count; ++i) {
+				const vec3f origin = b.min + b.extent() * vec3f(random_float(state), random_float(state), random_float(state));
+				rays[i].origin = origin;
+				rays[i].direction = vec3f(random_float(state) - 0.5f, random_float(state) - 0.5f, random_float(state) - 0.5f).normalized();
+
+				//unnormalized direction, the light is at t = 1
+				shadows[i].origin = origin;
+				shadows[i].direction = light - origin;
+				shadows[i].tmax = 1.0f;
+			}
+
+			thread_pool& pool = default_pool();
+			std::vector<hit> hits(count);
+			std::unique_ptr<bool[]> blocked(new bool[count]);
+			const double single = lamda_timer([&]() {
+				for (size_t i = 0; i < count; ++i) hits[i] = s.intersect(rays[i]);
+			});
+			const double batch = lamda_timer([&]() { s.trace(rays.data(), hits.data(), count, false, pool); });
+			const double sorted = lamda_timer([&]() { s.trace(rays.data(), hits.data(), count, true, pool); });
+			const double singleOccluded = lamda_timer([&]() {
+				for (size_t i = 0; i < count; ++i) blocked[i] = s.occluded(shadows[i]);
+			});
+			const double batchOccluded = lamda_timer([&]() { s.occluded(shadows.data(), blocked.get(), count, false, pool); });
+			const double sortedOccluded = lamda_timer([&]() { s.occluded(shadows.data(), blocked.get(), count, true, pool); });
+
+			size_t blockedCount = 0;
+			for (size_t i = 0; i < count; ++i) blockedCount += blocked[i];
+
+			printf("rays: %zu random rays over %zu triangles, one by one on one thread vs batches on %d workers, unsorted and sorted\n", count, s.triangle_count(), pool.size());
+			printf("  %-12s %15s %15s %15s\n", "", "one by one", "batch", "sorted batch");
+			printf("  closest hit  %8.2f Mrays/s %8.2f Mrays/s %8.2f Mrays/s\n", count / (single * 1000.0), count / (batch * 1000.0), count / (sorted * 1000.0));
+			printf("  occluded     %8.2f Mrays/s %8.2f Mrays/s %8.2f Mrays/s, %.1f%% blocked\n", count / (singleOccluded * 1000.0), count / (batchOccluded * 1000.0),
+				count / (sortedOccluded * 1000.0), 100.0 * blockedCount / count);
+		}
+
+		//looks at the scene from above and in front like the raytracer's automatic framing
+		pinhole_camera overview_camera(const aabb& b, const int width, const int height) {
+			const float radius = 0.5f * b.extent().len();
+			const float tanHalf = std::tan(0.5f * 60.0f * 3.14159265f / 180.0f);
+			pinhole_camera camera;
+			camera.position = b.center() + vec3f(0.0f, 0.6f * radius, 1.4f * radius);
+			camera.forward = (b.center() - camera.position).normalized();
+			camera.right = camera.forward.cross(vec3f(0.0f, 1.0f, 0.0f)).normalized();
+			camera.up = camera.right.cross(camera.forward) * tanHalf;
+			camera.right *= tanHalf * width / height;
+			camera.width = width;
+			camera.height = height;
+			camera.jitterX = 0.0f;
+			camera.jitterY = 0.0f;
+			camera.sample = 0;
+			return camera;
+		}
+
+		//path traced frames of the test spheres with and without sorting the bounced rays. enclosed puts the scene in
+		//a box, so no path escapes to the sky and every bounce up to the limit is traced
+		void path_suite() {
+			constexpr int width = 480, height = 270, bounces = 4, frames = 4;
+			thread_pool& pool = default_pool();
+			std::vector<vec3f> radiance((size_t) width * height);
+
+			printf("paths: %dx%d, %d bounces, ms per frame with bounced rays traced unsorted vs sorted on %d workers\n", width, height, bounces, pool.size());
+			printf("  %-8s %-8s %10s %10s %10s %9s\n", "detail", "scene", "triangles", "unsorted", "sorted", "speedup");
+			for (const int detail : { 10, 40 }) {
+				for (const bool enclosed : { false, true }) {
+					std::vector<float> vertices = test_spheres(detail);
+					scene s;
+					s.add_instance(s.add_mesh(vertices.data(), vertices.size(), false), transform());
+					s.update();
+
+					const aabb b = s.bounds();
+					const float radius = 0.5f * b.extent().len();
+					if (enclosed) {
+						//12 triangles of a cube twice the size of the scene around its center
+						const vec3f c = b.center();
+						const float e = 2.0f * radius;
+						const int faces[6][4] = { { 0, 1, 3, 2 }, { 4, 6, 7, 5 }, { 0, 4, 5, 1 }, { 2, 3, 7, 6 }, { 0, 2, 6, 4 }, { 1, 5, 7, 3 } };
+						std::vector<float> box;
+						for (const auto& f : faces) {
+							for (const int k : { f[0], f[1], f[2], f[0], f[2], f[3] }) {
+								box.push_back(c.x() + (k & 4 ? e : -e));
+								box.push_back(c.y() + (k & 2 ? e : -e));
+								box.push_back(c.z() + (k & 1 ? e : -e));
+							}
+						}
+
+						s.add_instance(s.add_mesh(box.data(), box.size(), true), transform());
+						s.update();
+					}
+
+					pinhole_camera camera = overview_camera(b, width, height);
+					path_tracer tracer;
+					double ms[2];
+					for (const bool sorted : { false, true }) {
+						camera.sample = 0;
+						tracer.render(s, camera, bounces, sorted, radiance.data(), nullptr, nullptr, nullptr, pool);
+						ms[sorted] = lamda_timer([&]() {
+							for (int i = 0; i < frames; ++i) {
+								camera.sample = i + 1;
+								tracer.render(s, camera, bounces, sorted, radiance.data(), nullptr, nullptr, nullptr, pool);
+							}
+						}) / frames;
+					}
+
+					printf("  %-8d %-8s %10zu %10.2f %10.2f %8.2fx\n", detail, enclosed ? "enclosed" : "open", s.triangle_count(), ms[0], ms[1], ms[0] / ms[1]);
+				}
+			}
+		}
+
+		//first hits of every pixel of the test spheres: camera rays traced one by one as the path tracer does, in
+		//8x8 packets as the raytracer does, and rasterized into a visibility buffer. rasterizing costs per triangle
+		//and tracing per pixel, so the resolution decides which one wins
+		void raster_suite() {
+			constexpr int frames = 4;
+			thread_pool& pool = default_pool();
+
+			printf("raster: ms per frame for the first hits of all pixels on %d workers\n", pool.size());
+			printf("  %-10s %10s %10s %10s %10s %9s\n", "size", "triangles", "rays", "packets", "raster", "speedup");
+			for (const int detail : { 10, 40 }) {
+				std::vector<float> vertices = test_spheres(detail);
+				scene s;
+				s.add_instance(s.add_mesh(vertices.data(), vertices.size(), false), transform());
+				s.update();
+
+				for (const int height : { 540, 1080, 2160 }) {
+					const int width = height * 16 / 9;
+					const pinhole_camera camera = overview_camera(s.bounds(), width, height);
+					const int rows = (height + PACKET_WIDTH - 1) / PACKET_WIDTH;
+
+					std::vector<hit> hits((size_t) width * height);
+					const double rays = lamda_timer([&]() {
+						pool.run(rows, [&](const int row, const int) {
+							for (int y = row * PACKET_WIDTH; y < std::min(height, (row + 1) * PACKET_WIDTH); ++y) {
+								for (int x = 0; x < width; ++x) {
+									ray r;
+									r.origin = camera.position;
+									r.direction = camera.direction(x, y);
+									hits[(size_t) y * width + x] = s.intersect(r);
+								}
+							}
+						});
+					});
+
+					const vec3f dx = camera.right * (2.0f / width);
+					const vec3f dy = camera.up * (2.0f / height);
+					const double packets = lamda_timer([&]() {
+						for (int i = 0; i < frames; ++i) {
+							pool.run(rows, [&](const int row, const int) {
+								ray_packet packet;
+								for (int x = 0; x < width; x += PACKET_WIDTH) {
+									const int y = row * PACKET_WIDTH;
+									init_packet(packet, camera.position, camera.forward + camera.right * (2.0f * (x + 0.5f) / width - 1.0f) + camera.up * (2.0f * (y + 0.5f) / height - 1.0f), dx, dy);
+									s.trace(packet);
+								}
+							});
+						}
+					}) / frames;
+
+					rasterizer raster;
+					raster.render(s, camera, pool);
+					const double rasterized = lamda_timer([&]() {
+						for (int i = 0; i < frames; ++i) raster.render(s, camera, pool);
+					}) / frames;
+
+					char size[32];
+					snprintf(size, sizeof(size), "%dx%d", width, height);
+					printf("  %-10s %10zu %10.2f %10.2f %10.2f %8.2fx\n", size, s.triangle_count(), rays, packets, rasterized, packets / rasterized);
+				}
+			}
+		}
+
+		//fastest of a few runs of fn in milliseconds, other load on the machine only ever slows a run down
+		template <typename F>
+		double best_of(const int runs, const F& fn) {
+			double best = lamda_timer(fn);
+			for (int i = 1; i < runs; ++i) best = std::min(best, lamda_timer(fn));
+			return best;
+		}
+
+		//the kernels of every instruction set this cpu runs on the same work, one thread. camera rays are coherent,
+		//random rays from inside the scene box are not. hits that disagree with the baseline are counted, the
+		//versions round differently (fma) but should find the same triangles
+		void isa_suite() {
+			constexpr size_t count = 1 << 18;
+			constexpr int width = 1920, height = 1080, resolves = 20, runs = 3;
+			const std::vector<float> spheres = test_spheres(20);
+			scene s;
+			s.add_instance(s.add_mesh(spheres.data(), spheres.size(), false), transform());
+			s.update();
+
+			const aabb b = s.bounds();
+			const vec3f light = b.center() + vec3f(0.0f, 4.0f * b.extent().y() + 10.0f, 0.0f);
+			const pinhole_camera camera = overview_camera(b, 512, count / 512);
+			std::vector<ray> primary(count), random(count), shadows(count);
+			uint32_t state = 0x9E3779B9u;
+			for (size_t i = 0; i < count; ++i) {
+				primary[i].origin = camera.position;
+				primary[i].direction = camera.direction((int) (i % camera.width), (int) (i / camera.width));
+
+				const vec3f origin = b.min + b.extent() * vec3f(random_float(state), random_float(state), random_float(state));
+				random[i].origin = origin;
+				random[i].direction = vec3f(random_float(state) - 0.5f, random_float(state) - 0.5f, random_float(state) - 0.5f).normalized();
+				shadows[i].origin = origin;
+				shadows[i].direction = light - origin;
+				shadows[i].tmax = 1.0f;
+			}
+
+			std::vector<vec3f> colors((size_t) width * height);
+			for (size_t i = 0; i < colors.size(); ++i) colors[i] = vec3f(random_float(state), random_float(state), random_float(state)) * 1.2f;
+			std::vector<byte> pixels(4 * colors.size());
+
+			const simd_isa detected = detect_simd_isa();
+			const simd_kernels& current = kernels();
+
+			std::vector<hit> reference(count), hits(count);
+			std::unique_ptr<bool[]> blocked(new bool[count]);
+			printf("isa: kernels per instruction set on one thread, %zu rays over %zu triangles, detected %s\n", count, s.triangle_count(), simd_isa_name(detected));
+			printf("  %-10s %14s %14s %14s %14s %10s\n", "isa", "camera", "random", "occluded", "resolve", "mismatches");
+			//the last row is the mix kernels() picks by default
+			for (int i = 0; i <= SIMD_ISA_COUNT; ++i) {
+				const simd_isa isa = (simd_isa) i;
+				const char* name = isa == SIMD_ISA_COUNT ? "default" : simd_isa_name(isa);
+				if (isa == SIMD_ISA_COUNT) set_kernels(default_kernels());
+				else if (!force_simd_isa(isa)) {
+					printf("  %-10s not supported by this cpu\n", name);
+					continue;
+				}
+
+				const double camera = best_of(runs, [&]() {
+					for (size_t r = 0; r < count; ++r) hits[r] = s.intersect(primary[r]);
+				});
+				const double occluded = best_of(runs, [&]() {
+					for (size_t r = 0; r < count; ++r) blocked[r] = s.occluded(shadows[r]);
+				});
+				const double resolve = best_of(runs, [&]() {
+					for (int k = 0; k < resolves; ++k) kernels().resolve(colors.data(), 0.9f, colors.size(), pixels.data());
+				}) / resolves;
+				const double incoherent = best_of(runs, [&]() {
+					for (size_t r = 0; r < count; ++r) hits[r] = s.intersect(random[r]);
+				});
+
+				if (isa == SIMD_ISA_BASELINE) reference = hits;
+				size_t mismatches = 0;
+				for (size_t r = 0; r < count; ++r) mismatches += hits[r].triangle != reference[r].triangle;
+
+				printf("  %-10s %7.2f Mrays/s %7.2f Mrays/s %7.2f Mrays/s %11.3f ms %10zu\n", name, count / (camera * 1000.0), count / (incoherent * 1000.0),
+					count / (occluded * 1000.0), resolve, mismatches);
+			}
+
+			printf("  default is %s\n", default_kernels().name);
+			set_kernels(current);
+		}
+
+		//frames of the test scene rendered with the generic tile and shade kernels, which test the settings per pixel
+		//and per path, and with the kernels compiled for the settings. stage is the cpu time of the tiles and the
+		//shade stage alone, the part the specialization changes, the frame time includes tracing
+		void kernel_suite() {
+			constexpr int width = 960, height = 540, frames = 4, rounds = 5;
+			const size_t triangles = add_test_scene(10);
+			std::vector<byte> pixels((size_t) width * height * 4);
+			const render_settings original = get_render_settings();
+
+			std::vector<std::pair<const char*, render_settings>> configurations;
+			render_settings settings = original;
+			settings.maxSamples = 1 << 20; //accumulation does not converge within the suite
+			settings.accumulate = false;
+			settings.packets = false;
+			configurations.push_back({ "rays", settings });
+			settings.packets = true;
+			configurations.push_back({ "packets", settings });
+			settings.accumulate = true;
+			configurations.push_back({ "packets accumulated", settings });
+			settings.rasterize = true;
+			configurations.push_back({ "rasterized accumulated", settings });
+			settings.rasterize = false;
+			settings.accumulate = false;
+			settings.pathTrace = true;
+			settings.maxBounces = 1;
+			configurations.push_back({ "path 1 bounce", settings });
+			settings.maxBounces = 4;
+			configurations.push_back({ "path 4 bounces", settings });
+			settings.accumulate = true;
+			configurations.push_back({ "path accumulated", settings });
+			settings.adaptiveError = 0.002f;
+			configurations.push_back({ "path adaptive", settings });
+			settings.adaptiveError = 0.0f;
+			settings.denoise = true;
+			configurations.push_back({ "path denoised", settings });
+
+			printf("kernels: %dx%d, %zu triangles, ms per frame and per frame's tile and shade stages, generic vs specialized\n", width, height, triangles);
+			printf("  %-24s %10s %10s %9s %10s %10s %9s\n", "settings", "frame", "frame", "speedup", "stage", "stage", "speedup");
+			run(pixels.data(), width, height); //builds the scene on the first call
+
+			profiler_set_enabled(true);
+			for (const auto& configuration : configurations) {
+				//both alternate for a few rounds and keep their best, other load on the machine only slows a round down
+				double frame[2] = { 1e30, 1e30 }, stage[2] = { 1e30, 1e30 };
+				for (int round = 0; round < rounds; ++round) {
+					for (const bool specialize : { false, true }) {
+						render_settings s = configuration.second;
+						s.specialize = specialize;
+						set_render_settings(s);
+						reset_accumulation();
+						run(pixels.data(), width, height);
+						profiler_end_frame();
+
+						double frameMs = 0.0, stageMs = 0.0;
+						for (int i = 0; i < frames; ++i) {
+							frameMs += lamda_timer([&]() { run(pixels.data(), width, height); }) / frames;
+							profiler_end_frame();
+							for (const profile_stats& scope : profiler_frame_stats()) {
+								if (strcmp(scope.name, "tile") == 0 || strcmp(scope.name, "shade") == 0) stageMs += scope.totalMs / frames;
+							}
+						}
+
+						frame[specialize] = std::min(frame[specialize], frameMs);
+						stage[specialize] = std::min(stage[specialize], stageMs);
+					}
+				}
+
+				printf("  %-24s %7.2f ms %7.2f ms %8.2fx %7.2f ms %7.2f ms %8.2fx\n", configuration.first, frame[0], frame[1], frame[0] / frame[1], stage[0], stage[1], stage[0] / stage[1]);
+			}
+
+			profiler_set_enabled(false);
+			set_render_settings(original);
+		}
+
+		struct suite {
+			const char* name;
+			void (*run)();
+		};
+
+		const suite _suites[] = {
+			{ "vec", vec_suite },
+			{ "packet", packet_suite },
+			{ "instances", instance_suite },
+			{ "build", build_suite },
+			{ "rays", ray_suite },
+			{ "paths", path_suite },
+			{ "raster", raster_suite },
+			{ "isa", isa_suite },
+			{ "kernels", kernel_suite },
+		};
+	}
+
+
+	vec_benchmark_result benchmark_vec_simd(const int iterations) {
+		return run_vec_kernels(iterations);
+	}
+
+	bool run_benchmark(const char* name) {
+		bool found = false;
+		for (const suite& s : _suites) {
+			if (strcmp(name, "all") == 0 || strcmp(name, s.name) == 0) {
+				s.run();
+				found = true;
+			}
+		}
+
+		return found;
+	}
+}
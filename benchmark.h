@@ -0,0 +1,20 @@
+﻿#pragma once
+
+namespace raytracer {
+	//microbenchmarks, run from the headless executable with --bench <suite>
+	//returns false if there is no suite with that name
+	bool run_benchmark(const char* suite);
+
+	//nanoseconds per operation for the vector kernels in benchmark_vec.inl
+	struct vec_benchmark_result {
+		double dot;
+		double cross;
+		double normalize;
+		double madd;
+		double triangle;
+	};
+
+	//same kernels compiled against the sse vec3f/vec4f and against the generic vec template
+	vec_benchmark_result benchmark_vec_simd(const int iterations);
+	vec_benchmark_result benchmark_vec_scalar(const int iterations);
+}
@@ -0,0 +1,108 @@
+﻿#pragma once
+#include "benchmark.h"
+#include "maths.h"
+
+#include <chrono>
+#include <vector>
+
+//vector kernels shared by benchmark.cpp and benchmark_vec_scalar.cpp. everything here has internal
+//linkage because vec3f is a different type in both translation units
+
+
+namespace raytracer {
+	namespace {
+		constexpr int VEC_BENCHMARK_SIZE = 1024;
+
+		volatile float _vecSink;
+
+		struct vec_data {
+			std::vector<vec3f> a;
+			std::vector<vec3f> b;
+			std::vector<vec3f> c;
+			std::vector<vec4f> q;
+			std::vector<vec4f> r;
+
+			vec_data() : a(VEC_BENCHMARK_SIZE), b(VEC_BENCHMARK_SIZE), c(VEC_BENCHMARK_SIZE), q(VEC_BENCHMARK_SIZE), r(VEC_BENCHMARK_SIZE) {
+				unsigned seed = 12345;
+				const auto next = [&]() {
+					seed = seed * 1664525u + 1013904223u;
+					return (float) (seed >> 8) / (float) (1 << 24) * 2.0f - 1.0f;
+				};
+
+				for (int i = 0; i < VEC_BENCHMARK_SIZE; ++i) {
+					a[i] = vec3f(next(), next(), next() + 2.0f);
+					b[i] = vec3f(next(), next(), next());
+					c[i] = vec3f(next(), next(), next());
+					q[i] = vec4f(next(), next(), next(), next());
+					r[i] = vec4f(next(), next(), next(), next());
+				}
+			}
+		};
+
+		template <typename Kernel>
+		double time_kernel(const int iterations, Kernel&& kernel) {
+			kernel(); //warm up
+			const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (int i = 0; i < iterations; ++i) kernel();
+			const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+			return ns / ((double) iterations * VEC_BENCHMARK_SIZE);
+		}
+
+		//moller-trumbore written against the vec api only, origin and triangles taken from the data arrays
+		float intersect_kernel(const vec3f& origin, const vec3f& dir, const vec3f& v0, const vec3f& e1, const vec3f& e2) {
+			const vec3f p = dir.cross(e2);
+			const float det = e1.dot(p);
+			if (std::fabs(det) < 1e-12f) return 0.0f;
+
+			const float invDet = 1.0f / det;
+			const vec3f s = origin - v0;
+			const float u = s.dot(p) * invDet;
+			const vec3f q = s.cross(e1);
+			const float v = dir.dot(q) * invDet;
+			if (u < 0.0f || v < 0.0f || u + v > 1.0f) return 0.0f;
+
+			return e2.dot(q) * invDet;
+		}
+
+		vec_benchmark_result run_vec_kernels(const int iterations) {
+			vec_data d;
+			vec_benchmark_result result;
+
+			result.dot = time_kernel(iterations, [&]() {
+				float sum = 0.0f;
+				for (int i = 0; i < VEC_BENCHMARK_SIZE; ++i) sum += d.a[i].dot(d.b[i]);
+				_vecSink = sum;
+			});
+
+			result.cross = time_kernel(iterations, [&]() {
+				for (int i = 0; i < VEC_BENCHMARK_SIZE; ++i) d.c[i] = d.a[i].cross(d.b[i]);
+				_vecSink = d.c[iterations % VEC_BENCHMARK_SIZE].x();
+			});
+
+			result.normalize = time_kernel(iterations, [&]() {
+				for (int i = 0; i < VEC_BENCHMARK_SIZE; ++i) d.c[i] = d.a[i].normalized();
+				_vecSink = d.c[iterations % VEC_BENCHMARK_SIZE].x();
+			});
+
+			//gcc vectorizes the generic vec4f here into the same mulps, addps, addps loop, both only measure the
+			//latency of the accumulator and differ by noise
+			result.madd = time_kernel(iterations, [&]() {
+				vec4f acc;
+				for (int i = 0; i < VEC_BENCHMARK_SIZE; ++i) acc += d.q[i] * 0.5f + d.r[i];
+				_vecSink = acc.x();
+			});
+
+			const vec3f origin(0.0f, 0.0f, -1.0f);
+			result.triangle = time_kernel(iterations, [&]() {
+				float sum = 0.0f;
+				for (int i = 0; i < VEC_BENCHMARK_SIZE; ++i) {
+					const int j = (i + 1) % VEC_BENCHMARK_SIZE;
+					sum += intersect_kernel(origin, d.b[i], d.a[i], d.c[i], d.b[j]);
+				}
+				_vecSink = sum;
+			});
+
+			return result;
+		}
+	}
+}
@@ -0,0 +1,9 @@
+﻿//the vector benchmarks compiled against the generic vec template, for comparison with the sse specializations
+#define RAYTRACER_SCALAR_MATHS
+#include "benchmark_vec.inl"
+
+namespace raytracer {
+	vec_benchmark_result benchmark_vec_scalar(const int iterations) {
+		return run_vec_kernels(iterations);
+	}
+}
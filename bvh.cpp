@@ -0,0 +1,516 @@
+﻿#include "bvh.h"
+#include "radix_sort.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace raytracer {
+
+	namespace {
+		//primitives one pool task bins, partitions or sorts
+		constexpr unsigned BVH_CHUNK = 1u << 14;
+		//builds below this size run serially, the task overhead would outweigh the work
+		constexpr unsigned BVH_PARALLEL_BUILD = 1u << 15;
+		//during a parallel build, nodes this large are binned and partitioned on all workers
+		constexpr unsigned BVH_PARALLEL_NODE = 1u << 16;
+		//smallest subtree that gets a task of its own
+		constexpr unsigned BVH_MIN_TASK = 1u << 10;
+
+		constexpr int MORTON_BITS = 10; //per axis
+
+		struct bin {
+			aabb bounds;
+			int count = 0;
+		};
+
+		struct range_bounds {
+			aabb bounds;
+			aabb centroids;
+
+			void grow(const range_bounds& b) {
+				bounds.grow(b.bounds);
+				centroids.grow(b.centroids);
+			}
+		};
+
+		//maps centroids to bins along each axis, flat axes put everything into bin 0
+		struct bin_mapping {
+			vec3f min;
+			vec3f scale;
+
+			explicit bin_mapping(const aabb& centroids) : min(centroids.min) {
+				const vec3f e = centroids.extent();
+				scale = vec3f(
+					e.x() > 0.0f ? BVH_BINS * (1.0f - 1e-5f) / e.x() : 0.0f,
+					e.y() > 0.0f ? BVH_BINS * (1.0f - 1e-5f) / e.y() : 0.0f,
+					e.z() > 0.0f ? BVH_BINS * (1.0f - 1e-5f) / e.z() : 0.0f);
+			}
+
+			int operator() (const vec3f& c, const int axis) const {
+				return std::min(BVH_BINS - 1, (int) ((c[axis] - min[axis]) * scale[axis]));
+			}
+		};
+
+		struct split_bins {
+			bin bins[3][BVH_BINS];
+
+			void grow(const split_bins& b) {
+				for (int axis = 0; axis < 3; ++axis) {
+					for (int i = 0; i < BVH_BINS; ++i) {
+						bins[axis][i].bounds.grow(b.bins[axis][i].bounds);
+						bins[axis][i].count += b.bins[axis][i].count;
+					}
+				}
+			}
+		};
+
+		struct split {
+			int axis = -1;
+			int bin = 0;
+			float cost = FLT_MAX; //unnormalized, area weighted blocks
+		};
+
+		//subtree handed to a pool task, node is its placeholder among the top level nodes
+		struct subtree {
+			unsigned node;
+			unsigned begin;
+			unsigned end;
+			int depth;
+			std::vector<bvh_node> nodes;
+		};
+
+		struct build_context {
+			const aabb* bounds;
+			std::vector<vec3f> centroids;
+			unsigned* indices;
+			int leafBlockSize;
+			thread_pool* pool; //null for serial builds
+			unsigned grain; //subtrees up to this size are deferred to tasks
+			std::vector<uint32_t> codes; //morton codes in sorted order, lbvh only
+
+			float blocks(const int count) const {
+				return (float) ((count + leafBlockSize - 1) / leafBlockSize);
+			}
+		};
+
+		int chunk_count(const unsigned count) {
+			return (int) ((count + BVH_CHUNK - 1) / BVH_CHUNK);
+		}
+
+		//calls fn(chunk, first, last) for [begin, end) cut into chunks, on the pool when there is one
+		template <typename Fn>
+		void for_chunks(thread_pool* pool, const unsigned begin, const unsigned end, Fn&& fn) {
+			const auto body = [&](const int chunk, const int) {
+				const unsigned first = begin + (unsigned) chunk * BVH_CHUNK;
+				fn(chunk, first, std::min(end, first + BVH_CHUNK));
+			};
+
+			const int chunks = chunk_count(end - begin);
+			if (pool) pool->run(chunks, body);
+			else for (int c = 0; c < chunks; ++c) body(c, 0);
+		}
+
+		void set_bounds(bvh_node& node, const aabb& b) {
+			for (int i = 0; i < 3; ++i) {
+				node.min[i] = b.min[i];
+				node.max[i] = b.max[i];
+			}
+		}
+
+		aabb node_bounds(const bvh_node& node) {
+			aabb b;
+			b.min = vec3f(node.min[0], node.min[1], node.min[2]);
+			b.max = vec3f(node.max[0], node.max[1], node.max[2]);
+			return b;
+		}
+
+		void make_leaf(bvh_node& node, const unsigned begin, const unsigned end) {
+			node.offset = begin;
+			node.count = end - begin;
+		}
+
+		range_bounds gather_bounds(const build_context& ctx, const unsigned begin, const unsigned end) {
+			range_bounds result;
+			for (unsigned i = begin; i < end; ++i) {
+				result.bounds.grow(ctx.bounds[ctx.indices[i]]);
+				result.centroids.grow(ctx.centroids[ctx.indices[i]]);
+			}
+			return result;
+		}
+
+		range_bounds gather_bounds(const build_context& ctx, thread_pool& pool, const unsigned begin, const unsigned end) {
+			std::vector<range_bounds> parts(chunk_count(end - begin));
+			for_chunks(&pool, begin, end, [&](const int chunk, const unsigned first, const unsigned last) {
+				parts[chunk] = gather_bounds(ctx, first, last);
+			});
+
+			range_bounds result;
+			for (const range_bounds& part : parts) result.grow(part);
+			return result;
+		}
+
+		void fill_bins(const build_context& ctx, const bin_mapping& map, const unsigned begin, const unsigned end, split_bins& bins) {
+			for (unsigned i = begin; i < end; ++i) {
+				const unsigned idx = ctx.indices[i];
+				const vec3f& c = ctx.centroids[idx];
+				for (int axis = 0; axis < 3; ++axis) {
+					bin& b = bins.bins[axis][map(c, axis)];
+					b.bounds.grow(ctx.bounds[idx]);
+					b.count++;
+				}
+			}
+		}
+
+		void fill_bins(const build_context& ctx, thread_pool& pool, const bin_mapping& map, const unsigned begin, const unsigned end, split_bins& bins) {
+			std::vector<split_bins> parts(chunk_count(end - begin));
+			for_chunks(&pool, begin, end, [&](const int chunk, const unsigned first, const unsigned last) {
+				fill_bins(ctx, map, first, last, parts[chunk]);
+			});
+
+			for (const split_bins& part : parts) bins.grow(part);
+		}
+
+		//cheapest split plane over all axes
+		split find_split(const build_context& ctx, const split_bins& bins, const vec3f& cExtent) {
+			split best;
+			for (int axis = 0; axis < 3; ++axis) {
+				if (cExtent[axis] <= 0.0f) continue;
+				const bin* axisBins = bins.bins[axis];
+
+				//sweep from both sides, leftArea[i] covers bins [0, i]
+				float leftArea[BVH_BINS - 1];
+				int leftCount[BVH_BINS - 1];
+				aabb acc;
+				int n = 0;
+				for (int i = 0; i < BVH_BINS - 1; ++i) {
+					acc.grow(axisBins[i].bounds);
+					n += axisBins[i].count;
+					leftArea[i] = acc.area();
+					leftCount[i] = n;
+				}
+
+				acc = aabb();
+				n = 0;
+				for (int i = BVH_BINS - 1; i > 0; --i) {
+					acc.grow(axisBins[i].bounds);
+					n += axisBins[i].count;
+					if (n == 0 || leftCount[i - 1] == 0) continue;
+
+					const float cost = leftArea[i - 1] * ctx.blocks(leftCount[i - 1]) + acc.area() * ctx.blocks(n);
+					if (cost < best.cost) {
+						best.cost = cost;
+						best.axis = axis;
+						best.bin = i;
+					}
+				}
+			}
+
+			return best;
+		}
+
+		//stable two pass partition: every chunk counts its left side, then scatters into its slots of a scratch copy
+		template <typename Pred>
+		unsigned parallel_partition(const build_context& ctx, thread_pool& pool, const unsigned begin, const unsigned end, Pred&& isLeft) {
+			const int chunks = chunk_count(end - begin);
+			std::vector<unsigned> leftCounts(chunks);
+			for_chunks(&pool, begin, end, [&](const int chunk, const unsigned first, const unsigned last) {
+				unsigned n = 0;
+				for (unsigned i = first; i < last; ++i) n += isLeft(ctx.indices[i]) ? 1 : 0;
+				leftCounts[chunk] = n;
+			});
+
+			unsigned totalLeft = 0;
+			for (const unsigned n : leftCounts) totalLeft += n;
+
+			std::vector<unsigned> leftOffsets(chunks), rightOffsets(chunks);
+			unsigned left = 0, right = totalLeft;
+			for (int c = 0; c < chunks; ++c) {
+				leftOffsets[c] = left;
+				rightOffsets[c] = right;
+				left += leftCounts[c];
+				right += std::min(BVH_CHUNK, end - begin - (unsigned) c * BVH_CHUNK) - leftCounts[c];
+			}
+
+			std::vector<unsigned> scratch(end - begin);
+			for_chunks(&pool, begin, end, [&](const int chunk, const unsigned first, const unsigned last) {
+				unsigned l = leftOffsets[chunk], r = rightOffsets[chunk];
+				for (unsigned i = first; i < last; ++i) {
+					const unsigned idx = ctx.indices[i];
+					scratch[isLeft(idx) ? l++ : r++] = idx;
+				}
+			});
+
+			for_chunks(&pool, begin, end, [&](const int, const unsigned first, const unsigned last) {
+				std::copy(scratch.begin() + (first - begin), scratch.begin() + (last - begin), ctx.indices + first);
+			});
+
+			return begin + totalLeft;
+		}
+
+		//binned sah, deferred is null for serial builds and inside subtree tasks
+		void build_sah(const build_context& ctx, std::vector<bvh_node>& nodes, const unsigned nodeIdx, const unsigned begin, const unsigned end, const int depth, std::vector<subtree>* deferred) {
+			const unsigned count = end - begin;
+			if (deferred && count <= ctx.grain) {
+				deferred->push_back({ nodeIdx, begin, end, depth, {} });
+				return;
+			}
+
+			thread_pool* pool = deferred && count >= BVH_PARALLEL_NODE ? ctx.pool : nullptr;
+			const range_bounds range = pool ? gather_bounds(ctx, *pool, begin, end) : gather_bounds(ctx, begin, end);
+			set_bounds(nodes[nodeIdx], range.bounds);
+
+			if (count <= 2 || depth >= BVH_MAX_DEPTH - 1) {
+				make_leaf(nodes[nodeIdx], begin, end);
+				return;
+			}
+
+			const bin_mapping map(range.centroids);
+			split_bins bins;
+			if (pool) fill_bins(ctx, *pool, map, begin, end, bins);
+			else fill_bins(ctx, map, begin, end, bins);
+
+			const split best = find_split(ctx, bins, range.centroids.extent());
+			const float leafCost = BVH_INTERSECTION_COST * ctx.blocks(count);
+			const float area = range.bounds.area();
+			const float splitCost = best.axis < 0 ? FLT_MAX :
+				BVH_TRAVERSAL_COST + BVH_INTERSECTION_COST * best.cost / (area > 0.0f ? area : 1.0f);
+
+			unsigned mid;
+			if (best.axis < 0) {
+				//all centroids coincide, binning cannot separate them
+				if (count <= BVH_MAX_LEAF_SIZE) {
+					make_leaf(nodes[nodeIdx], begin, end);
+					return;
+				}
+
+				mid = begin + count / 2;
+			} else {
+				if (splitCost >= leafCost && count <= BVH_MAX_LEAF_SIZE) {
+					make_leaf(nodes[nodeIdx], begin, end);
+					return;
+				}
+
+				const auto isLeft = [&](const unsigned idx) { return map(ctx.centroids[idx], best.axis) < best.bin; };
+				mid = pool ? parallel_partition(ctx, *pool, begin, end, isLeft) :
+					(unsigned) (std::partition(ctx.indices + begin, ctx.indices + end, isLeft) - ctx.indices);
+			}
+
+			//depth first layout: left child follows its parent, right child after the left subtree
+			const unsigned left = (unsigned) nodes.size();
+			nodes.emplace_back();
+			build_sah(ctx, nodes, left, begin, mid, depth + 1, deferred);
+
+			const unsigned right = (unsigned) nodes.size();
+			nodes.emplace_back();
+			build_sah(ctx, nodes, right, mid, end, depth + 1, deferred);
+
+			bvh_node& node = nodes[nodeIdx];
+			node.offset = right;
+			node.count = 0;
+		}
+
+		//spreads the low 10 bits so two zero bits follow each of them
+		uint32_t expand_bits(uint32_t v) {
+			v = (v * 0x00010001u) & 0xFF0000FFu;
+			v = (v * 0x00000101u) & 0x0F00F00Fu;
+			v = (v * 0x00000011u) & 0xC30C30C3u;
+			v = (v * 0x00000005u) & 0x49249249u;
+			return v;
+		}
+
+		//30 bit morton code of a point inside [0, 1]^3
+		uint32_t morton_code(const vec3f& p) {
+			const auto quantize = [](const float f) {
+				return (uint32_t) std::min(std::max(f * (1 << MORTON_BITS), 0.0f), (float) ((1 << MORTON_BITS) - 1));
+			};
+			return expand_bits(quantize(p.x())) << 2 | expand_bits(quantize(p.y())) << 1 | expand_bits(quantize(p.z()));
+		}
+
+		//sorts the primitive references along the morton curve of their centroids
+		void sort_morton(build_context& ctx, const unsigned count) {
+			const range_bounds range = ctx.pool ? gather_bounds(ctx, *ctx.pool, 0, count) : gather_bounds(ctx, 0, count);
+			//one scale for all axes keeps the cells cubic, flat scenes would otherwise get coarse cells along their long axes
+			const vec3f e = range.centroids.extent();
+			const float extent = std::max(e.x(), std::max(e.y(), e.z()));
+			const float scale = extent > 0.0f ? 1.0f / extent : 0.0f;
+
+			std::vector<uint64_t> keys(count);
+			for_chunks(ctx.pool, 0, count, [&](const int, const unsigned first, const unsigned last) {
+				for (unsigned i = first; i < last; ++i) {
+					const vec3f p = (ctx.centroids[i] - range.centroids.min) * scale;
+					keys[i] = (uint64_t) morton_code(p) << 32 | i;
+				}
+			});
+
+			//the primitive index below the code keeps equal codes in order
+			radix_sort(keys, 32, 32 + 3 * MORTON_BITS, ctx.pool);
+
+			ctx.codes.resize(count);
+			for_chunks(ctx.pool, 0, count, [&](const int, const unsigned first, const unsigned last) {
+				for (unsigned i = first; i < last; ++i) {
+					ctx.codes[i] = (uint32_t) (keys[i] >> 32);
+					ctx.indices[i] = (unsigned) keys[i];
+				}
+			});
+		}
+
+		//linear bvh, every node splits its sorted range where the highest differing morton bit flips.
+		//returns the node bounds, deferred subtrees return an empty box and are fixed up when spliced
+		aabb build_lbvh(const build_context& ctx, std::vector<bvh_node>& nodes, const unsigned nodeIdx, const unsigned begin, const unsigned end, const int depth, std::vector<subtree>* deferred) {
+			const unsigned count = end - begin;
+			if (deferred && count <= ctx.grain) {
+				deferred->push_back({ nodeIdx, begin, end, depth, {} });
+				return aabb();
+			}
+
+			if (count <= (unsigned) ctx.leafBlockSize || depth >= BVH_MAX_DEPTH - 1) {
+				aabb b;
+				for (unsigned i = begin; i < end; ++i) b.grow(ctx.bounds[ctx.indices[i]]);
+				set_bounds(nodes[nodeIdx], b);
+				make_leaf(nodes[nodeIdx], begin, end);
+				return b;
+			}
+
+			const uint32_t* codes = ctx.codes.data();
+			const uint32_t diff = codes[begin] ^ codes[end - 1];
+			unsigned mid = begin + count / 2; //identical codes, split in the middle
+			if (diff != 0) {
+				int bit = 31;
+				while (!(diff >> bit & 1u)) --bit;
+
+				//the range shares all higher bits, so codes with this bit cleared come first
+				const uint32_t mask = 1u << bit;
+				mid = (unsigned) (std::partition_point(codes + begin, codes + end, [&](const uint32_t c) { return (c & mask) == 0; }) - codes);
+			}
+
+			const unsigned left = (unsigned) nodes.size();
+			nodes.emplace_back();
+			aabb b = build_lbvh(ctx, nodes, left, begin, mid, depth + 1, deferred);
+
+			const unsigned right = (unsigned) nodes.size();
+			nodes.emplace_back();
+			b.grow(build_lbvh(ctx, nodes, right, mid, end, depth + 1, deferred));
+
+			bvh_node& node = nodes[nodeIdx];
+			set_bounds(node, b);
+			node.offset = right;
+			node.count = 0;
+			return b;
+		}
+
+		//copies the top levels depth first, replacing placeholders by their subtrees, and returns the node bounds
+		aabb splice(const std::vector<bvh_node>& top, const std::vector<int>& taskOf, const std::vector<subtree>& subtrees, const unsigned nodeIdx, std::vector<bvh_node>& out) {
+			if (taskOf[nodeIdx] >= 0) {
+				const subtree& s = subtrees[taskOf[nodeIdx]];
+				const unsigned base = (unsigned) out.size();
+				for (bvh_node node : s.nodes) {
+					if (!node.is_leaf()) node.offset += base;
+					out.push_back(node);
+				}
+				return node_bounds(s.nodes[0]);
+			}
+
+			const bvh_node& node = top[nodeIdx];
+			const unsigned at = (unsigned) out.size();
+			out.push_back(node);
+			if (node.is_leaf()) return node_bounds(node);
+
+			aabb b = splice(top, taskOf, subtrees, nodeIdx + 1, out);
+			out[at].offset = (unsigned) out.size();
+			b.grow(splice(top, taskOf, subtrees, node.offset, out));
+			set_bounds(out[at], b);
+			return b;
+		}
+	}
+
+
+	aabb bvh::bounds() const {
+		if (nodes.empty()) return aabb();
+		return node_bounds(nodes[0]);
+	}
+
+	void build_bvh(bvh& tree, const aabb* bounds, const size_t count, const int leafBlockSize, const bvh_builder builder, thread_pool* pool) {
+		tree.nodes.clear();
+		tree.indices.resize(count);
+		if (count == 0) return;
+
+		if (count < BVH_PARALLEL_BUILD) pool = nullptr;
+		build_context ctx { bounds, std::vector<vec3f>(count), tree.indices.data(), std::max(leafBlockSize, 1), pool, 0, {} };
+		for_chunks(pool, 0, (unsigned) count, [&](const int, const unsigned first, const unsigned last) {
+			for (unsigned i = first; i < last; ++i) {
+				ctx.indices[i] = i;
+				ctx.centroids[i] = bounds[i].center();
+			}
+		});
+
+		if (builder == BVH_BUILDER_LBVH) sort_morton(ctx, (unsigned) count);
+
+		const auto build = [&](std::vector<bvh_node>& nodes, const unsigned begin, const unsigned end, const int depth, std::vector<subtree>* deferred) {
+			nodes.emplace_back();
+			if (builder == BVH_BUILDER_LBVH) build_lbvh(ctx, nodes, 0, begin, end, depth, deferred);
+			else build_sah(ctx, nodes, 0, begin, end, depth, deferred);
+		};
+
+		if (!pool) {
+			tree.nodes.reserve(2 * count);
+			build(tree.nodes, 0, (unsigned) count, 0, nullptr);
+			tree.nodes.shrink_to_fit();
+			return;
+		}
+
+		//the top levels are split on the calling thread with parallel binning and partitioning, which leaves
+		//enough independent subtrees to keep every worker busy while they are built serially
+		ctx.grain = std::max(BVH_MIN_TASK, (unsigned) (count / (8 * (size_t) pool->size())));
+		std::vector<bvh_node> top;
+		std::vector<subtree> subtrees;
+		build(top, 0, (unsigned) count, 0, &subtrees);
+
+		pool->run((int) subtrees.size(), [&](const int task, const int) {
+			subtree& s = subtrees[task];
+			s.nodes.reserve(2 * (s.end - s.begin));
+			build(s.nodes, s.begin, s.end, s.depth, nullptr);
+		});
+
+		std::vector<int> taskOf(top.size(), -1);
+		size_t total = top.size();
+		for (size_t i = 0; i < subtrees.size(); ++i) {
+			taskOf[subtrees[i].node] = (int) i;
+			total += subtrees[i].nodes.size() - 1;
+		}
+
+		tree.nodes.reserve(total);
+		splice(top, taskOf, subtrees, 0, tree.nodes);
+	}
+
+	void refit_bvh(bvh& tree, const aabb* bounds) {
+		//children are stored after their parent, so a reverse sweep visits them first
+		for (size_t i = tree.nodes.size(); i-- > 0;) {
+			bvh_node& node = tree.nodes[i];
+			aabb b;
+			if (node.is_leaf()) {
+				for (unsigned k = node.offset; k < node.offset + node.count; ++k) b.grow(bounds[tree.indices[k]]);
+			} else {
+				b = node_bounds(tree.nodes[i + 1]);
+				b.grow(node_bounds(tree.nodes[node.offset]));
+			}
+
+			set_bounds(node, b);
+		}
+	}
+
+	float sah_cost(const bvh& tree) {
+		if (tree.empty()) return 0.0f;
+
+		const float rootArea = tree.bounds().area();
+		if (rootArea <= 0.0f) return 0.0f;
+
+		double cost = 0.0;
+		for (const bvh_node& node : tree.nodes) {
+			const double rel = node_bounds(node).area() / rootArea;
+			cost += node.is_leaf() ? rel * BVH_INTERSECTION_COST * node.count : rel * BVH_TRAVERSAL_COST;
+		}
+
+		return (float) cost;
+	}
+}
@@ -0,0 +1,120 @@
+﻿#pragma once
+#include "ray.h"
+
+#include <vector>
+
+namespace raytracer {
+	struct thread_pool;
+
+	//32 byte node, children of an interior node are stored depth-first:
+	//the first child directly follows its parent, offset points to the second child
+	struct bvh_node {
+		float min[3];
+		unsigned offset; //leaf: first index into bvh::indices, interior: index of second child
+		float max[3];
+		unsigned count; //leaf: number of primitives, interior: 0
+
+		bool is_leaf() const { return count != 0; }
+	};
+
+	struct bvh {
+		std::vector<bvh_node> nodes;
+		std::vector<unsigned> indices; //primitive references, leaves point into this array
+
+		bool empty() const { return nodes.empty(); }
+		aabb bounds() const;
+	};
+
+	constexpr int BVH_BINS = 16;
+	constexpr int BVH_MAX_LEAF_SIZE = 8;
+	constexpr int BVH_MAX_DEPTH = 64; //deeper subtrees are collapsed into a single leaf
+	constexpr float BVH_TRAVERSAL_COST = 1.0f;
+	constexpr float BVH_INTERSECTION_COST = 1.0f;
+
+	enum bvh_builder {
+		BVH_BUILDER_SAH, //binned surface area heuristic, the fastest trees to trace
+		BVH_BUILDER_LBVH, //morton ordered linear bvh, several times faster to build but slower to trace
+	};
+
+	//builds over the given primitive bounds. leafBlockSize is the number of primitives a leaf intersects
+	//at the cost of one, so simd leaves are filled up instead of being split further. with a pool large
+	//builds run on all of its workers, so it can not be called from one of the pool's own tasks then
+	void build_bvh(bvh& tree, const aabb* bounds, const size_t count, const int leafBlockSize = 1,
+		const bvh_builder builder = BVH_BUILDER_SAH, thread_pool* pool = nullptr);
+
+	//recomputes all node bounds bottom up for primitives that moved, keeping the topology.
+	//only valid while leaves still reference bvh::indices (not after build_triangle_blocks)
+	void refit_bvh(bvh& tree, const aabb* bounds);
+
+	//surface area heuristic cost of the whole tree, useful to compare builds
+	float sah_cost(const bvh& tree);
+
+
+	//slab test, returns the entry distance or FLT_MAX on a miss
+	inline float intersect_node(const bvh_node& node, const vec3f& origin, const vec3f& invDir, const float tmax) {
+		float tmin = 0.0f;
+		float tfar = tmax;
+		for (int i = 0; i < 3; ++i) {
+			const float t0 = (node.min[i] - origin[i]) * invDir[i];
+			const float t1 = (node.max[i] - origin[i]) * invDir[i];
+			tmin = std::max(tmin, std::min(t0, t1));
+			tfar = std::min(tfar, std::max(t0, t1));
+		}
+
+		return tmin <= tfar ? tmin : FLT_MAX;
+	}
+
+	inline vec3f safe_inverse(const vec3f& d) {
+		//avoid infinities of opposite sign producing nans in the slab test
+		const auto inv = [](const float f) { return 1.0f / (std::fabs(f) > 1e-20f ? f : std::copysign(1e-20f, f)); };
+		return vec3f(inv(d.x()), inv(d.y()), inv(d.z()));
+	}
+
+	//closest hit traversal, leaf(first, count, h) intersects the referenced primitives and updates h
+	template <typename Leaf>
+	void traverse(const bvh& tree, const ray& r, hit& h, Leaf&& leaf) {
+		if (tree.empty()) return;
+
+		const vec3f invDir = safe_inverse(r.direction);
+		unsigned stack[BVH_MAX_DEPTH];
+		int stackSize = 0;
+		unsigned current = 0;
+
+		if (intersect_node(tree.nodes[0], r.origin, invDir, h.t) == FLT_MAX) return;
+
+		while (true) {
+			const bvh_node& node = tree.nodes[current];
+
+			if (node.is_leaf()) {
+				leaf(node.offset, node.count, h);
+			} else {
+				unsigned first = current + 1;
+				unsigned second = node.offset;
+				float dNear = intersect_node(tree.nodes[first], r.origin, invDir, h.t);
+				float dFar = intersect_node(tree.nodes[second], r.origin, invDir, h.t);
+				if (dFar < dNear) {
+					std::swap(first, second);
+					std::swap(dNear, dFar);
+				}
+
+				if (dNear != FLT_MAX) {
+					if (dFar != FLT_MAX) stack[stackSize++] = second;
+					current = first;
+					continue;
+				}
+			}
+
+			//pop until we find a node that is still in front of the closest hit
+			bool found = false;
+			while (stackSize > 0) {
+				current = stack[--stackSize];
+				if (intersect_node(tree.nodes[current], r.origin, invDir, h.t) != FLT_MAX) {
+					found = true;
+					break;
+				}
+			}
+
+			if (!found) return;
+		}
+	}
+}
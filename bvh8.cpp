@@ -0,0 +1,180 @@
+﻿#include "bvh8.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+namespace raytracer {
+
+	namespace {
+		//part of the binary tree waiting to become a slot: a node, or a range of blocks with the bounds of its leaf
+		struct collapse_item {
+			aabb bounds;
+			unsigned node; //UINT_MAX for block ranges
+			unsigned first;
+			unsigned count;
+
+			//interior nodes open up into their children, ranges too large for one slot are halved
+			bool expandable() const {
+				return node != UINT_MAX || count > BVH8_MAX_LEAF_BLOCKS;
+			}
+		};
+
+		struct collapse_context {
+			const bvh& tree;
+			const std::vector<triangle_block>& source;
+			std::vector<triangle_block> blocks;
+			bvh8& wide;
+		};
+
+		aabb node_bounds(const bvh_node& node) {
+			aabb b;
+			b.min = vec3f(node.min[0], node.min[1], node.min[2]);
+			b.max = vec3f(node.max[0], node.max[1], node.max[2]);
+			return b;
+		}
+
+		collapse_item make_item(const bvh& tree, const unsigned nodeIdx) {
+			const bvh_node& node = tree.nodes[nodeIdx];
+			if (node.is_leaf()) return { node_bounds(node), UINT_MAX, node.offset, node.count };
+			return { node_bounds(node), nodeIdx, 0, 0 };
+		}
+
+		//opens the item with the largest surface area until all slots are used or nothing can be opened
+		int gather_children(const bvh& tree, const collapse_item& root, collapse_item* items) {
+			int count = 1;
+			items[0] = root;
+			while (count < BVH8_WIDTH) {
+				int best = -1;
+				for (int i = 0; i < count; ++i) {
+					if (items[i].expandable() && (best < 0 || items[i].bounds.area() > items[best].bounds.area())) best = i;
+				}
+				if (best < 0) break;
+
+				const collapse_item item = items[best];
+				if (item.node != UINT_MAX) {
+					items[best] = make_item(tree, item.node + 1);
+					items[count++] = make_item(tree, tree.nodes[item.node].offset);
+				} else {
+					const unsigned half = item.count / 2;
+					items[best] = { item.bounds, UINT_MAX, item.first, half };
+					items[count++] = { item.bounds, UINT_MAX, item.first + half, item.count - half };
+				}
+			}
+
+			//interior children take the first slots
+			std::stable_partition(items, items + count, [](const collapse_item& item) { return item.expandable(); });
+			return count;
+		}
+
+		//grid over the node bounds, children round outwards so decoding never shrinks them
+		void quantize(bvh8_node& node, const collapse_item* items, const int count) {
+			aabb bounds;
+			for (int i = 0; i < count; ++i) bounds.grow(items[i].bounds);
+
+			for (int axis = 0; axis < 3; ++axis) {
+				int exponent;
+				std::frexp((bounds.max[axis] - bounds.min[axis]) / 255.0f, &exponent);
+				node.exponent[axis] = (int8_t) std::min(std::max(exponent, -126), 127);
+				node.origin[axis] = bounds.min[axis];
+			}
+
+			for (int axis = 0; axis < 3; ++axis) {
+				const float origin = node.origin[axis];
+				const float cell = node.cell(axis);
+				for (int i = 0; i < BVH8_WIDTH; ++i) {
+					if (i >= count) {
+						node.lo[axis][i] = 0;
+						node.hi[axis][i] = 0;
+						continue;
+					}
+
+					int lo = std::max(0, (int) std::floor((items[i].bounds.min[axis] - origin) / cell));
+					int hi = std::min(255, (int) std::ceil((items[i].bounds.max[axis] - origin) / cell));
+					while (lo > 0 && origin + lo * cell > items[i].bounds.min[axis]) --lo;
+					while (hi < 255 && origin + hi * cell < items[i].bounds.max[axis]) ++hi;
+					node.lo[axis][i] = (uint8_t) lo;
+					node.hi[axis][i] = (uint8_t) hi;
+				}
+			}
+		}
+
+		void emit_node(collapse_context& ctx, const unsigned nodeIdx, const collapse_item& root) {
+			collapse_item items[BVH8_WIDTH];
+			const int count = gather_children(ctx.tree, root, items);
+
+			bvh8_node node = {};
+			quantize(node, items, count);
+
+			//interior children are allocated together, so the node only needs the index of the first
+			node.childBase = (unsigned) ctx.wide.nodes.size();
+			node.blockBase = (unsigned) ctx.blocks.size();
+			int interior = 0;
+			for (int i = 0; i < count; ++i) {
+				if (items[i].expandable()) {
+					interior++;
+					continue;
+				}
+
+				node.blockCount[i] = (uint8_t) items[i].count;
+				ctx.blocks.insert(ctx.blocks.end(), ctx.source.begin() + items[i].first, ctx.source.begin() + items[i].first + items[i].count);
+			}
+
+			node.slots = (uint8_t) (interior | count << 4);
+			ctx.wide.nodes.resize(ctx.wide.nodes.size() + interior);
+			ctx.wide.nodes[nodeIdx] = node;
+			for (int i = 0; i < interior; ++i) emit_node(ctx, node.childBase + i, items[i]);
+		}
+	}
+
+
+	aabb bvh8_node::child_bounds(const int slot) const {
+		aabb b;
+		for (int axis = 0; axis < 3; ++axis) {
+			b.min[axis] = origin[axis] + lo[axis][slot] * cell(axis);
+			b.max[axis] = origin[axis] + hi[axis][slot] * cell(axis);
+		}
+		return b;
+	}
+
+	void collapse_bvh8(const bvh& tree, std::vector<triangle_block>& blocks, bvh8& wide) {
+		wide.nodes.clear();
+		wide.box = tree.bounds();
+		if (tree.empty()) return;
+
+		collapse_context ctx { tree, blocks, {}, wide };
+		ctx.blocks.reserve(blocks.size());
+		wide.nodes.reserve(tree.nodes.size() / 4 + 1);
+
+		//a root leaf becomes a wide root with that leaf as its only child
+		wide.nodes.emplace_back();
+		collapse_item root = make_item(tree, 0);
+		emit_node(ctx, 0, root);
+
+		wide.nodes.shrink_to_fit();
+		blocks.swap(ctx.blocks);
+	}
+
+	float sah_cost(const bvh8& tree) {
+		if (tree.empty()) return 0.0f;
+
+		const float rootArea = tree.bounds().area();
+		if (rootArea <= 0.0f) return 0.0f;
+
+		double cost = 0.0;
+		for (const bvh8_node& node : tree.nodes) {
+			aabb b;
+			const int mask = node.child_mask();
+			for (int slot = 0; slot < BVH8_WIDTH; ++slot) {
+				if (!(mask >> slot & 1)) continue;
+
+				const aabb child = node.child_bounds(slot);
+				b.grow(child);
+				if (slot >= node.interior_count()) cost += child.area() / rootArea * BVH_INTERSECTION_COST * node.blockCount[slot];
+			}
+			cost += b.area() / rootArea * BVH_TRAVERSAL_COST;
+		}
+
+		return (float) cost;
+	}
+}
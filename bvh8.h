@@ -0,0 +1,142 @@
+﻿#pragma once
+#include "simd.h"
+#include "triangles.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace raytracer {
+	constexpr int BVH8_WIDTH = 8;
+	constexpr int BVH8_MAX_LEAF_BLOCKS = 255; //blocks one leaf slot can reference
+	constexpr int BVH8_STACK_SIZE = (BVH8_WIDTH - 1) * BVH_MAX_DEPTH + 1;
+
+	//80 byte node of an 8 wide bvh. child boxes are 8 bit coordinates on a grid spanning the node with a power of
+	//two cell size per axis and decode conservatively to origin + q * 2^exponent. interior children take the first
+	//slots and are stored consecutively from childBase, the blocks of the leaf children follow each other from
+	//blockBase in slot order. unused slots are at the end
+	struct bvh8_node {
+		float origin[3];
+		int8_t exponent[3];
+		uint8_t slots; //low nibble: interior children, high nibble: children in use
+		unsigned childBase;
+		unsigned blockBase;
+		uint8_t blockCount[BVH8_WIDTH]; //leaf slots only
+		uint8_t lo[3][BVH8_WIDTH];
+		uint8_t hi[3][BVH8_WIDTH];
+
+		//2^exponent, built from the bits since exponents stay within the normal range
+		float cell(const int axis) const {
+			const uint32_t bits = (uint32_t) (exponent[axis] + 127) << 23;
+			float result;
+			memcpy(&result, &bits, sizeof(result));
+			return result;
+		}
+
+		int interior_count() const { return slots & 15; }
+		int child_count() const { return slots >> 4; }
+		int child_mask() const { return (1 << child_count()) - 1; }
+
+		aabb child_bounds(const int slot) const;
+	};
+
+	static_assert(sizeof(bvh8_node) == 80, "bvh8_node is meant to fit 80 bytes");
+
+	struct bvh8 {
+		std::vector<bvh8_node> nodes;
+		aabb box; //exact bounds, the quantized children of the root are slightly larger
+
+		bool empty() const { return nodes.empty(); }
+		aabb bounds() const { return box; }
+	};
+
+	//collapses a binary bvh whose leaves reference triangle blocks (see build_triangle_blocks) into an 8 wide one,
+	//pulling up the largest children first. blocks are reordered so every node's leaves are contiguous
+	void collapse_bvh8(const bvh& tree, std::vector<triangle_block>& blocks, bvh8& wide);
+
+	//surface area heuristic cost with one traversal step per wide node and one intersection per block
+	float sah_cost(const bvh8& tree);
+
+
+	//stack entry of the wide traversals, count is 0 for nodes and the number of blocks for leaves
+	struct bvh8_entry {
+		unsigned index;
+		unsigned count;
+		float distance;
+	};
+
+	//pushes the children in mask so that the nearest one is popped first
+	inline void push_children(const bvh8_node& node, int mask, const float* distance, bvh8_entry* stack, int& stackSize) {
+		bvh8_entry entries[BVH8_WIDTH];
+		int count = 0;
+		unsigned block = node.blockBase;
+		for (int slot = 0; mask != 0; ++slot, mask >>= 1) {
+			const bool interior = slot < node.interior_count();
+			if (mask & 1) {
+				bvh8_entry e = interior ? bvh8_entry { node.childBase + slot, 0u, distance[slot] } : bvh8_entry { block, node.blockCount[slot], distance[slot] };
+
+				//insertion sort, farthest first
+				int i = count++;
+				for (; i > 0 && entries[i - 1].distance < e.distance; --i) entries[i] = entries[i - 1];
+				entries[i] = e;
+			}
+			if (!interior) block += node.blockCount[slot];
+		}
+
+		for (int i = 0; i < count; ++i) stack[stackSize++] = entries[i];
+	}
+
+	//slab test of one ray against all children, returns the mask of the ones it enters before tmax
+	template <typename simd>
+	int intersect_children(const bvh8_node& node, const vec3f& origin, const vec3f& invDir, const float tmax, float* distance) {
+		simd cell[3], base[3];
+		bool positive[3];
+		for (int axis = 0; axis < 3; ++axis) {
+			cell[axis] = simd(node.cell(axis) * invDir[axis]);
+			base[axis] = simd((node.origin[axis] - origin[axis]) * invDir[axis]);
+			positive[axis] = invDir[axis] >= 0.0f;
+		}
+
+		int mask = 0;
+		for (int c = 0; c < BVH8_WIDTH; c += simd::width) {
+			simd tmin(0.0f), tfar(tmax);
+			for (int axis = 0; axis < 3; ++axis) {
+				const simd entry = simd::load_bytes((positive[axis] ? node.lo : node.hi)[axis] + c);
+				const simd exit = simd::load_bytes((positive[axis] ? node.hi : node.lo)[axis] + c);
+				tmin = vmax(tmin, entry * cell[axis] + base[axis]);
+				tfar = vmin(tfar, exit * cell[axis] + base[axis]);
+			}
+
+			tmin.store(distance + c);
+			mask |= movemask(tmin <= tfar) << c;
+		}
+
+		return mask & node.child_mask();
+	}
+
+	//closest hit traversal, leaf(first, count, h) intersects the referenced blocks and updates h
+	template <typename Leaf>
+	void traverse(const bvh8& tree, const ray& r, hit& h, Leaf&& leaf) {
+		if (tree.empty()) return;
+
+		const vec3f invDir = safe_inverse(r.direction);
+		bvh8_entry stack[BVH8_STACK_SIZE];
+		int stackSize = 0;
+		stack[stackSize++] = { 0, 0, 0.0f };
+
+		alignas(32) float distance[BVH8_WIDTH];
+		while (stackSize > 0) {
+			const bvh8_entry e = stack[--stackSize];
+			if (e.distance >= h.t) continue;
+
+			if (e.count != 0) {
+				leaf(e.index, e.count, h);
+				continue;
+			}
+
+			const bvh8_node& node = tree.nodes[e.index];
+			const int mask = intersect_children<simdf>(node, r.origin, invDir, h.t, distance);
+			push_children(node, mask, distance, stack, stackSize);
+		}
+	}
+}
@@ -0,0 +1,146 @@
+﻿#include "bvh_cache.h"
+#include "mesh_file.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace raytracer {
+
+	namespace {
+		constexpr size_t HASH_CHUNK = 1 << 20; //bytes hashed by one task
+		constexpr uint64_t HASH_PRIME_1 = 0x9E3779B185EBCA87ull;
+		constexpr uint64_t HASH_PRIME_2 = 0xC2B2AE3D27D4EB4Full;
+		constexpr size_t SECTION_ALIGNMENT = 64;
+
+		uint64_t rotl(const uint64_t v, const int bits) {
+			return v << bits | v >> (64 - bits);
+		}
+
+		//final avalanche of murmur3
+		uint64_t fmix(uint64_t h) {
+			h ^= h >> 33;
+			h *= 0xFF51AFD7ED558CCDull;
+			h ^= h >> 33;
+			h *= 0xC4CEB9FE1A85EC53ull;
+			h ^= h >> 33;
+			return h;
+		}
+
+		uint64_t hash_bytes(const uint8_t* data, const size_t size, uint64_t h) {
+			size_t i = 0;
+			for (; i + 8 <= size; i += 8) {
+				uint64_t word;
+				memcpy(&word, data + i, 8);
+				h = rotl(h ^ word * HASH_PRIME_2, 31) * HASH_PRIME_1;
+			}
+			for (; i < size; ++i) h = rotl(h ^ data[i] * HASH_PRIME_2, 31) * HASH_PRIME_1;
+			return fmix(h ^ size);
+		}
+
+		uint64_t combine(const uint64_t h, const uint64_t value) {
+			return rotl(h ^ fmix(value), 27) * HASH_PRIME_1;
+		}
+
+		size_t align_section(const size_t offset) {
+			return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+		}
+
+		std::string cache_path(const char* directory, const uint64_t key) {
+			char name[32];
+			snprintf(name, sizeof(name), "%016llx.rtbv", (unsigned long long) key);
+
+			std::string path = directory;
+			if (!path.empty() && path.back() != '/' && path.back() != '\\') path += '/';
+			return path + name;
+		}
+
+		bool write_padding(FILE* file, const size_t offset) {
+			static const uint8_t zeros[SECTION_ALIGNMENT] = {};
+			const size_t padding = align_section(offset) - offset;
+			return padding == 0 || fwrite(zeros, 1, padding, file) == padding;
+		}
+	}
+
+
+	uint64_t mesh_cache_key(const triangle_mesh& mesh, const bvh_builder builder, thread_pool* pool) {
+		//vertices and then indices, split into chunks that never span both
+		const uint8_t* sections[2] = { mesh.quantized ? (const uint8_t*) mesh.quantized : (const uint8_t*) mesh.vertices, (const uint8_t*) mesh.indices };
+		const size_t bytes[2] = { mesh.vertex_bytes(), mesh.index_bytes() };
+		const size_t vertexChunks = (bytes[0] + HASH_CHUNK - 1) / HASH_CHUNK;
+		std::vector<uint64_t> chunks(vertexChunks + (bytes[1] + HASH_CHUNK - 1) / HASH_CHUNK);
+		const auto hash_chunk = [&](const int chunk, const int) {
+			const int section = (size_t) chunk < vertexChunks ? 0 : 1;
+			const size_t first = ((size_t) chunk - (section == 0 ? 0 : vertexChunks)) * HASH_CHUNK;
+			chunks[chunk] = hash_bytes(sections[section] + first, std::min(HASH_CHUNK, bytes[section] - first), (uint64_t) chunk);
+		};
+
+		if (pool && chunks.size() > 1) pool->run((int) chunks.size(), hash_chunk);
+		else for (size_t c = 0; c < chunks.size(); ++c) hash_chunk((int) c, 0);
+
+		uint64_t h = combine(BVH_CACHE_VERSION, mesh.vertexCount);
+		h = combine(h, mesh.triangles);
+		h = combine(h, (uint64_t) builder);
+		h = combine(h, (uint64_t) TRIANGLE_BLOCK_WIDTH << 32 | sizeof(triangle_block) << 8 | sizeof(bvh8_node));
+		if (mesh.quantized) {
+			const float decode[6] = { mesh.origin.x(), mesh.origin.y(), mesh.origin.z(), mesh.scale.x(), mesh.scale.y(), mesh.scale.z() };
+			h = combine(h, hash_bytes((const uint8_t*) decode, sizeof(decode), 0));
+		}
+		for (const uint64_t chunk : chunks) h = combine(h, chunk);
+		return fmix(h);
+	}
+
+	bool load_cached_bvh(const char* directory, const uint64_t key, bvh8& tree, std::vector<triangle_block>& blocks) {
+		mapped_file file;
+		if (!file.open(cache_path(directory, key).c_str()) || file.size() < sizeof(bvh_cache_header)) return false;
+
+		const bvh_cache_header* header = (const bvh_cache_header*) file.data();
+		if (memcmp(header->magic, "RTBV", 4) != 0 || header->version != BVH_CACHE_VERSION || header->key != key) return false;
+		if (header->nodesOffset > file.size() || header->nodes > (file.size() - header->nodesOffset) / sizeof(bvh8_node)) return false;
+		if (header->blocksOffset > file.size() || header->blocks > (file.size() - header->blocksOffset) / sizeof(triangle_block)) return false;
+
+		const bvh8_node* nodes = (const bvh8_node*) (file.data() + header->nodesOffset);
+		const triangle_block* blockData = (const triangle_block*) (file.data() + header->blocksOffset);
+		tree.nodes.assign(nodes, nodes + header->nodes);
+		tree.box.min = vec3f(header->bounds[0], header->bounds[1], header->bounds[2]);
+		tree.box.max = vec3f(header->bounds[3], header->bounds[4], header->bounds[5]);
+		blocks.assign(blockData, blockData + header->blocks);
+		return true;
+	}
+
+	bool store_cached_bvh(const char* directory, const uint64_t key, const bvh8& tree, const std::vector<triangle_block>& blocks) {
+		bvh_cache_header header = {};
+		memcpy(header.magic, "RTBV", 4);
+		header.version = BVH_CACHE_VERSION;
+		header.key = key;
+		header.nodes = tree.nodes.size();
+		header.nodesOffset = align_section(sizeof(header));
+		header.blocks = blocks.size();
+		header.blocksOffset = align_section(header.nodesOffset + tree.nodes.size() * sizeof(bvh8_node));
+		for (int axis = 0; axis < 3; ++axis) {
+			header.bounds[axis] = tree.box.min[axis];
+			header.bounds[3 + axis] = tree.box.max[axis];
+		}
+
+		//written under a temporary name and renamed, so a concurrent reader never maps a partial file
+		const std::string path = cache_path(directory, key);
+		const std::string partial = path + ".part";
+		FILE* file = fopen(partial.c_str(), "wb");
+		if (!file) return false;
+
+		bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && write_padding(file, sizeof(header));
+		ok = ok && fwrite(tree.nodes.data(), sizeof(bvh8_node), tree.nodes.size(), file) == tree.nodes.size();
+		ok = ok && write_padding(file, header.nodesOffset + tree.nodes.size() * sizeof(bvh8_node));
+		ok = ok && fwrite(blocks.data(), sizeof(triangle_block), blocks.size(), file) == blocks.size();
+		if (fclose(file) != 0) ok = false;
+
+		if (ok) {
+			remove(path.c_str()); //rename does not replace existing files everywhere
+			ok = rename(partial.c_str(), path.c_str()) == 0;
+		}
+		if (!ok) remove(partial.c_str());
+		return ok;
+	}
+}
@@ -0,0 +1,38 @@
+﻿#pragma once
+#include "bvh8.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace raytracer {
+	struct thread_pool;
+
+	//built bottom level of one mesh: a 128 byte header, the flattened nodes and the triangle blocks.
+	//both sections are stored in memory layout and start 64 byte aligned, loading copies each of them with
+	//one bulk copy out of the mapping into the vectors the tracer uses
+	struct bvh_cache_header {
+		char magic[4]; //"RTBV"
+		uint32_t version;
+		uint64_t key; //mesh_cache_key the file was written for
+		uint64_t nodes; //bvh8_node
+		uint64_t nodesOffset;
+		uint64_t blocks;
+		uint64_t blocksOffset;
+		float bounds[6]; //exact min and max of the mesh
+		uint8_t reserved[56];
+	};
+
+	static_assert(sizeof(bvh_cache_header) == 128, "the sections have to stay cache line aligned");
+
+	//bump whenever the builders or the node and block layouts change, older files then miss
+	constexpr uint32_t BVH_CACHE_VERSION = 2;
+
+	//hash of the vertices, indices and everything else the built structure depends on. with a pool the data
+	//is hashed on all workers, so it can not be called from one of the pool's own tasks then
+	uint64_t mesh_cache_key(const triangle_mesh& mesh, const bvh_builder builder, thread_pool* pool = nullptr);
+
+	//cache files are named after their key inside directory, which has to exist.
+	//load returns false on a miss or a file that does not match the key
+	bool load_cached_bvh(const char* directory, const uint64_t key, bvh8& tree, std::vector<triangle_block>& blocks);
+	bool store_cached_bvh(const char* directory, const uint64_t key, const bvh8& tree, const std::vector<triangle_block>& blocks);
+}
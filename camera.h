@@ -0,0 +1,30 @@
+﻿#pragma once
+#include "maths.h"
+
+#include <cstdint>
+
+namespace raytracer {
+	//pinhole camera of one frame, right and up are prescaled so that screen coordinates in [-1, 1] span the image
+	struct pinhole_camera {
+		vec3f position;
+		vec3f forward;
+		vec3f right;
+		vec3f up;
+		int width;
+		int height;
+
+		//subpixel offset of this frame's samples from the pixel centers
+		float jitterX;
+		float jitterY;
+
+		//seeds the random numbers, so every sample of a pixel follows different paths
+		uint32_t sample;
+
+		//normalized direction of the ray through the sample of pixel (x, y)
+		vec3f direction(const int x, const int y) const {
+			const float sx = 2.0f * (x + 0.5f + jitterX) / width - 1.0f;
+			const float sy = 2.0f * (y + 0.5f + jitterY) / height - 1.0f;
+			return (forward + right * sx + up * sy).normalized();
+		}
+	};
+}
@@ -0,0 +1,212 @@
+﻿#include "denoise.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <pmmintrin.h>
+
+namespace raytracer {
+
+	namespace {
+		constexpr int PASSES = 5; //taps reach 1 << (PASSES - 1) pixels in the last pass
+		constexpr int BAND_ROWS = 8; //rows one pool task filters
+		constexpr float KERNEL[3] = { 1.0f / 4.0f, 1.0f / 2.0f, 1.0f / 4.0f };
+
+		//how fast the weight of a tap falls off with its difference to the center
+		constexpr float COLOR_SIGMA = 1.0f; //halved every pass
+		constexpr float ALBEDO_SIGMA = 0.1f;
+		constexpr float DEPTH_SIGMA = 0.02f; //relative to the center depth, per pixel of tap distance
+		constexpr int NORMAL_POWER_SQUARINGS = 6; //weight is the normals' cosine to the power of 64
+
+		enum feature { NX, NY, NZ, DEPTH, AR, AG, AB, FEATURES };
+		static_assert(FEATURES == PIXEL_FEATURES, "one plane per member of pixel_features");
+
+		//exp(-x) for x >= 0 as (1 + x / 16)^-16, close enough for weights and needs no lookup
+		template <typename simd>
+		simd exp_negative(const simd x) {
+			simd t = simd(1.0f) + x * simd(1.0f / 16.0f);
+			t = t * t;
+			t = t * t;
+			t = t * t;
+			t = t * t;
+			return simd(1.0f) / t;
+		}
+
+		//pixels [x, x + simd::width) of a row, those outside the image repeat the edge. only taps near the left
+		//and right edge need the slow path, so it is kept out of the loop
+		template <typename simd>
+		simd load_edge(const float* row, const int x, const int width) {
+			alignas(32) float lanes[simd::width];
+			for (int l = 0; l < simd::width; ++l) lanes[l] = row[std::min(std::max(x + l, 0), width - 1)];
+			return simd::load(lanes);
+		}
+
+		template <typename simd>
+		inline simd load_clamped(const float* row, const int x, const int width) {
+			if (x >= 0 && x + simd::width <= width) return simd::load_unaligned(row + x);
+			return load_edge<simd>(row, x, width);
+		}
+
+		struct pass_input {
+			const float* color[3];
+			float* result[3];
+			const float* features[FEATURES];
+			int stride;
+			int width;
+			int height;
+			int step;
+			float invColorSigma2;
+		};
+
+		template <typename simd>
+		void filter_rows(const pass_input& in, const int y0, const int y1) {
+			//high powers of the normal cosine and tiny weights end up denormal, which is many times slower
+			//to compute with. they are flushed to zero while filtering
+			const unsigned csr = _mm_getcsr();
+			_mm_setcsr(csr | _MM_FLUSH_ZERO_ON | _MM_DENORMALS_ZERO_ON);
+
+			const simd zero(0.0f), tiny(1e-20f);
+			const simd invAlbedoSigma2(1.0f / (ALBEDO_SIGMA * ALBEDO_SIGMA));
+			const simd invColorSigma2(in.invColorSigma2);
+
+			for (int y = y0; y < y1; ++y) {
+				const size_t row = (size_t) y * in.stride;
+				for (int x = 0; x < in.width; x += simd::width) {
+					const size_t p = row + x;
+					const simd cr = simd::load_unaligned(in.color[0] + p);
+					const simd cg = simd::load_unaligned(in.color[1] + p);
+					const simd cb = simd::load_unaligned(in.color[2] + p);
+					const simd nx = simd::load_unaligned(in.features[NX] + p);
+					const simd ny = simd::load_unaligned(in.features[NY] + p);
+					const simd nz = simd::load_unaligned(in.features[NZ] + p);
+					const simd z = simd::load_unaligned(in.features[DEPTH] + p);
+					const simd ar = simd::load_unaligned(in.features[AR] + p);
+					const simd ag = simd::load_unaligned(in.features[AG] + p);
+					const simd ab = simd::load_unaligned(in.features[AB] + p);
+					const simd invDepth = simd(1.0f) / (simd(DEPTH_SIGMA * in.step) * vmax(z, tiny));
+
+					simd sumR = zero, sumG = zero, sumB = zero, weights = zero;
+					for (int j = 0; j < 3; ++j) {
+						const int yy = std::min(std::max(y + (j - 1) * in.step, 0), in.height - 1);
+						const size_t tapRow = (size_t) yy * in.stride;
+						for (int k = 0; k < 3; ++k) {
+							const int xx = x + (k - 1) * in.step;
+							const simd qz = load_clamped<simd>(in.features[DEPTH] + tapRow, xx, in.width);
+
+							simd cosine = nx * load_clamped<simd>(in.features[NX] + tapRow, xx, in.width)
+								+ ny * load_clamped<simd>(in.features[NY] + tapRow, xx, in.width)
+								+ nz * load_clamped<simd>(in.features[NZ] + tapRow, xx, in.width);
+							cosine = vmax(cosine, zero);
+							for (int s = 0; s < NORMAL_POWER_SQUARINGS; ++s) cosine = cosine * cosine;
+
+							const simd dar = ar - load_clamped<simd>(in.features[AR] + tapRow, xx, in.width);
+							const simd dag = ag - load_clamped<simd>(in.features[AG] + tapRow, xx, in.width);
+							const simd dab = ab - load_clamped<simd>(in.features[AB] + tapRow, xx, in.width);
+
+							const simd qr = load_clamped<simd>(in.color[0] + tapRow, xx, in.width);
+							const simd qg = load_clamped<simd>(in.color[1] + tapRow, xx, in.width);
+							const simd qb = load_clamped<simd>(in.color[2] + tapRow, xx, in.width);
+							const simd dcr = cr - qr, dcg = cg - qg, dcb = cb - qb;
+
+							const simd distance = vabs(z - qz) * invDepth
+								+ (dar * dar + dag * dag + dab * dab) * invAlbedoSigma2
+								+ (dcr * dcr + dcg * dcg + dcb * dcb) * invColorSigma2;
+
+							//taps on the sky never count for a surface
+							const simd w = blend(zero, simd(KERNEL[j] * KERNEL[k]) * cosine * exp_negative(distance), qz > zero);
+							sumR = sumR + w * qr;
+							sumG = sumG + w * qg;
+							sumB = sumB + w * qb;
+							weights = weights + w;
+						}
+					}
+
+					//the sky and surfaces without a normal keep their color
+					const simd keep = (z <= zero) | (weights <= zero);
+					const simd invWeights = simd(1.0f) / vmax(weights, tiny);
+					blend(sumR * invWeights, cr, keep).store_unaligned(in.result[0] + p);
+					blend(sumG * invWeights, cg, keep).store_unaligned(in.result[1] + p);
+					blend(sumB * invWeights, cb, keep).store_unaligned(in.result[2] + p);
+				}
+			}
+
+			_mm_setcsr(csr);
+		}
+
+		template <typename F>
+		void for_each_band(const int height, thread_pool& pool, const F& fn) {
+			const int bands = (height + BAND_ROWS - 1) / BAND_ROWS;
+			pool.run(bands, [&](const int band, const int) {
+				const int y0 = band * BAND_ROWS;
+				fn(y0, std::min(y0 + BAND_ROWS, height));
+			});
+		}
+	}
+
+
+	void pixel_features::resize(const size_t size) {
+		for (std::vector<float>* v : { &nx, &ny, &nz, &depth, &ar, &ag, &ab }) v->resize(size);
+	}
+
+
+	void denoiser::load(const vec3f* color, const float scale, const pixel_features& features, const int width, const int height, thread_pool& pool) {
+		//the padding at the end of the rows repeats their last pixel, so whole vectors can be loaded and stored
+		_stride = (width + simdf::width - 1) / simdf::width * simdf::width;
+		const size_t size = (size_t) _stride * height;
+		for (std::vector<float>& plane : _planes[0]) plane.resize(size);
+		for (std::vector<float>& plane : _planes[1]) plane.resize(size);
+		for (std::vector<float>& plane : _features) plane.resize(size);
+
+		const std::vector<float>* source[FEATURES] = { &features.nx, &features.ny, &features.nz, &features.depth, &features.ar, &features.ag, &features.ab };
+		for_each_band(height, pool, [&](const int y0, const int y1) {
+			for (int y = y0; y < y1; ++y) {
+				for (int x = 0; x < _stride; ++x) {
+					const size_t from = (size_t) y * width + std::min(x, width - 1);
+					const size_t to = (size_t) y * _stride + x;
+					for (int f = 0; f < FEATURES; ++f) _features[f][to] = (*source[f])[from];
+
+					//the filter works on the light reaching the surface, the albedo is multiplied back in afterwards
+					const vec3f c = color[from] * scale;
+					_planes[0][0][to] = c.x() / std::max(features.ar[from], 0.01f);
+					_planes[0][1][to] = c.y() / std::max(features.ag[from], 0.01f);
+					_planes[0][2][to] = c.z() / std::max(features.ab[from], 0.01f);
+				}
+			}
+		});
+	}
+
+	void denoiser::run(const vec3f* color, const float scale, const int samples, const pixel_features& features, const int width, const int height, vec3f* output, thread_pool& pool) {
+		if (width <= 0 || height <= 0) return;
+		load(color, scale, features, width, height, pool);
+
+		//noise shrinks with the square root of the samples, so does the color difference still taken for noise
+		float colorSigma = COLOR_SIGMA / std::sqrt((float) std::max(samples, 1));
+		for (int pass = 0; pass < PASSES; ++pass) {
+			pass_input in;
+			for (int c = 0; c < 3; ++c) {
+				in.color[c] = _planes[pass & 1][c].data();
+				in.result[c] = _planes[~pass & 1][c].data();
+			}
+
+			for (int f = 0; f < FEATURES; ++f) in.features[f] = _features[f].data();
+			in.stride = _stride;
+			in.width = width;
+			in.height = height;
+			in.step = 1 << pass;
+			in.invColorSigma2 = 1.0f / (colorSigma * colorSigma);
+			for_each_band(height, pool, [&](const int y0, const int y1) { filter_rows<simdf>(in, y0, y1); });
+			colorSigma *= 0.5f;
+		}
+
+		const std::vector<float>* result = _planes[PASSES & 1];
+		for_each_band(height, pool, [&](const int y0, const int y1) {
+			for (int y = y0; y < y1; ++y) {
+				for (int x = 0; x < width; ++x) {
+					const size_t from = (size_t) y * _stride + x;
+					const vec3f albedo(_features[AR][from], _features[AG][from], _features[AB][from]);
+					output[(size_t) y * width + x] = vec3f(result[0][from], result[1][from], result[2][from]) * albedo;
+				}
+			}
+		});
+	}
+}
@@ -0,0 +1,42 @@
+﻿#pragma once
+#include "maths.h"
+
+#include <vector>
+
+namespace raytracer {
+	struct thread_pool;
+
+	constexpr int PIXEL_FEATURES = 7; //planes of pixel_features
+
+	//what the first hit of every pixel looks like, the denoiser keeps edges between pixels that differ here.
+	//one plane per channel, depth 0 marks pixels that see the sky
+	struct pixel_features {
+		std::vector<float> nx, ny, nz;
+		std::vector<float> depth;
+		std::vector<float> ar, ag, ab; //albedo
+
+		void resize(const size_t size);
+	};
+
+	//edge avoiding a-trous wavelet filter after dammertz et al. 2010. each pass blurs with a 3x3 binomial kernel
+	//(instead of the paper's 5x5, at a third of the cost) whose taps are spread twice as far as in the previous
+	//one, and weights every tap by how close its normal, depth, albedo and color are to the center. color is
+	//divided by the albedo first, so texture is not blurred with the noise. passes run in bands of rows on the
+	//thread pool and are vectorized over pixels of a row
+	struct denoiser {
+		private:
+		//color being filtered and the result of a pass, rows padded to whole vectors
+		std::vector<float> _planes[2][3];
+		std::vector<float> _features[PIXEL_FEATURES];
+		int _stride = 0;
+
+		void load(const vec3f* color, const float scale, const pixel_features& features, const int width, const int height,
+			thread_pool& pool);
+
+		public:
+		//filters color * scale and writes it to output, both width * height pixels. samples is the number of
+		//samples averaged in color, filtering is weaker the more there are
+		void run(const vec3f* color, const float scale, const int samples, const pixel_features& features, const int width,
+			const int height, vec3f* output, thread_pool& pool);
+	};
+}
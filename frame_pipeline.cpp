@@ -0,0 +1,137 @@
+﻿#include "frame_pipeline.h"
+#include "image.h"
+#include "measurements.h"
+#include "raytracer.h"
+#include "thread_pool.h"
+
+#include <chrono>
+
+namespace raytracer {
+
+	frame_pipeline::frame_pipeline(const int width, const int height) :
+		_rendering(0), _ready(1), _presenting(2), _fresh(false), _width(width), _height(height),
+		_renderedFrames(0), _presentedFrames(0), _stop(false), _targetMs(0.0) { }
+
+	frame_pipeline::~frame_pipeline() {
+		stop();
+	}
+
+	void frame_pipeline::start() {
+		if (_thread.joinable()) return;
+
+		_stop = false;
+		_thread = std::thread(&frame_pipeline::render_main, this);
+	}
+
+	void frame_pipeline::stop() {
+		if (!_thread.joinable()) return;
+
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			_stop = true;
+		}
+
+		_frameDone.notify_all();
+		_thread.join();
+	}
+
+	void frame_pipeline::resize(const int width, const int height) {
+		std::lock_guard<std::mutex> lock(_lock);
+		_width = width;
+		_height = height;
+	}
+
+	void frame_pipeline::set_frame_time_target(const double ms) {
+		std::lock_guard<std::mutex> lock(_lock);
+		_targetMs = ms;
+	}
+
+	std::unique_lock<std::mutex> frame_pipeline::lock_scene() {
+		return std::unique_lock<std::mutex>(_sceneLock);
+	}
+
+	void frame_pipeline::render_main() {
+		while (true) {
+			int width, height;
+			{
+				std::lock_guard<std::mutex> lock(_lock);
+				if (_stop) return;
+
+				width = _width;
+				height = _height;
+				if (_targetMs != _resolution.target()) _resolution.set_target(_targetMs);
+			}
+
+			frame& f = _frames[_rendering];
+			f.pixels.resize((size_t) width * height * 4);
+			f.width = width;
+			f.height = height;
+			_resolution.render_size(width, height, f.renderWidth, f.renderHeight);
+			{
+				std::lock_guard<std::mutex> scene(_sceneLock);
+				const int samples = get_sample_count();
+				f.renderMs = lamda_timer([&]() {
+					if (f.renderWidth == width && f.renderHeight == height) {
+						run(f.pixels.data(), width, height);
+						return;
+					}
+
+					_lowResolution.resize((size_t) f.renderWidth * f.renderHeight * 4);
+					run(_lowResolution.data(), f.renderWidth, f.renderHeight);
+					PROFILE_SCOPE("upscale");
+					upscale_bilinear(_lowResolution.data(), f.renderWidth, f.renderHeight, f.pixels.data(), width, height, &default_pool());
+				});
+
+				//once accumulation converged frames only resolve, their time says nothing about tracing.
+				//a changed sample count, or 1 without accumulation, means the frame traced
+				const int traced = get_sample_count();
+				if (traced != samples || traced == 1) _resolution.update(f.renderMs, f.renderWidth, f.renderHeight, width, height);
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(_lock);
+				std::swap(_rendering, _ready);
+				_fresh = true;
+				++_renderedFrames;
+			}
+
+			_frameDone.notify_all();
+		}
+	}
+
+	bool frame_pipeline::present(presenter& target, const int timeoutMs) {
+		{
+			std::unique_lock<std::mutex> lock(_lock);
+			_frameDone.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]() { return _fresh || _stop; });
+			if (!_fresh) return false;
+
+			std::swap(_presenting, _ready);
+			_fresh = false;
+			++_presentedFrames;
+		}
+
+		//the presenting buffer is not touched by the render thread, upload without holding the lock
+		const frame& f = _frames[_presenting];
+		target.present(f.pixels.data(), f.width, f.height);
+		return true;
+	}
+
+	double frame_pipeline::presented_render_ms() const {
+		return _frames[_presenting].renderMs;
+	}
+
+	void frame_pipeline::presented_render_size(int& width, int& height) const {
+		width = _frames[_presenting].renderWidth;
+		height = _frames[_presenting].renderHeight;
+	}
+
+	long long frame_pipeline::rendered_frames() {
+		std::lock_guard<std::mutex> lock(_lock);
+		return _renderedFrames;
+	}
+
+	long long frame_pipeline::presented_frames() {
+		std::lock_guard<std::mutex> lock(_lock);
+		return _presentedFrames;
+	}
+}
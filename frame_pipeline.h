@@ -0,0 +1,89 @@
+﻿#pragma once
+#include "presenter.h"
+#include "resolution.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace raytracer {
+	//renders frames with raytracer::run() on a thread of its own into a ring of three buffers, while the thread
+	//that owns the display presents them. one buffer is being rendered, one holds the newest finished frame and
+	//one is being presented. the renderer never waits for presentation: a finished frame replaces the one still
+	//waiting, so vsync and texture uploads only decide which frame is shown and never delay tracing.
+	//with a frame time target the frames are traced at a lower resolution that holds it and upscaled to the
+	//output size, the presenter always gets frames of the size set by resize()
+	struct frame_pipeline {
+		private:
+		struct frame {
+			std::vector<byte> pixels;
+			int width = 0;
+			int height = 0;
+			int renderWidth = 0;
+			int renderHeight = 0;
+			double renderMs = 0.0;
+		};
+
+		//_rendering is only changed by the render thread and _presenting only by the presenting thread,
+		//both swap with _ready under _lock
+		frame _frames[3];
+		int _rendering;
+		int _ready;
+		int _presenting;
+		bool _fresh;
+
+		int _width;
+		int _height;
+		long long _renderedFrames;
+		long long _presentedFrames;
+		bool _stop;
+
+		//only used by the render thread, the target is handed over through _targetMs under _lock
+		resolution_controller _resolution;
+		std::vector<byte> _lowResolution;
+		double _targetMs;
+
+		std::mutex _lock;
+		std::condition_variable _frameDone;
+		std::mutex _sceneLock;
+		std::thread _thread;
+
+		void render_main();
+
+		public:
+		frame_pipeline(const int width, const int height);
+		~frame_pipeline();
+
+		frame_pipeline(const frame_pipeline&) = delete;
+		frame_pipeline& operator=(const frame_pipeline&) = delete;
+
+		void start();
+
+		//finishes the frame in flight and joins the render thread
+		void stop();
+
+		//size of the frames rendered from now on, frames already finished keep their size
+		void resize(const int width, const int height);
+
+		//render time to hold by lowering the resolution frames are traced at, 0 always traces at the output size
+		void set_frame_time_target(const double ms);
+
+		//the renderer holds this lock while tracing, hold it to change the camera or settings. scene edits are
+		//published between frames and do not need it
+		std::unique_lock<std::mutex> lock_scene();
+
+		//presents the newest finished frame, waiting up to timeoutMs for one.
+		//returns false if no frame was finished since the last call
+		bool present(presenter& target, const int timeoutMs);
+
+		//time raytracer::run() and the upscale took for the frame presented last
+		double presented_render_ms() const;
+
+		//resolution the frame presented last was traced at
+		void presented_render_size(int& width, int& height) const;
+
+		long long rendered_frames();
+		long long presented_frames();
+	};
+}
@@ -0,0 +1,387 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark.h"
+#include "frame_pipeline.h"
+#include "kernels.h"
+#include "measurements.h"
+#include "mesh_file.h"
+#include "mesh_import.h"
+#include "raytracer.h"
+#include "test_scene.h"
+
+//offline entry point without glfw/glew, renders into a cpu buffer and writes the last frame to disk
+
+
+namespace raytracer {
+	typedef struct headless_options_t {
+		int width = 1280;
+		int height = 720;
+		int frames = 10;
+		int detail = 10;
+		int bounces = -1; //-1 shades primary hits without path tracing
+		bool denoise = false;
+		bool rasterize = false;
+		float adaptiveError = 0.0f;
+		const char* isa = nullptr;
+		const char* output = "frame.ppm";
+		const char* benchmark = nullptr;
+		const char* profile = nullptr;
+		const char* mesh = nullptr;
+		const char* cache = nullptr;
+		bool pipeline = false;
+		double targetMs = 0.0;
+		bool instanced = false;
+		bool quantize = false;
+		bool edits = false;
+		bvh_builder builder = BVH_BUILDER_SAH;
+	} headless_options;
+
+	typedef struct edit_counts_t {
+		int meshes = 0;
+		int instances = 0;
+		int moves = 0;
+		int removedInstances = 0;
+		int removedMeshes = 0;
+		int removedAdds = 0; //add_instance calls with the id of a removed mesh
+		int removedAdded = 0; //those that did not return -1, has to stay 0
+	} edit_counts;
+
+	//counted by the released callbacks of removed meshes, which run on whichever thread drops the last snapshot
+	static std::atomic<int> releasedMeshes(0);
+
+	static void print_usage() {
+		printf("usage: headless [options]\n");
+		printf("  --width <pixels>     render width (default 1280)\n");
+		printf("  --height <pixels>    render height (default 720)\n");
+		printf("  --frames <count>     number of frames to render (default 10)\n");
+		printf("  --detail <n>         test scene with n x n spheres (default 10)\n");
+		printf("  --instanced          place the test scene spheres as instances of one mesh\n");
+		printf("  --quantize           store mesh vertices as 16 bit fixed point, meshes are copied instead of mapped\n");
+		printf("  --path <bounces>     path trace with sky and sun light, following up to the given number of bounces\n");
+		printf("  --denoise            filter the path traced image, guided by the first hits of the pixels\n");
+		printf("  --rasterize          find the first hits by rasterizing a visibility buffer instead of tracing camera rays\n");
+		printf("  --adaptive <error>   stop sampling tiles once the standard error of their pixels is below this, e.g. 0.005\n");
+		printf("  --builder <name>     bvh builder for the meshes, sah or lbvh (default sah)\n");
+		printf("  --isa <name>         force the kernels of baseline, sse4.2, avx2 or avx512 instead of the best the cpu runs\n");
+		printf("  --cache <dir>        keep built bvhs in an existing directory and load them on the next run\n");
+		printf("  --mesh <file>        render a mesh file instead of the test scene, .obj and .ply are converted\n");
+		printf("                       to <file>.rtms first\n");
+		printf("  --output <file>      .ppm or .png for the last frame, empty string to skip (default frame.ppm)\n");
+		printf("  --bench <suite>      run a microbenchmark suite (vec, packet, instances, build, rays, paths, raster, isa, kernels, all) instead of rendering\n");
+		printf("  --profile <file>     print per scope timings of the last frame and write a chrome trace (.json)\n");
+		printf("  --pipeline           render on the frame pipeline's thread and present the frames to a file presenter\n");
+		printf("  --target <ms>        with --pipeline, lower the traced resolution to hold this frame time\n");
+		printf("  --edits              while the frames render, a second thread adds, moves and removes meshes and instances\n");
+	}
+
+	static bool parse_options(const int argc, char** argv, headless_options& options) {
+		for (int i = 1; i < argc; ++i) {
+			const char* arg = argv[i];
+			const bool hasValue = i + 1 < argc;
+
+			if (strcmp(arg, "--width") == 0 && hasValue) options.width = atoi(argv[++i]);
+			else if (strcmp(arg, "--height") == 0 && hasValue) options.height = atoi(argv[++i]);
+			else if (strcmp(arg, "--frames") == 0 && hasValue) options.frames = atoi(argv[++i]);
+			else if (strcmp(arg, "--detail") == 0 && hasValue) options.detail = atoi(argv[++i]);
+			else if (strcmp(arg, "--path") == 0 && hasValue) options.bounces = std::max(0, atoi(argv[++i]));
+			else if (strcmp(arg, "--output") == 0 && hasValue) options.output = argv[++i];
+			else if (strcmp(arg, "--bench") == 0 && hasValue) options.benchmark = argv[++i];
+			else if (strcmp(arg, "--profile") == 0 && hasValue) options.profile = argv[++i];
+			else if (strcmp(arg, "--mesh") == 0 && hasValue) options.mesh = argv[++i];
+			else if (strcmp(arg, "--cache") == 0 && hasValue) options.cache = argv[++i];
+			else if (strcmp(arg, "--pipeline") == 0) options.pipeline = true;
+			else if (strcmp(arg, "--target") == 0 && hasValue) options.targetMs = atof(argv[++i]);
+			else if (strcmp(arg, "--instanced") == 0) options.instanced = true;
+			else if (strcmp(arg, "--quantize") == 0) options.quantize = true;
+			else if (strcmp(arg, "--edits") == 0) options.edits = true;
+			else if (strcmp(arg, "--denoise") == 0) options.denoise = true;
+			else if (strcmp(arg, "--rasterize") == 0) options.rasterize = true;
+			else if (strcmp(arg, "--adaptive") == 0 && hasValue) options.adaptiveError = (float) atof(argv[++i]);
+			else if (strcmp(arg, "--isa") == 0 && hasValue) options.isa = argv[++i];
+			else if (strcmp(arg, "--builder") == 0 && hasValue) {
+				const char* name = argv[++i];
+				if (strcmp(name, "sah") == 0) options.builder = BVH_BUILDER_SAH;
+				else if (strcmp(name, "lbvh") == 0) options.builder = BVH_BUILDER_LBVH;
+				else return false;
+			}
+			else return false;
+		}
+
+		return options.width > 0 && options.height > 0 && options.frames > 0 && options.detail >= 0;
+	}
+
+	static bool is_mesh_file(const char* path) {
+		const size_t length = strlen(path);
+		return length >= 5 && strcmp(path + length - 5, ".rtms") == 0;
+	}
+
+	//maps the mesh, converting it first if needed. the scene references the mapping, so it has to outlive rendering.
+	//soup from version 1 files is welded and quantized meshes are copied, those do not need the mapping afterwards
+	static bool load_mesh(const char* path, const bool quantize, mesh_file& mesh) {
+		std::string meshPath = path;
+		if (!is_mesh_file(path)) {
+			meshPath += ".rtms";
+			const double ms = lamda_timer([&]() {
+				if (!import_mesh(path, meshPath.c_str())) meshPath.clear();
+			});
+			if (meshPath.empty()) return false;
+
+			printf("imported %s in %.3f ms\n", path, ms);
+		}
+
+		if (!mesh.open(meshPath.c_str())) return false;
+
+		if (!mesh.indices()) {
+			std::vector<float> vertices;
+			std::vector<unsigned> indices;
+			const double ms = lamda_timer([&]() { weld_vertices(mesh.vertices(), mesh.vertex_count(), vertices, indices); });
+			printf("welded %zu vertices into %zu in %.3f ms\n", mesh.vertex_count(), vertices.size() / 3, ms);
+
+			return add_indexed_mesh(vertices.data(), vertices.size() / 3, indices.data(), indices.size(), quantize) >= 0;
+		}
+
+		if (quantize) return add_indexed_mesh(mesh.vertices(), mesh.vertex_count(), mesh.indices(), 3 * mesh.triangle_count(), true) >= 0;
+		return add_indexed_mesh_view(mesh.vertices(), mesh.vertex_count(), mesh.indices(), 3 * mesh.triangle_count()) >= 0;
+	}
+
+	//adds, moves and removes small spheres above the scene until stop is set, one edit per millisecond. every other
+	//mesh is a view of vertices on the heap, which its released callback frees once no snapshot references it
+	static void edit_scene(const int detail, const std::atomic<bool>& stop, edit_counts& counts) {
+		typedef struct edited_mesh_t {
+			int id;
+			std::vector<float>* vertices; //nullptr for copied meshes
+		} edited_mesh;
+		typedef struct edited_instance_t {
+			int id;
+			int mesh;
+		} edited_instance;
+
+		const std::vector<float> sphere = test_sphere();
+		std::vector<edited_mesh> meshes;
+		std::vector<edited_instance> instances;
+		int removedMesh = -1;
+
+		unsigned state = 2463534242u;
+		const auto next = [&state](const size_t n) {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			return (size_t) state % n;
+		};
+		const auto place = [&]() {
+			const float extent = (float) std::max(detail, 1);
+			const vec3f center((next(1000) / 500.0f - 1.0f) * extent, 1.0f + next(1000) / 1000.0f, (next(1000) / 500.0f - 1.0f) * extent);
+			return transform::translate(center) * transform::scale(0.2f);
+		};
+
+		while (!stop.load()) {
+			const size_t edit = next(8);
+			if (meshes.size() < 2 || (edit == 0 && meshes.size() < 8)) {
+				edited_mesh mesh = { -1, nullptr };
+				if (counts.meshes % 2 == 0) mesh.id = create_mesh(sphere.data(), sphere.size());
+				else {
+					mesh.vertices = new std::vector<float>(sphere);
+					mesh.id = create_mesh_view(mesh.vertices->data(), mesh.vertices->size());
+				}
+				meshes.push_back(mesh);
+				++counts.meshes;
+			} else if (edit <= 2) {
+				const edited_mesh& mesh = meshes[next(meshes.size())];
+				const int instance = add_instance(mesh.id, place());
+				if (instance >= 0) instances.push_back({ instance, mesh.id });
+				++counts.instances;
+
+				//the id of the last removed mesh is only valid again once a new mesh reuses it
+				if (removedMesh >= 0 && std::none_of(meshes.begin(), meshes.end(), [&](const edited_mesh& m) { return m.id == removedMesh; })) {
+					if (add_instance(removedMesh, place()) >= 0) ++counts.removedAdded;
+					++counts.removedAdds;
+				}
+			} else if (edit <= 5 && !instances.empty()) {
+				set_instance_transform(instances[next(instances.size())].id, place());
+				++counts.moves;
+			} else if (edit == 6 && !instances.empty()) {
+				const size_t i = next(instances.size());
+				remove_instance(instances[i].id);
+				instances.erase(instances.begin() + i);
+				++counts.removedInstances;
+			} else if (edit == 7) {
+				const size_t i = next(meshes.size());
+				const edited_mesh mesh = meshes[i];
+				std::vector<float>* vertices = mesh.vertices;
+				remove_mesh(mesh.id, [vertices]() {
+					delete vertices;
+					++releasedMeshes;
+				});
+				meshes.erase(meshes.begin() + i);
+				instances.erase(std::remove_if(instances.begin(), instances.end(), [&](const edited_instance& instance) { return instance.mesh == mesh.id; }), instances.end());
+				removedMesh = mesh.id;
+				++counts.removedMeshes;
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+}
+
+
+int main(int argc, char** argv) {
+	raytracer::headless_options options;
+	if (!raytracer::parse_options(argc, argv, options)) {
+		raytracer::print_usage();
+		return 1;
+	}
+
+	if (options.isa) {
+		raytracer::simd_isa isa;
+		if (!raytracer::parse_simd_isa(options.isa, isa) || !raytracer::force_simd_isa(isa)) {
+			printf("the kernels of %s are unknown or not supported by this cpu\n", options.isa);
+			return 1;
+		}
+	}
+
+	if (options.benchmark) {
+		if (!raytracer::run_benchmark(options.benchmark)) {
+			printf("unknown benchmark suite %s\n", options.benchmark);
+			return 1;
+		}
+
+		return 0;
+	}
+
+	raytracer::mesh_file mesh;
+	size_t triangles = 0;
+	if (options.mesh) {
+		if (!raytracer::load_mesh(options.mesh, options.quantize, mesh)) {
+			printf("failed to load %s\n", options.mesh);
+			return 1;
+		}
+
+		triangles = mesh.triangle_count();
+	} else if (options.instanced) {
+		triangles = raytracer::add_instanced_test_scene(options.detail, options.quantize);
+	} else {
+		triangles = raytracer::add_test_scene(options.detail, options.quantize);
+	}
+
+	printf("scene: %zu triangles, %dx%d, %d frames, %s kernels\n", triangles, options.width, options.height, options.frames, raytracer::kernels().name);
+
+	raytracer::render_settings settings = raytracer::get_render_settings();
+	settings.builder = options.builder;
+	settings.pathTrace = options.bounces >= 0;
+	if (settings.pathTrace) settings.maxBounces = options.bounces;
+	settings.denoise = options.denoise;
+	settings.rasterize = options.rasterize;
+	settings.adaptiveError = options.adaptiveError;
+	raytracer::set_render_settings(settings);
+	raytracer::set_bvh_cache(options.cache);
+
+	std::vector<double> times;
+	std::vector<size_t> samples; //traced by every frame, fewer than its pixels with adaptive sampling
+	raytracer::file_presenter presenter;
+
+	if (options.profile) {
+		raytracer::profiler_set_enabled(true);
+		raytracer::profiler_set_capture(true);
+	}
+
+	raytracer::edit_counts edits;
+	std::atomic<bool> stopEdits(false);
+	std::thread editor;
+	if (options.edits) editor = std::thread([&]() { raytracer::edit_scene(options.detail, stopEdits, edits); });
+
+	if (options.pipeline) {
+		//frames finished while the previous one is presented replace it, so fewer may be presented than rendered
+		raytracer::frame_pipeline pipeline(options.width, options.height);
+		pipeline.set_frame_time_target(options.targetMs);
+		pipeline.start();
+		while ((int) times.size() < options.frames) {
+			if (!pipeline.present(presenter, 1000)) continue;
+
+			times.push_back(pipeline.presented_render_ms());
+			raytracer::profiler_end_frame();
+		}
+		pipeline.stop();
+
+		int renderWidth, renderHeight;
+		pipeline.presented_render_size(renderWidth, renderHeight);
+		printf("pipeline: %lld frames rendered, %lld presented, the last traced at %dx%d\n", pipeline.rendered_frames(), pipeline.presented_frames(), renderWidth, renderHeight);
+	} else {
+		std::vector<byte> pixels((size_t) options.width * options.height * 4);
+		for (int i = 0; i < options.frames; ++i) {
+			times.push_back(raytracer::lamda_timer([&]() { raytracer::run(pixels.data(), options.width, options.height); }));
+			samples.push_back(raytracer::get_frame_sample_count());
+			raytracer::profiler_end_frame();
+		}
+
+		presenter.present(pixels.data(), options.width, options.height);
+	}
+
+	if (editor.joinable()) {
+		stopEdits = true;
+		editor.join();
+		printf("edits: %d meshes and %d instances added, %d moves, %d instances and %d meshes removed, %d meshes released so far\n", edits.meshes, edits.instances,
+			edits.moves, edits.removedInstances, edits.removedMeshes, raytracer::releasedMeshes.load());
+		if (edits.removedAdded > 0) {
+			printf("%d of %d instances of removed meshes were added\n", edits.removedAdded, edits.removedAdds);
+			return 1;
+		}
+	}
+
+	//the first frame also builds the acceleration structure, keep it out of the steady state numbers
+	printf("first frame: %.3f ms\n", times[0]);
+	const raytracer::build_stats build = raytracer::get_build_stats();
+	printf("bvh: %s build %.3f ms (%.2f Mtris/s), top level %.3f ms, sah cost %.2f, %d meshes from cache\n", options.builder == raytracer::BVH_BUILDER_LBVH ? "lbvh" : "sah",
+		build.blasMs, build.blasMs > 0.0 ? build.blasTriangles / (build.blasMs * 1000.0) : 0.0, build.tlasMs, build.blasCost, build.cachedMeshes);
+	if (build.blasTriangles > 0) {
+		printf("memory: %.1f bytes per triangle in vertices and indices, %.1f in bvh8 nodes, %.1f in triangle blocks\n", (double) build.blasVertexBytes / build.blasTriangles,
+			(double) build.blasNodeBytes / build.blasTriangles, (double) build.blasBlockBytes / build.blasTriangles);
+	}
+	if (times.size() > 1) {
+		double minTime = times[1], maxTime = times[1], total = 0.0, traced = 0.0;
+		for (size_t i = 1; i < times.size(); ++i) {
+			minTime = std::min(minTime, times[i]);
+			maxTime = std::max(maxTime, times[i]);
+			total += times[i];
+			traced += i < samples.size() ? (double) samples[i] : (double) options.width * options.height;
+		}
+
+		const double avg = total / (times.size() - 1);
+		const double mrays = traced / (total * 1000.0);
+		printf("frames: min %.3f ms, avg %.3f ms, max %.3f ms - %.1f fps, %.2f Mrays/s\n", minTime, avg, maxTime, 1000.0 / avg, mrays);
+	}
+	if (options.adaptiveError > 0.0f && !samples.empty()) {
+		double traced = 0.0;
+		for (const size_t n : samples) traced += (double) n;
+		printf("image: up to %d samples per pixel, %.1f on average\n", raytracer::get_sample_count(), traced / ((double) options.width * options.height));
+	}
+	else printf("image: %d samples per pixel\n", raytracer::get_sample_count());
+
+	if (options.profile) {
+		raytracer::profiler_print_frame();
+		if (!raytracer::profiler_write_chrome_trace(options.profile)) {
+			printf("failed to write %s\n", options.profile);
+			return 1;
+		}
+
+		printf("wrote %s\n", options.profile);
+	}
+
+	if (options.output[0] != '\0') {
+		if (!presenter.write(options.output)) {
+			printf("failed to write %s\n", options.output);
+			return 1;
+		}
+
+		printf("wrote %s\n", options.output);
+	}
+
+	return 0;
+}
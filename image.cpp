@@ -0,0 +1,161 @@
+﻿#include "image.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace raytracer {
+
+	namespace {
+		unsigned crc32(const byte* data, const size_t size, unsigned crc = 0) {
+			static unsigned table[256];
+			static bool initialized = false;
+			if (!initialized) {
+				for (unsigned i = 0; i < 256; ++i) {
+					unsigned c = i;
+					for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+					table[i] = c;
+				}
+				initialized = true;
+			}
+
+			crc = ~crc;
+			for (size_t i = 0; i < size; ++i) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+			return ~crc;
+		}
+
+		void put_u32(std::vector<byte>& out, const unsigned v) {
+			out.push_back((byte) (v >> 24));
+			out.push_back((byte) (v >> 16));
+			out.push_back((byte) (v >> 8));
+			out.push_back((byte) v);
+		}
+
+		void put_chunk(std::vector<byte>& out, const char* type, const std::vector<byte>& data) {
+			put_u32(out, (unsigned) data.size());
+			const size_t start = out.size();
+			out.insert(out.end(), type, type + 4);
+			out.insert(out.end(), data.begin(), data.end());
+			put_u32(out, crc32(out.data() + start, out.size() - start));
+		}
+
+		//source pixel left of (or below) a target pixel center and the weight of the next one in 1/256
+		struct sample_position {
+			int first;
+			int next;
+			int weight;
+		};
+
+		std::vector<sample_position> sample_positions(const int sourceSize, const int size) {
+			std::vector<sample_position> positions((size_t) size);
+			const float scale = (float) sourceSize / size;
+			for (int i = 0; i < size; ++i) {
+				const float s = std::min(std::max((i + 0.5f) * scale - 0.5f, 0.0f), (float) (sourceSize - 1));
+				sample_position& p = positions[i];
+				p.first = (int) s;
+				p.next = std::min(p.first + 1, sourceSize - 1);
+				p.weight = (int) ((s - p.first) * 256.0f + 0.5f);
+			}
+
+			return positions;
+		}
+
+		bool write_file(const char* path, const byte* data, const size_t size) {
+			FILE* file = fopen(path, "wb");
+			if (!file) return false;
+
+			const bool ok = fwrite(data, 1, size, file) == size;
+			return fclose(file) == 0 && ok;
+		}
+	}
+
+
+	bool write_ppm(const char* path, const byte* pixels, const int width, const int height) {
+		char header[64];
+		const int headerSize = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+
+		std::vector<byte> data(header, header + headerSize);
+		data.reserve(headerSize + 3 * (size_t) width * height);
+		for (int y = height - 1; y >= 0; --y) {
+			const byte* row = pixels + 4 * (size_t) y * width;
+			for (int x = 0; x < width; ++x) {
+				data.insert(data.end(), row + 4 * x, row + 4 * x + 3);
+			}
+		}
+
+		return write_file(path, data.data(), data.size());
+	}
+
+	bool write_png(const char* path, const byte* pixels, const int width, const int height) {
+		//raw scanlines with filter type 0, stored in uncompressed deflate blocks so we need no zlib
+		const size_t rowSize = 4 * (size_t) width + 1;
+		std::vector<byte> raw(rowSize * height);
+		for (int y = 0; y < height; ++y) {
+			raw[y * rowSize] = 0;
+			memcpy(&raw[y * rowSize + 1], pixels + 4 * (size_t) (height - 1 - y) * width, 4 * (size_t) width);
+		}
+
+		std::vector<byte> idat = { 0x78, 0x01 };
+		unsigned a = 1, b = 0;
+		for (size_t offset = 0; offset < raw.size(); offset += 65535) {
+			const size_t blockSize = std::min<size_t>(65535, raw.size() - offset);
+			idat.push_back(offset + blockSize == raw.size() ? 1 : 0);
+			idat.push_back((byte) blockSize);
+			idat.push_back((byte) (blockSize >> 8));
+			idat.push_back((byte) ~blockSize);
+			idat.push_back((byte) (~blockSize >> 8));
+			idat.insert(idat.end(), raw.begin() + offset, raw.begin() + offset + blockSize);
+		}
+
+		for (const byte c : raw) {
+			a = (a + c) % 65521;
+			b = (b + a) % 65521;
+		}
+		put_u32(idat, (b << 16) | a);
+
+		std::vector<byte> ihdr;
+		put_u32(ihdr, (unsigned) width);
+		put_u32(ihdr, (unsigned) height);
+		ihdr.insert(ihdr.end(), { 8, 6, 0, 0, 0 }); //8 bit rgba, no interlacing
+
+		static const byte signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+		std::vector<byte> png(signature, signature + 8);
+		put_chunk(png, "IHDR", ihdr);
+		put_chunk(png, "IDAT", idat);
+		put_chunk(png, "IEND", {});
+
+		return write_file(path, png.data(), png.size());
+	}
+
+	bool write_image(const char* path, const byte* pixels, const int width, const int height) {
+		const size_t len = strlen(path);
+		if (len >= 4 && strcmp(path + len - 4, ".png") == 0) return write_png(path, pixels, width, height);
+		return write_ppm(path, pixels, width, height);
+	}
+
+	void upscale_bilinear(const byte* source, const int sourceWidth, const int sourceHeight, byte* target, const int width, const int height, thread_pool* pool) {
+		if (sourceWidth <= 0 || sourceHeight <= 0 || width <= 0 || height <= 0) return;
+
+		const std::vector<sample_position> columns = sample_positions(sourceWidth, width);
+		const std::vector<sample_position> rows = sample_positions(sourceHeight, height);
+		const auto upscale_row = [&](const int y, const int) {
+			const sample_position& r = rows[y];
+			const byte* below = source + (size_t) r.first * sourceWidth * 4;
+			const byte* above = source + (size_t) r.next * sourceWidth * 4;
+			byte* out = target + (size_t) y * width * 4;
+			for (int x = 0; x < width; ++x) {
+				const sample_position& c = columns[x];
+				for (int k = 0; k < 4; ++k) {
+					const int b = below[4 * c.first + k] * (256 - c.weight) + below[4 * c.next + k] * c.weight;
+					const int a = above[4 * c.first + k] * (256 - c.weight) + above[4 * c.next + k] * c.weight;
+					out[4 * x + k] = (byte) ((b * (256 - r.weight) + a * r.weight + (1 << 15)) >> 16);
+				}
+			}
+		};
+
+		if (pool) pool->run(height, upscale_row);
+		else for (int y = 0; y < height; ++y) upscale_row(y, 0);
+	}
+}
@@ -0,0 +1,18 @@
+﻿#pragma once
+#include "maths.h"
+
+namespace raytracer {
+	struct thread_pool;
+
+	//pixels are rgba8 with the first row at the bottom, as uploaded by draw_screen()
+	//both writers flip the rows so the file is stored top to bottom, they return false on io errors
+	bool write_ppm(const char* path, const byte* pixels, const int width, const int height);
+	bool write_png(const char* path, const byte* pixels, const int width, const int height);
+
+	//picks the writer from the file extension, defaults to ppm
+	bool write_image(const char* path, const byte* pixels, const int width, const int height);
+
+	//bilinear resize of rgba8 pixels, the pixel centers of both images line up. with a pool the rows are split
+	//over its workers, so it can not be called from one of the pool's own tasks then
+	void upscale_bilinear(const byte* source, const int sourceWidth, const int sourceHeight, byte* target, const int width, const int height, thread_pool* pool = nullptr);
+}
@@ -0,0 +1,183 @@
+﻿#include "kernels.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef RAYTRACER_ISA_KERNELS
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+namespace raytracer {
+
+	namespace {
+#ifdef RAYTRACER_ISA_KERNELS
+		void cpuid(const unsigned leaf, const unsigned subleaf, unsigned regs[4]) {
+#ifdef _MSC_VER
+			int r[4];
+			__cpuidex(r, (int) leaf, (int) subleaf);
+			for (int i = 0; i < 4; ++i) regs[i] = (unsigned) r[i];
+#else
+			if (!__get_cpuid_count(leaf, subleaf, &regs[0], &regs[1], &regs[2], &regs[3])) regs[0] = regs[1] = regs[2] = regs[3] = 0;
+#endif
+		}
+
+		//register state the os saves on context switches, wide registers are unusable without it
+		unsigned long long xcr0() {
+#ifdef _MSC_VER
+			return _xgetbv(0);
+#else
+			unsigned lo, hi;
+			__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+			return ((unsigned long long) hi << 32) | lo;
+#endif
+		}
+
+		simd_isa detect() {
+			unsigned leaf0[4], leaf1[4], leaf7[4] = {};
+			cpuid(0, 0, leaf0);
+			cpuid(1, 0, leaf1);
+			if (leaf0[0] >= 7) cpuid(7, 0, leaf7);
+
+			const bool sse42 = (leaf1[2] >> 19 & 1) && (leaf1[2] >> 20 & 1);
+			if (!sse42) return SIMD_ISA_BASELINE;
+
+			const bool osxsave = leaf1[2] >> 27 & 1;
+			const unsigned long long state = osxsave ? xcr0() : 0;
+			const bool ymm = (state & 0x6) == 0x6;
+			const bool zmm = (state & 0xE6) == 0xE6;
+
+			const bool avx2 = ymm && (leaf1[2] >> 28 & 1) && (leaf1[2] >> 12 & 1) && (leaf7[1] >> 5 & 1);
+			if (!avx2) return SIMD_ISA_SSE42;
+
+			const bool avx512 = zmm && (leaf7[1] >> 16 & 1) && (leaf7[1] >> 31 & 1);
+			return avx512 ? SIMD_ISA_AVX512 : SIMD_ISA_AVX2;
+		}
+#else
+		simd_isa detect() {
+			return SIMD_ISA_BASELINE;
+		}
+#endif
+
+		bool baseline_closest_hit(const bvh8& tree, const triangle_block* blocks, const ray& r, hit& h) {
+			bool found = false;
+			traverse(tree, r, h, [&](const unsigned first, const unsigned count, hit& closest) {
+				for (unsigned b = first; b < first + count; ++b) found |= intersect_block(blocks[b], r, closest);
+			});
+			return found;
+		}
+
+		bool baseline_any_hit(const bvh8& tree, const triangle_block* blocks, const ray& r, const float tmax) {
+			hit h;
+			h.t = tmax;
+			bool found = false;
+			traverse(tree, r, h, [&](const unsigned first, const unsigned count, hit& closest) {
+				for (unsigned b = first; b < first + count && !found; ++b) found = intersect_block(blocks[b], r, closest);
+				if (found) closest.t = -1.0f; //nothing is closer, the traversal stops
+			});
+			return found;
+		}
+
+		byte to_byte(const float f) {
+			return (byte) (255.0f * std::min(1.0f, std::max(0.0f, f)) + 0.5f);
+		}
+
+		void baseline_resolve(const vec3f* colors, const float scale, const size_t count, byte* pixels) {
+			for (size_t i = 0; i < count; ++i) {
+				const vec3f c = colors[i] * scale;
+				pixels[4 * i] = to_byte(c.x());
+				pixels[4 * i + 1] = to_byte(c.y());
+				pixels[4 * i + 2] = to_byte(c.z());
+				pixels[4 * i + 3] = 255;
+			}
+		}
+
+		const simd_kernels BASELINE = { "baseline", &baseline_closest_hit, &baseline_any_hit, &baseline_resolve };
+
+		const char* const NAMES[SIMD_ISA_COUNT] = { "baseline", "sse4.2", "avx2", "avx512" };
+
+		std::atomic<const simd_kernels*> _current(nullptr);
+	}
+
+	simd_isa detect_simd_isa() {
+		static const simd_isa isa = detect();
+		return isa;
+	}
+
+	bool simd_isa_supported(const simd_isa isa) {
+		return isa >= SIMD_ISA_BASELINE && isa <= detect_simd_isa();
+	}
+
+	const simd_kernels* kernels_for(const simd_isa isa) {
+		if (!simd_isa_supported(isa)) return nullptr;
+
+		switch (isa) {
+#ifdef RAYTRACER_ISA_KERNELS
+		case SIMD_ISA_SSE42: return &kernels_sse42();
+		case SIMD_ISA_AVX2: return &kernels_avx2();
+		case SIMD_ISA_AVX512: return &kernels_avx512();
+#endif
+		default: return &BASELINE;
+		}
+	}
+
+	const simd_kernels& default_kernels() {
+		static const simd_kernels k = []() {
+			const simd_isa best = detect_simd_isa();
+			const simd_isa trace = best >= SIMD_ISA_AVX2 ? SIMD_ISA_AVX2 : SIMD_ISA_BASELINE;
+			const simd_kernels& traversal = *kernels_for(trace);
+			const simd_kernels& resolve = *kernels_for(best);
+			if (trace == best) return resolve;
+
+			static char name[64];
+			snprintf(name, sizeof(name), "%s traversal, %s resolve", traversal.name, resolve.name);
+			return simd_kernels { name, traversal.closest_hit, traversal.any_hit, resolve.resolve };
+		}();
+		return k;
+	}
+
+	const simd_kernels& kernels() {
+		const simd_kernels* k = _current.load(std::memory_order_acquire);
+		if (k) return *k;
+
+		const char* forced = std::getenv("RAYTRACER_ISA");
+		simd_isa requested;
+		k = forced && parse_simd_isa(forced, requested) ? kernels_for(requested) : nullptr;
+
+		//threads racing here all pick the same kernels
+		if (!k) k = &default_kernels();
+		_current.store(k, std::memory_order_release);
+		return *k;
+	}
+
+	void set_kernels(const simd_kernels& k) {
+		_current.store(&k, std::memory_order_release);
+	}
+
+	bool force_simd_isa(const simd_isa isa) {
+		const simd_kernels* k = kernels_for(isa);
+		if (!k) return false;
+
+		set_kernels(*k);
+		return true;
+	}
+
+	const char* simd_isa_name(const simd_isa isa) {
+		return isa >= SIMD_ISA_BASELINE && isa < SIMD_ISA_COUNT ? NAMES[isa] : "unknown";
+	}
+
+	bool parse_simd_isa(const char* name, simd_isa& isa) {
+		for (int i = 0; i < SIMD_ISA_COUNT; ++i) {
+			if (strcmp(name, NAMES[i]) != 0) continue;
+
+			isa = (simd_isa) i;
+			return true;
+		}
+
+		return false;
+	}
+}
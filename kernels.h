@@ -0,0 +1,65 @@
+﻿#pragma once
+#include "bvh8.h"
+
+//the instruction set versions need x86 and the sse vec3f that resolve loads as 4 floats, other builds only have
+//the baseline
+#if defined(RAYTRACER_SIMD_MATHS) && (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86))
+#define RAYTRACER_ISA_KERNELS
+#endif
+
+namespace raytracer {
+	//instruction sets the hot kernels are built for. baseline is whatever the build targets, the others are
+	//compiled in their own translation units (kernels_*.cpp) and only run on cpus that support them
+	enum simd_isa {
+		SIMD_ISA_BASELINE,
+		SIMD_ISA_SSE42,
+		SIMD_ISA_AVX2,
+		SIMD_ISA_AVX512,
+		SIMD_ISA_COUNT
+	};
+
+	//one version of the kernels, everything in it was compiled for the same instruction set
+	struct simd_kernels {
+		const char* name;
+
+		//closest hit of r with the triangle blocks of a bottom level, only hits closer than h.t count. returns
+		//true and updates t, u, v and triangle of h if it found one
+		bool (*closest_hit)(const bvh8& tree, const triangle_block* blocks, const ray& r, hit& h);
+
+		//true if r hits any triangle of the bottom level closer than tmax
+		bool (*any_hit)(const bvh8& tree, const triangle_block* blocks, const ray& r, const float tmax);
+
+		//colors * scale to display bytes, clamped to [0, 1] and rounded, 4 bytes per pixel with alpha 255
+		void (*resolve)(const vec3f* colors, const float scale, const size_t count, byte* pixels);
+	};
+
+	//the kernels in use, default_kernels() unless the environment variable RAYTRACER_ISA (baseline, sse4.2, avx2
+	//or avx512) asks for the versions of one instruction set, for testing
+	const simd_kernels& kernels();
+
+	//each kernel from the instruction set it is fastest with on the cpus measured (--bench isa): resolve from the
+	//best one the cpu supports, traversal from avx2 if it has that and baseline otherwise. the sse4.2 traversal
+	//does not beat the baseline and the avx512 one does not beat avx2
+	const simd_kernels& default_kernels();
+
+	//best instruction set this machine runs, by cpuid
+	simd_isa detect_simd_isa();
+	bool simd_isa_supported(const simd_isa isa);
+
+	//kernels of one instruction set, nullptr if it was not built or the cpu does not support it
+	const simd_kernels* kernels_for(const simd_isa isa);
+
+	//switches the kernels in use, for tests and benchmarks. must not be called while rays are traced. force
+	//returns false and keeps the current ones if the cpu does not support isa
+	void set_kernels(const simd_kernels& k);
+	bool force_simd_isa(const simd_isa isa);
+
+	//name as accepted by RAYTRACER_ISA, and the other way round. parse returns false for unknown names
+	const char* simd_isa_name(const simd_isa isa);
+	bool parse_simd_isa(const char* name, simd_isa& isa);
+
+	//the versions built in the instruction set translation units, see kernels.inl
+	const simd_kernels& kernels_sse42();
+	const simd_kernels& kernels_avx2();
+	const simd_kernels& kernels_avx512();
+}
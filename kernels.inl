@@ -0,0 +1,298 @@
+﻿#pragma once
+#include "kernels.h"
+
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+//trace kernels compiled once per instruction set by kernels_sse42.cpp, kernels_avx2.cpp and kernels_avx512.cpp.
+//those include the headers first and only then switch the compiler's target, so inline functions of the headers
+//stay baseline code wherever the linker picks them from. everything here has internal linkage for the same
+//reason, the versions never mix. the including file defines one of RAYTRACER_KERNEL_SSE42, RAYTRACER_KERNEL_AVX2
+//or RAYTRACER_KERNEL_AVX512
+
+
+namespace raytracer {
+	namespace {
+		static_assert(sizeof(vec3f) == 4 * sizeof(float), "resolve loads colors as 4 floats");
+
+#if defined(RAYTRACER_KERNEL_SSE42)
+		//4 lanes, comparisons give all-ones lanes
+		struct lanes {
+			static constexpr int width = 4;
+			__m128 m;
+
+			lanes() { }
+			lanes(const __m128 v) : m(v) { }
+			explicit lanes(const float f) : m(_mm_set1_ps(f)) { }
+
+			static lanes load(const float* p) { return _mm_load_ps(p); }
+			static lanes load_bytes(const uint8_t* p) {
+				int32_t bytes;
+				memcpy(&bytes, p, sizeof(bytes));
+				return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes)));
+			}
+			void store(float* p) const { _mm_store_ps(p, m); }
+		};
+
+		typedef lanes lane_mask;
+
+		inline lanes operator+(const lanes a, const lanes b) { return _mm_add_ps(a.m, b.m); }
+		inline lanes operator-(const lanes a, const lanes b) { return _mm_sub_ps(a.m, b.m); }
+		inline lanes operator*(const lanes a, const lanes b) { return _mm_mul_ps(a.m, b.m); }
+		inline lanes operator/(const lanes a, const lanes b) { return _mm_div_ps(a.m, b.m); }
+		inline lanes fmadd(const lanes a, const lanes b, const lanes c) { return _mm_add_ps(_mm_mul_ps(a.m, b.m), c.m); }
+		inline lanes vmin(const lanes a, const lanes b) { return _mm_min_ps(a.m, b.m); }
+		inline lanes vmax(const lanes a, const lanes b) { return _mm_max_ps(a.m, b.m); }
+		inline lanes vabs(const lanes a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.m); }
+
+		inline lane_mask operator&(const lane_mask a, const lane_mask b) { return _mm_and_ps(a.m, b.m); }
+		inline lane_mask less(const lanes a, const lanes b) { return _mm_cmplt_ps(a.m, b.m); }
+		inline lane_mask less_equal(const lanes a, const lanes b) { return _mm_cmple_ps(a.m, b.m); }
+		inline int bits(const lane_mask a) { return _mm_movemask_ps(a.m); }
+#else
+		//8 lanes. avx512 compares straight into mask registers, avx2 into all-ones lanes
+		struct lanes {
+			static constexpr int width = 8;
+			__m256 m;
+
+			lanes() { }
+			lanes(const __m256 v) : m(v) { }
+			explicit lanes(const float f) : m(_mm256_set1_ps(f)) { }
+
+			static lanes load(const float* p) { return _mm256_load_ps(p); }
+			static lanes load_bytes(const uint8_t* p) { return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) p))); }
+			void store(float* p) const { _mm256_store_ps(p, m); }
+		};
+
+		inline lanes operator+(const lanes a, const lanes b) { return _mm256_add_ps(a.m, b.m); }
+		inline lanes operator-(const lanes a, const lanes b) { return _mm256_sub_ps(a.m, b.m); }
+		inline lanes operator*(const lanes a, const lanes b) { return _mm256_mul_ps(a.m, b.m); }
+		inline lanes operator/(const lanes a, const lanes b) { return _mm256_div_ps(a.m, b.m); }
+		inline lanes fmadd(const lanes a, const lanes b, const lanes c) { return _mm256_fmadd_ps(a.m, b.m, c.m); }
+		inline lanes vmin(const lanes a, const lanes b) { return _mm256_min_ps(a.m, b.m); }
+		inline lanes vmax(const lanes a, const lanes b) { return _mm256_max_ps(a.m, b.m); }
+		inline lanes vabs(const lanes a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.m); }
+
+#if defined(RAYTRACER_KERNEL_AVX512)
+		typedef __mmask8 lane_mask;
+
+		inline lane_mask less(const lanes a, const lanes b) { return _mm256_cmp_ps_mask(a.m, b.m, _CMP_LT_OQ); }
+		inline lane_mask less_equal(const lanes a, const lanes b) { return _mm256_cmp_ps_mask(a.m, b.m, _CMP_LE_OQ); }
+		inline int bits(const lane_mask a) { return (int) a; }
+#else
+		struct lane_mask {
+			__m256 m;
+			lane_mask(const __m256 v) : m(v) { }
+		};
+
+		inline lane_mask operator&(const lane_mask a, const lane_mask b) { return _mm256_and_ps(a.m, b.m); }
+		inline lane_mask less(const lanes a, const lanes b) { return _mm256_cmp_ps(a.m, b.m, _CMP_LT_OQ); }
+		inline lane_mask less_equal(const lanes a, const lanes b) { return _mm256_cmp_ps(a.m, b.m, _CMP_LE_OQ); }
+		inline int bits(const lane_mask a) { return _mm256_movemask_ps(a.m); }
+#endif
+#endif
+
+#if defined(RAYTRACER_KERNEL_AVX512)
+		//all 8 children in one 16 lane register: entries in the low half and exits negated in the high half, so a
+		//single running max over the axes yields tmin below and -tfar above
+		int enter_children(const bvh8_node& node, const vec3f& origin, const vec3f& invDir, const float tmax, float* distance) {
+			const __m512i negateHigh = _mm512_maskz_set1_epi32(0xFF00, (int) 0x80000000);
+			__m512 t = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(_mm512_set1_ps(tmax)), negateHigh));
+			t = _mm512_mask_blend_ps(0xFF00, _mm512_setzero_ps(), t);
+			for (int axis = 0; axis < 3; ++axis) {
+				const float cell = node.cell(axis) * invDir[axis];
+				const float base = (node.origin[axis] - origin[axis]) * invDir[axis];
+				const bool positive = invDir[axis] >= 0.0f;
+				const uint8_t* entry = (positive ? node.lo : node.hi)[axis];
+				const uint8_t* exit = (positive ? node.hi : node.lo)[axis];
+
+				const __m128i q = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*) entry), _mm_loadl_epi64((const __m128i*) exit));
+				const __m512 d = _mm512_fmadd_ps(_mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(q)), _mm512_set1_ps(cell), _mm512_set1_ps(base));
+				t = _mm512_max_ps(t, _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(d), negateHigh)));
+			}
+
+			const __m256 tmin = _mm512_castps512_ps256(t);
+			const __m256 tfar = _mm256_xor_ps(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(t), 1)), _mm256_set1_ps(-0.0f));
+			_mm256_store_ps(distance, tmin);
+			return (int) _mm256_cmp_ps_mask(tmin, tfar, _CMP_LE_OQ) & node.child_mask();
+		}
+#else
+		//slab test of one ray against all children, the mask of the ones it enters before tmax
+		int enter_children(const bvh8_node& node, const vec3f& origin, const vec3f& invDir, const float tmax, float* distance) {
+			lanes cell[3], base[3];
+			bool positive[3];
+			for (int axis = 0; axis < 3; ++axis) {
+				cell[axis] = lanes(node.cell(axis) * invDir[axis]);
+				base[axis] = lanes((node.origin[axis] - origin[axis]) * invDir[axis]);
+				positive[axis] = invDir[axis] >= 0.0f;
+			}
+
+			int mask = 0;
+			for (int c = 0; c < BVH8_WIDTH; c += lanes::width) {
+				lanes tmin(0.0f), tfar(tmax);
+				for (int axis = 0; axis < 3; ++axis) {
+					const lanes entry = lanes::load_bytes((positive[axis] ? node.lo : node.hi)[axis] + c);
+					const lanes exit = lanes::load_bytes((positive[axis] ? node.hi : node.lo)[axis] + c);
+					tmin = vmax(tmin, fmadd(entry, cell[axis], base[axis]));
+					tfar = vmin(tfar, fmadd(exit, cell[axis], base[axis]));
+				}
+
+				tmin.store(distance + c);
+				mask |= bits(less_equal(tmin, tfar)) << c;
+			}
+
+			return mask & node.child_mask();
+		}
+#endif
+
+		//moller-trumbore for the lanes [offset, offset + width) of the block, the same test as triangles.cpp.
+		//returns the lanes that hit closer than tmax and writes their distances and barycentrics
+		int intersect_lanes(const triangle_block& block, const int offset, const ray& r, const float tmax, float* t, float* u, float* v) {
+			const lanes ox(r.origin.x()), oy(r.origin.y()), oz(r.origin.z());
+			const lanes dx(r.direction.x()), dy(r.direction.y()), dz(r.direction.z());
+
+			const lanes e1x = lanes::load(block.e1x + offset), e1y = lanes::load(block.e1y + offset), e1z = lanes::load(block.e1z + offset);
+			const lanes e2x = lanes::load(block.e2x + offset), e2y = lanes::load(block.e2y + offset), e2z = lanes::load(block.e2z + offset);
+
+			//p = d x e2
+			const lanes px = dy * e2z - dz * e2y;
+			const lanes py = dz * e2x - dx * e2z;
+			const lanes pz = dx * e2y - dy * e2x;
+			const lanes det = fmadd(e1x, px, fmadd(e1y, py, e1z * pz));
+			const lanes invDet = lanes(1.0f) / det;
+
+			const lanes sx = ox - lanes::load(block.v0x + offset);
+			const lanes sy = oy - lanes::load(block.v0y + offset);
+			const lanes sz = oz - lanes::load(block.v0z + offset);
+			const lanes lu = fmadd(sx, px, fmadd(sy, py, sz * pz)) * invDet;
+
+			//q = s x e1
+			const lanes qx = sy * e1z - sz * e1y;
+			const lanes qy = sz * e1x - sx * e1z;
+			const lanes qz = sx * e1y - sy * e1x;
+			const lanes lv = fmadd(dx, qx, fmadd(dy, qy, dz * qz)) * invDet;
+			const lanes lt = fmadd(e2x, qx, fmadd(e2y, qy, e2z * qz)) * invDet;
+
+			const lanes zero(0.0f);
+			const lane_mask mask = less_equal(lanes(1e-12f), vabs(det)) & less_equal(zero, lu) & less_equal(zero, lv) & less_equal(lu + lv, lanes(1.0f)) &
+				less(zero, lt) & less(lt, lanes(tmax));
+			const int hits = bits(mask);
+			if (hits == 0) return 0;
+
+			lt.store(t + offset);
+			lu.store(u + offset);
+			lv.store(v + offset);
+			return hits << offset;
+		}
+
+		//lanes of the block that r hits closer than h.t, with any the first one found is enough
+		bool intersect_triangles(const triangle_block& block, const ray& r, hit& h, const bool any) {
+			alignas(32) float t[TRIANGLE_BLOCK_WIDTH], u[TRIANGLE_BLOCK_WIDTH], v[TRIANGLE_BLOCK_WIDTH];
+
+			int hits = 0;
+			for (int offset = 0; offset < TRIANGLE_BLOCK_WIDTH; offset += lanes::width) {
+				hits |= intersect_lanes(block, offset, r, h.t, t, u, v);
+				if (any && hits) return true;
+			}
+			if (hits == 0) return false;
+
+			int lane = lowest_bit(hits);
+			for (int i = lane + 1; i < TRIANGLE_BLOCK_WIDTH; ++i) {
+				if ((hits >> i & 1) && t[i] < t[lane]) lane = i;
+			}
+
+			h.t = t[lane];
+			h.u = u[lane];
+			h.v = v[lane];
+			h.triangle = block.id[lane];
+			return true;
+		}
+
+		//the walk of traverse() in bvh8.h with the leaves tested here
+		template <bool ANY>
+		bool walk(const bvh8& tree, const triangle_block* blocks, const ray& r, hit& h) {
+			if (tree.empty()) return false;
+
+			const vec3f invDir = safe_inverse(r.direction);
+			bvh8_entry stack[BVH8_STACK_SIZE];
+			int stackSize = 0;
+			stack[stackSize++] = { 0, 0, 0.0f };
+
+			alignas(32) float distance[BVH8_WIDTH];
+			bool found = false;
+			while (stackSize > 0) {
+				const bvh8_entry e = stack[--stackSize];
+				if (e.distance >= h.t) continue;
+
+				if (e.count != 0) {
+					for (unsigned b = e.index; b < e.index + e.count; ++b) {
+						if (!intersect_triangles(blocks[b], r, h, ANY)) continue;
+
+						found = true;
+						if (ANY) return true;
+					}
+					continue;
+				}
+
+				const bvh8_node& node = tree.nodes[e.index];
+				const int mask = enter_children(node, r.origin, invDir, h.t, distance);
+				push_children(node, mask, distance, stack, stackSize);
+			}
+
+			return found;
+		}
+
+		bool closest_hit(const bvh8& tree, const triangle_block* blocks, const ray& r, hit& h) {
+			return walk<false>(tree, blocks, r, h);
+		}
+
+		bool any_hit(const bvh8& tree, const triangle_block* blocks, const ray& r, const float tmax) {
+			hit h;
+			h.t = tmax;
+			return walk<true>(tree, blocks, r, h);
+		}
+
+		//255 * clamped color + 0.5, truncated. the same float operations as the scalar version, so every
+		//version rounds alike
+		void resolve(const vec3f* colors, const float scale, const size_t count, byte* pixels) {
+			const float* c = (const float*) colors;
+			size_t i = 0;
+
+#if defined(RAYTRACER_KERNEL_AVX512)
+			//4 pixels per register, saturated straight down to bytes
+			const __m512 s = _mm512_set1_ps(scale), zero = _mm512_setzero_ps(), one = _mm512_set1_ps(1.0f);
+			const __m512 full = _mm512_set1_ps(255.0f), half = _mm512_set1_ps(0.5f);
+			for (; i + 4 <= count; i += 4) {
+				const __m512 clamped = _mm512_min_ps(_mm512_max_ps(_mm512_mul_ps(_mm512_loadu_ps(c + 4 * i), s), zero), one);
+				const __m128i bytes = _mm512_cvtusepi32_epi8(_mm512_cvttps_epi32(_mm512_add_ps(_mm512_mul_ps(clamped, full), half)));
+				_mm_storeu_si128((__m128i*) (pixels + 4 * i), _mm_or_si128(bytes, _mm_set1_epi32((int) 0xFF000000)));
+			}
+#elif defined(RAYTRACER_KERNEL_AVX2)
+			//2 pixels per register, packed to bytes in its 128 bit halves
+			const __m256 s = _mm256_set1_ps(scale), zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+			const __m256 full = _mm256_set1_ps(255.0f), half = _mm256_set1_ps(0.5f);
+			for (; i + 4 <= count; i += 4) {
+				__m256i words[2];
+				for (int k = 0; k < 2; ++k) {
+					const __m256 clamped = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(c + 4 * (i + 2 * k)), s), zero), one);
+					words[k] = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(clamped, full), half));
+				}
+
+				const __m256i shorts = _mm256_packus_epi32(words[0], words[1]); //pixels 0 2 | 1 3
+				const __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(shorts), _mm256_extracti128_si256(shorts, 1)); //0 2 1 3
+				const __m128i ordered = _mm_shuffle_epi32(bytes, _MM_SHUFFLE(3, 1, 2, 0));
+				_mm_storeu_si128((__m128i*) (pixels + 4 * i), _mm_or_si128(ordered, _mm_set1_epi32((int) 0xFF000000)));
+			}
+#endif
+			const __m128 s4 = _mm_set1_ps(scale);
+			for (; i < count; ++i) {
+				const __m128 clamped = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(c + 4 * i), s4), _mm_setzero_ps()), _mm_set1_ps(1.0f));
+				const __m128i words = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(clamped, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+				const __m128i bytes = _mm_packus_epi16(_mm_packus_epi32(words, words), _mm_setzero_si128());
+				const int pixel = _mm_cvtsi128_si32(bytes) | (int) 0xFF000000;
+				memcpy(pixels + 4 * i, &pixel, sizeof(pixel));
+			}
+		}
+	}
+}
@@ -0,0 +1,29 @@
+﻿//the kernels of kernels.inl built for avx2 and fma, kernels() only hands them out on cpus that have it
+#include "kernels.h"
+
+#ifdef RAYTRACER_ISA_KERNELS
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,fma"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+
+#define RAYTRACER_KERNEL_AVX2
+#include "kernels.inl"
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+namespace raytracer {
+	const simd_kernels& kernels_avx2() {
+		static const simd_kernels k = { "avx2", &closest_hit, &any_hit, &resolve };
+		return k;
+	}
+}
+#endif
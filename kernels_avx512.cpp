@@ -0,0 +1,34 @@
+﻿//the kernels of kernels.inl built for avx512f and avx512vl, kernels() only hands them out on cpus that have it
+#include "kernels.h"
+
+#ifdef RAYTRACER_ISA_KERNELS
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f,avx512vl,avx2,fma"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512vl,avx2,fma")
+#pragma GCC diagnostic push
+//gcc 12 warns about the undefined source register of its own avx512 intrinsics, wherever they are inlined
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#define RAYTRACER_KERNEL_AVX512
+#include "kernels.inl"
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+#endif
+
+namespace raytracer {
+	const simd_kernels& kernels_avx512() {
+		static const simd_kernels k = { "avx512", &closest_hit, &any_hit, &resolve };
+		return k;
+	}
+}
+#endif
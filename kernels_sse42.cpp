@@ -0,0 +1,29 @@
+﻿//the kernels of kernels.inl built for sse4.2, kernels() only hands them out on cpus that have it
+#include "kernels.h"
+
+#ifdef RAYTRACER_ISA_KERNELS
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("sse4.2,popcnt"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("sse4.2,popcnt")
+#endif
+
+#define RAYTRACER_KERNEL_SSE42
+#include "kernels.inl"
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+namespace raytracer {
+	const simd_kernels& kernels_sse42() {
+		static const simd_kernels k = { "sse4.2", &closest_hit, &any_hit, &resolve };
+		return k;
+	}
+}
+#endif
@@ -2,7 +2,7 @@
 #include <cstdlib>
 
 #define GLEW_STATIC
-#include "measurements.h"
+#include "frame_pipeline.h"
 #include "raytracer.h"
 #include "GL/glew.h"
 #include "GLFW/glfw3.h"
@@ -13,12 +13,15 @@
 #define WIDTH_INIT 1280
 #define HEIGHT_INIT 720
 
+//frames that would take longer are traced at a lower resolution and upscaled
+#define TARGET_FRAME_MS 33.3
+
 
 namespace raytracer {
 	typedef struct raytracer_data_t {
 		int width;
 		int height;
-		byte* pixels;
+		frame_pipeline* pipeline;
 	} raytracer_data;
 
 	static void on_framebuffer_resize(GLFWwindow* window, const int width, const int height) {
@@ -26,12 +29,10 @@ namespace raytracer {
 
 		data->width = width;
 		data->height = height;
-		free(data->pixels);
-		data->pixels = (byte*) calloc(width * height * 4, 1);
-		
-		//reset screen
-		terminate_screen();
-		init_screen(width, height);
+
+		//the next rendered frame has the new size, which also restarts accumulation.
+		//the screen texture is resized by the presenter once that frame arrives
+		data->pipeline->resize(width, height);
 		glViewport(0, 0, width, height);
 	}
 }
@@ -47,25 +48,34 @@ int main() {
 	glewInit();
 	glfwShowWindow(window);
 
-	raytracer::init_screen(WIDTH_INIT, HEIGHT_INIT);
-
-	raytracer::raytracer_data data;
-	data.width = WIDTH_INIT;
-	data.height = HEIGHT_INIT;
-	data.pixels = (byte*) calloc(WIDTH_INIT * HEIGHT_INIT * 4, 1);
-	glfwSetWindowUserPointer(window, &data);
-
-	while (!glfwWindowShouldClose(window)) {
-		raytracer::scoped_timer t([](const int dt) { printf("frame took %d ms - %d fps\n", dt, 1000 / dt); });
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		raytracer::run(data.pixels, data.width, data.height);
-		raytracer::draw_screen(data.pixels);
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+	{
+		raytracer::gl_presenter presenter(window, WIDTH_INIT, HEIGHT_INIT);
+		raytracer::frame_pipeline pipeline(WIDTH_INIT, HEIGHT_INIT);
+		pipeline.set_frame_time_target(TARGET_FRAME_MS);
+
+		raytracer::raytracer_data data;
+		data.width = WIDTH_INIT;
+		data.height = HEIGHT_INIT;
+		data.pipeline = &pipeline;
+		glfwSetWindowUserPointer(window, &data);
+
+		//frames are traced on the pipeline's thread, this one only uploads, swaps and handles events
+		pipeline.start();
+		while (!glfwWindowShouldClose(window)) {
+			if (pipeline.present(presenter, 16)) {
+				const double dt = pipeline.presented_render_ms();
+				int renderWidth, renderHeight;
+				pipeline.presented_render_size(renderWidth, renderHeight);
+				printf("frame took %.2f ms - %.1f fps, traced at %dx%d\n", dt, dt > 0.0 ? 1000.0 / dt : 0.0, renderWidth, renderHeight);
+			}
+
+			glfwPollEvents();
+		}
+		pipeline.stop();
 	}
 
 	glfwDestroyWindow(window);
 	glfwTerminate();
 
 	return 0;
-}
\ No newline at end of file
+}
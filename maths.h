@@ -3,9 +3,38 @@
 #include <cassert>
 #include <cmath>
 
+#if !defined(RAYTRACER_SCALAR_MATHS) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define RAYTRACER_SIMD_MATHS
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 typedef unsigned char byte;
 
 namespace raytracer {
+	//index of the lowest set bit, mask must not be zero
+	inline int lowest_bit(const unsigned mask) {
+#ifdef _MSC_VER
+		unsigned long idx;
+		_BitScanForward(&idx, mask);
+		return (int) idx;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+}
+
+namespace raytracer {
+//the vector types live in an inline namespace named after the build configuration, so a translation unit
+//compiled with RAYTRACER_SCALAR_MATHS (see benchmark_vec_scalar.cpp) can be linked next to the simd ones
+#ifdef RAYTRACER_SIMD_MATHS
+inline namespace simd {
+#else
+inline namespace scalar {
+#endif
 
 	//declarations
 
@@ -20,8 +49,8 @@ namespace raytracer {
 		vec(const Scalar& v0, const Scalar& v1);
 		vec(const Scalar& v0, const Scalar& v1, const Scalar& v2);
 		vec(const Scalar& v0, const Scalar& v1, const Scalar& v2, const Scalar& v3);
-		vec(const vec<Scalar, D>& v);
-		vec(const vec<Scalar, D>&& v) noexcept;
+		vec(const vec<Scalar, D>& v) = default;
+		vec(vec<Scalar, D>&& v) noexcept = default;
 
 		Scalar& x();
 		Scalar& y();
@@ -72,15 +101,14 @@ namespace raytracer {
 		bool operator>= (const vec<Scalar, D>& v) const;
 		bool operator<= (const vec<Scalar, D>& v) const;
 
-		float& operator[] (const size_t idx);
-		const float& operator[] (const size_t idx) const;
+		Scalar& operator[] (const size_t idx);
+		const Scalar& operator[] (const size_t idx) const;
 
-		float& operator() (const size_t idx);
-		const float& operator() (const size_t idx) const;
+		Scalar& operator() (const size_t idx);
+		const Scalar& operator() (const size_t idx) const;
 
-		//vec<Scalar, D>& operator=(vec<Scalar, D> v) noexcept;
-		vec<Scalar, D>& operator=(const vec<Scalar, D>& v);
-		//vec<Scalar, D>& operator=(vec<Scalar, D>&& v) noexcept;
+		vec<Scalar, D>& operator=(const vec<Scalar, D>& v) = default;
+		vec<Scalar, D>& operator=(vec<Scalar, D>&& v) noexcept = default;
 	};
 
 	template <typename Scalar, int D>
@@ -89,6 +117,12 @@ namespace raytracer {
 	template <typename Scalar, int D>
 	vec<Scalar, D> operator/(const Scalar f, const vec<Scalar, D>& v);
 
+	template <typename Scalar, int D>
+	vec<Scalar, D> component_min(const vec<Scalar, D>& a, const vec<Scalar, D>& b);
+
+	template <typename Scalar, int D>
+	vec<Scalar, D> component_max(const vec<Scalar, D>& a, const vec<Scalar, D>& b);
+
 	typedef vec<float, 1> vec1f;
 	typedef vec<float, 2> vec2f;
 	typedef vec<float, 3> vec3f;
@@ -142,16 +176,6 @@ namespace raytracer {
 		_elements[3] = v3;
 	}
 
-	template <typename Scalar, int D>
-	vec<Scalar, D>::vec(const vec<Scalar, D>& v) {
-		memcpy(_elements, v._elements, D * sizeof(Scalar));
-	}
-
-	template <typename Scalar, int D>
-	vec<Scalar, D>::vec(const vec<Scalar, D>&& v) noexcept {
-		memcpy(_elements, v._elements, D * sizeof(Scalar));
-	}
-
 	template <typename Scalar, int D>
 	Scalar& vec<Scalar, D>::x() {
 		assert(D >= 1 && "vector dimension too small!");
@@ -245,7 +269,7 @@ namespace raytracer {
 
 	template <typename Scalar, int D>
 	void vec<Scalar, D>::normalize() {
-		const Scalar len = len();
+		const Scalar len = this->len();
 		assert(len != static_cast<Scalar>(0) && "cannot normalize zero vector!");
 		*this /= len;
 	}
@@ -303,12 +327,10 @@ namespace raytracer {
 	template <typename Scalar, int D>
 	vec<Scalar, D> vec<Scalar, D>::cross(const vec<Scalar, D>& v) const {
 		assert(D == 3 && "dimension must be 3!");
-		vec<Scalar, D> result;
-		for (int i = 0; i < D; ++i) {
-			result[i] = _elements[(i + 1) % 3] * v[(i + 2) % 3] - _elements[(i + 2) % 3] * v[(i + 1) % 3];
-		}
-
-		return result;
+		return vec<Scalar, D>(
+			_elements[1] * v[2] - _elements[2] * v[1],
+			_elements[2] * v[0] - _elements[0] * v[2],
+			_elements[0] * v[1] - _elements[1] * v[0]);
 	}
 
 	template <typename Scalar, int D>
@@ -417,38 +439,29 @@ namespace raytracer {
 	}
 
 	template <typename Scalar, int D>
-	float& vec<Scalar, D>::operator[](const size_t idx) {
-		assert(idx >= 0 && idx < D && "index out of range!");
+	Scalar& vec<Scalar, D>::operator[](const size_t idx) {
+		assert(idx < D && "index out of range!");
 		return _elements[idx];
 	}
 
 	template <typename Scalar, int D>
-	const float& vec<Scalar, D>::operator[](const size_t idx) const {
-		assert(idx >= 0 && idx < D && "index out of range!");
+	const Scalar& vec<Scalar, D>::operator[](const size_t idx) const {
+		assert(idx < D && "index out of range!");
 		return _elements[idx];
 	}
 
 	template <typename Scalar, int D>
-	float& vec<Scalar, D>::operator()(const size_t idx) {
-		assert(idx >= 0 && idx < D && "index out of range!");
+	Scalar& vec<Scalar, D>::operator()(const size_t idx) {
+		assert(idx < D && "index out of range!");
 		return _elements[idx];
 	}
 
 	template <typename Scalar, int D>
-	const float& vec<Scalar, D>::operator()(const size_t idx) const {
-		assert(idx >= 0 && idx < D && "index out of range!");
+	const Scalar& vec<Scalar, D>::operator()(const size_t idx) const {
+		assert(idx < D && "index out of range!");
 		return _elements[idx];
 	}
 
-	template <typename Scalar, int D>
-	vec<Scalar, D>& vec<Scalar, D>::operator=(const vec<Scalar, D>& v) {
-		if (this != &v) {
-			memcpy(_elements, v._elements, D * sizeof(Scalar));
-		}
-
-		return *this;
-	}
-
 
 	template <typename Scalar, int D>
 	vec<Scalar, D> operator*(const Scalar f, const vec<Scalar, D>& v) {
@@ -459,4 +472,173 @@ namespace raytracer {
 	vec<Scalar, D> operator/(const Scalar f, const vec<Scalar, D>& v) {
 		return v.div(f);
 	}
+
+	template <typename Scalar, int D>
+	vec<Scalar, D> component_min(const vec<Scalar, D>& a, const vec<Scalar, D>& b) {
+		vec<Scalar, D> result;
+		for (int i = 0; i < D; ++i) result[i] = std::min(a[i], b[i]);
+		return result;
+	}
+
+	template <typename Scalar, int D>
+	vec<Scalar, D> component_max(const vec<Scalar, D>& a, const vec<Scalar, D>& b) {
+		vec<Scalar, D> result;
+		for (int i = 0; i < D; ++i) result[i] = std::max(a[i], b[i]);
+		return result;
+	}
+
+
+#ifdef RAYTRACER_SIMD_MATHS
+	//sse specializations of vec3f and vec4f, one 16 byte aligned register per vector.
+	//vec3f keeps its padding lane at zero so that dot products and comparisons can use all four lanes
+
+	template <> struct vec<float, 3>;
+	template <> struct vec<float, 4>;
+
+	template <int D>
+	struct alignas(16) vec_sse {
+		protected:
+		union {
+			__m128 _m;
+			float _elements[4];
+		};
+
+		template <int> friend struct vec_sse;
+
+		//takes the register as it is, only for results that keep the padding lane at zero
+		explicit vec_sse(const __m128 m) : _m(m) { }
+
+		static __m128 lane_mask() {
+			return D == 3 ? _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1)) : _mm_castsi128_ps(_mm_set1_epi32(-1));
+		}
+
+		static float horizontal_sum(const __m128 m) {
+			const __m128 pairs = _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+			return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_movehl_ps(pairs, pairs)));
+		}
+
+		public:
+		typedef vec<float, D> vec_type;
+
+		vec_sse() : _m(_mm_setzero_ps()) { }
+		explicit vec_sse(const float& v0) : _m(_mm_set_ss(v0)) { }
+		vec_sse(const float& v0, const float& v1) : _m(_mm_setr_ps(v0, v1, 0.0f, 0.0f)) { }
+		vec_sse(const float& v0, const float& v1, const float& v2) : _m(_mm_setr_ps(v0, v1, v2, 0.0f)) { }
+		vec_sse(const float& v0, const float& v1, const float& v2, const float& v3) : _m(_mm_setr_ps(v0, v1, v2, D == 3 ? 0.0f : v3)) {
+			assert(D >= 4 && "vector dimension too small!");
+		}
+
+		__m128 simd() const { return _m; }
+
+		float& x() { return _elements[0]; }
+		float& y() { return _elements[1]; }
+		float& z() { return _elements[2]; }
+		float& w() { assert(D >= 4 && "vector dimension too small!"); return _elements[3]; }
+		const float& x() const { return _elements[0]; }
+		const float& y() const { return _elements[1]; }
+		const float& z() const { return _elements[2]; }
+		const float& w() const { assert(D >= 4 && "vector dimension too small!"); return _elements[3]; }
+		vec<float, 2> xy() const { return vec<float, 2>(_elements[0], _elements[1]); }
+		vec<float, 3> xyz() const;
+
+		float dot(const vec_type& v) const { return horizontal_sum(_mm_mul_ps(_m, v._m)); }
+		float len() const { return std::sqrt(lenSquared()); }
+		float lenSquared() const { return dot(static_cast<const vec_type&>(*this)); }
+		float dist(const vec_type& v) const { return sub(v).len(); }
+		float distSquared(const vec_type& v) const { return sub(v).lenSquared(); }
+
+		void normalize() {
+			const float len = this->len();
+			assert(len != 0.0f && "cannot normalize zero vector!");
+			_m = _mm_div_ps(_m, _mm_set1_ps(len));
+		}
+
+		vec_type normalized() const {
+			const float len = this->len();
+			assert(len != 0.0f && "cannot normalize zero vector!");
+			return vec_type(_mm_div_ps(_m, _mm_set1_ps(len)));
+		}
+
+		vec_type mul(const float f) const { return vec_type(_mm_mul_ps(_m, _mm_set1_ps(f))); }
+		vec_type mul(const vec_type& v) const { return vec_type(_mm_mul_ps(_m, v._m)); }
+		vec_type div(const float f) const {
+			assert(f != 0.0f && "cannot divide by zero!");
+			return vec_type(_mm_div_ps(_m, _mm_set1_ps(f)));
+		}
+		vec_type div(const vec_type& v) const { return vec_type(_mm_and_ps(_mm_div_ps(_m, v._m), lane_mask())); } //0/0 in the padding lane
+		vec_type add(const vec_type& v) const { return vec_type(_mm_add_ps(_m, v._m)); }
+		vec_type sub(const vec_type& v) const { return vec_type(_mm_sub_ps(_m, v._m)); }
+
+		vec_type cross(const vec_type& v) const {
+			assert(D == 3 && "dimension must be 3!");
+			const __m128 aYzx = _mm_shuffle_ps(_m, _m, _MM_SHUFFLE(3, 0, 2, 1));
+			const __m128 bYzx = _mm_shuffle_ps(v._m, v._m, _MM_SHUFFLE(3, 0, 2, 1));
+			const __m128 c = _mm_sub_ps(_mm_mul_ps(_m, bYzx), _mm_mul_ps(aYzx, v._m)); //in zxy order
+			return vec_type(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+		}
+
+		vec_type operator* (const vec_type& v) const { return mul(v); }
+		vec_type operator/ (const vec_type& v) const { return div(v); }
+		vec_type operator* (const float f) const { return mul(f); }
+		vec_type operator/ (const float f) const { return div(f); }
+		vec_type operator+ (const vec_type& v) const { return add(v); }
+		vec_type operator- (const vec_type& v) const { return sub(v); }
+
+		vec_type& operator*= (const vec_type& v) { _m = _mm_mul_ps(_m, v._m); return self(); }
+		vec_type& operator/= (const vec_type& v) { _m = _mm_and_ps(_mm_div_ps(_m, v._m), lane_mask()); return self(); }
+		vec_type& operator*= (const float f) { _m = _mm_mul_ps(_m, _mm_set1_ps(f)); return self(); }
+		vec_type& operator/= (const float f) { assert(f); _m = _mm_div_ps(_m, _mm_set1_ps(f)); return self(); }
+		vec_type& operator+= (const vec_type& v) { _m = _mm_add_ps(_m, v._m); return self(); }
+		vec_type& operator-= (const vec_type& v) { _m = _mm_sub_ps(_m, v._m); return self(); }
+
+		bool operator== (const vec_type& v) const { return _mm_movemask_ps(_mm_cmpeq_ps(_m, v._m)) == 0xF; }
+		bool operator!= (const vec_type& v) const { return !(*this == v); }
+		bool operator> (const vec_type& v) const { return lenSquared() > v.lenSquared(); }
+		bool operator< (const vec_type& v) const { return lenSquared() < v.lenSquared(); }
+		bool operator>= (const vec_type& v) const { return lenSquared() >= v.lenSquared(); }
+		bool operator<= (const vec_type& v) const { return lenSquared() <= v.lenSquared(); }
+
+		float& operator[] (const size_t idx) { assert(idx < D && "index out of range!"); return _elements[idx]; }
+		const float& operator[] (const size_t idx) const { assert(idx < D && "index out of range!"); return _elements[idx]; }
+
+		float& operator() (const size_t idx) { assert(idx < D && "index out of range!"); return _elements[idx]; }
+		const float& operator() (const size_t idx) const { assert(idx < D && "index out of range!"); return _elements[idx]; }
+
+		private:
+		vec_type& self() { return static_cast<vec_type&>(*this); }
+	};
+
+	template <>
+	struct vec<float, 3> : vec_sse<3> {
+		using vec_sse<3>::vec_sse;
+		vec() = default;
+
+		private:
+		template <int> friend struct vec_sse;
+		friend vec<float, 3> component_min(const vec<float, 3>& a, const vec<float, 3>& b);
+		friend vec<float, 3> component_max(const vec<float, 3>& a, const vec<float, 3>& b);
+	};
+
+	template <>
+	struct vec<float, 4> : vec_sse<4> {
+		using vec_sse<4>::vec_sse;
+		vec() = default;
+
+		private:
+		template <int> friend struct vec_sse;
+		friend vec<float, 4> component_min(const vec<float, 4>& a, const vec<float, 4>& b);
+		friend vec<float, 4> component_max(const vec<float, 4>& a, const vec<float, 4>& b);
+	};
+
+	template <int D>
+	vec<float, 3> vec_sse<D>::xyz() const {
+		return vec<float, 3>(_mm_and_ps(_m, vec_sse<3>::lane_mask()));
+	}
+
+	inline vec3f component_min(const vec3f& a, const vec3f& b) { return vec3f(_mm_min_ps(a.simd(), b.simd())); }
+	inline vec3f component_max(const vec3f& a, const vec3f& b) { return vec3f(_mm_max_ps(a.simd(), b.simd())); }
+	inline vec4f component_min(const vec4f& a, const vec4f& b) { return vec4f(_mm_min_ps(a.simd(), b.simd())); }
+	inline vec4f component_max(const vec4f& a, const vec4f& b) { return vec4f(_mm_max_ps(a.simd(), b.simd())); }
+#endif
+}
 }
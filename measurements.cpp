@@ -1,54 +1,212 @@
 ﻿#include "measurements.h"
-#include <chrono>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
 
 namespace raytracer {
 
-	timer::timer() : _startTime(std::chrono::system_clock::now()), _endTime(std::chrono::system_clock::now()), _running(true) { }
+	timer::timer() : _startTime(now_ns()), _endTime(_startTime), _running(true) { }
 
 	timer::~timer() { }
 
 	void timer::start() {
 		if (_running) return;
 
-		_startTime = std::chrono::system_clock::now();
+		_startTime = now_ns();
 		_running = true;
 	}
 
 	void timer::stop() {
 		if (!_running) return;
 
-		_endTime = std::chrono::system_clock::now();
+		_endTime = now_ns();
 		_running = false;
 	}
 
 	void timer::reset() {
-		_startTime = std::chrono::system_clock::now();
-		_endTime = std::chrono::system_clock::now();
+		_startTime = now_ns();
+		_endTime = _startTime;
 		_running = false;
 	}
 
-	int timer::get_elapsed_ms() const {
-		const std::chrono::time_point<std::chrono::system_clock> now =
-			_running ? std::chrono::system_clock::now() : _endTime;
+	long long timer::get_elapsed_ns() const {
+		return (_running ? now_ns() : _endTime) - _startTime;
+	}
+
+	double timer::get_elapsed_ms() const {
+		return get_elapsed_ns() * 1e-6;
+	}
+
 
-		return (int) std::chrono::duration_cast<std::chrono::milliseconds>(now - _startTime).count();
+	namespace {
+		std::atomic<bool> _profilerEnabled(false);
+
+		constexpr unsigned PROFILE_BUFFER_SIZE = 1 << 16; //events per thread between two profiler_end_frame calls
+
+		//single producer (the owning thread), single consumer (profiler_end_frame) ring.
+		//events that do not fit are counted and dropped instead of blocking the worker
+		struct profile_buffer {
+			profile_event events[PROFILE_BUFFER_SIZE];
+			std::atomic<unsigned> head { 0 };
+			std::atomic<unsigned> tail { 0 };
+			std::atomic<unsigned> dropped { 0 };
+			int thread = 0;
+		};
+
+		//buffers live until exit so a thread that ends never leaves a dangling ring behind
+		std::mutex _buffersMutex;
+		std::vector<std::unique_ptr<profile_buffer>> _buffers;
+
+		std::vector<profile_event> _frameEvents;
+		std::vector<profile_stats> _frameStats;
+		std::vector<profile_event> _capture;
+		bool _capturing = false;
+		unsigned _dropped = 0;
+		const long long _epoch = now_ns();
+
+		thread_local profile_buffer* _threadBuffer = nullptr;
+		thread_local int _depth = 0;
+
+		profile_buffer& thread_buffer() {
+			if (_threadBuffer) return *_threadBuffer;
+
+			std::lock_guard<std::mutex> lock(_buffersMutex);
+			_buffers.emplace_back(new profile_buffer());
+			_threadBuffer = _buffers.back().get();
+			_threadBuffer->thread = (int) _buffers.size() - 1;
+			return *_threadBuffer;
+		}
+
+		void drain_buffers(std::vector<profile_event>& events) {
+			std::lock_guard<std::mutex> lock(_buffersMutex);
+			for (const std::unique_ptr<profile_buffer>& b : _buffers) {
+				const unsigned tail = b->tail.load(std::memory_order_relaxed);
+				const unsigned head = b->head.load(std::memory_order_acquire);
+				for (unsigned i = tail; i != head; ++i) events.push_back(b->events[i % PROFILE_BUFFER_SIZE]);
+				b->tail.store(head, std::memory_order_release);
+				_dropped += b->dropped.exchange(0, std::memory_order_relaxed);
+			}
+		}
+
+		double duration_ms(const profile_event& e) {
+			return (e.end - e.start) * 1e-6;
+		}
+
+		//groups the events by name (string literals of different translation units may not share an address)
+		//and sorts each group by duration, which gives min and p99 by index
+		void aggregate(std::vector<profile_event>& events, std::vector<profile_stats>& stats) {
+			stats.clear();
+			std::sort(events.begin(), events.end(), [](const profile_event& a, const profile_event& b) {
+				const int order = strcmp(a.name, b.name);
+				return order != 0 ? order < 0 : a.end - a.start < b.end - b.start;
+			});
+
+			for (size_t first = 0; first < events.size();) {
+				size_t last = first + 1;
+				while (last < events.size() && strcmp(events[first].name, events[last].name) == 0) ++last;
+
+				const int calls = (int) (last - first);
+				double total = 0.0;
+				for (size_t i = first; i < last; ++i) total += duration_ms(events[i]);
+
+				profile_stats s;
+				s.name = events[first].name;
+				s.calls = calls;
+				s.totalMs = total;
+				s.minMs = duration_ms(events[first]);
+				s.avgMs = total / calls;
+				s.p99Ms = duration_ms(events[first + (calls * 99 + 99) / 100 - 1]);
+				stats.push_back(s);
+				first = last;
+			}
+
+			std::sort(stats.begin(), stats.end(), [](const profile_stats& a, const profile_stats& b) { return a.totalMs > b.totalMs; });
+		}
+
+		void write_json_string(FILE* file, const char* s) {
+			fputc('"', file);
+			for (; *s; ++s) {
+				if (*s == '"' || *s == '\\') fputc('\\', file);
+				fputc(*s, file);
+			}
+			fputc('"', file);
+		}
 	}
 
 
-	scoped_timer::scoped_timer( const std::function<void(int)>& closeFunc ) :
-		_startTime(std::chrono::system_clock::now()), _onClose( closeFunc ) { }
+	void profiler_set_enabled(const bool enabled) {
+		_profilerEnabled.store(enabled, std::memory_order_relaxed);
+	}
+
+	void profiler_set_capture(const bool capture) {
+		_capturing = capture;
+	}
+
+	void profiler_end_frame() {
+		_frameEvents.clear();
+		drain_buffers(_frameEvents);
+		if (_capturing) _capture.insert(_capture.end(), _frameEvents.begin(), _frameEvents.end());
+		aggregate(_frameEvents, _frameStats);
+	}
 
-	scoped_timer::~scoped_timer() {
-		const std::chrono::time_point<std::chrono::system_clock> now = std::chrono::system_clock::now();
-		_onClose((int)std::chrono::duration_cast<std::chrono::milliseconds>(now - _startTime).count());
+	const std::vector<profile_stats>& profiler_frame_stats() {
+		return _frameStats;
 	}
 
+	void profiler_print_frame() {
+		printf("%-20s %8s %10s %10s %10s %10s\n", "scope", "calls", "total ms", "min ms", "avg ms", "p99 ms");
+		for (const profile_stats& s : _frameStats) {
+			printf("%-20s %8d %10.3f %10.4f %10.4f %10.4f\n", s.name, s.calls, s.totalMs, s.minMs, s.avgMs, s.p99Ms);
+		}
+		if (_dropped > 0) printf("%u events dropped, profiler_end_frame is called too rarely\n", _dropped);
+	}
+
+	bool profiler_write_chrome_trace(const char* path) {
+		FILE* file = fopen(path, "wb");
+		if (!file) return false;
+
+		//complete events ("ph":"X") with microsecond timestamps, nesting is recovered by the viewer from the times
+		fprintf(file, "{\"traceEvents\":[\n");
+		for (size_t i = 0; i < _capture.size(); ++i) {
+			const profile_event& e = _capture[i];
+			fprintf(file, "{\"name\":");
+			write_json_string(file, e.name);
+			fprintf(file, ",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+				e.thread, (e.start - _epoch) * 1e-3, (e.end - e.start) * 1e-3, i + 1 < _capture.size() ? "," : "");
+		}
+		fprintf(file, "],\"displayTimeUnit\":\"ns\"}\n");
+
+		const bool ok = ferror(file) == 0;
+		fclose(file);
+		return ok;
+	}
+
+
+	profile_scope::profile_scope(const char* name) : _name(name), _start(0) {
+		if (!_profilerEnabled.load(std::memory_order_relaxed)) return;
+
+		++_depth;
+		_start = now_ns();
+	}
+
+	profile_scope::~profile_scope() {
+		if (_start == 0) return;
+
+		const long long end = now_ns();
+		--_depth;
 
-	int lamda_timer(const std::function<void()>& lambda) {
-		const std::chrono::time_point<std::chrono::system_clock> start = std::chrono::system_clock::now();
-		lambda();
-		const std::chrono::time_point<std::chrono::system_clock> end = std::chrono::system_clock::now();
+		profile_buffer& b = thread_buffer();
+		const unsigned head = b.head.load(std::memory_order_relaxed);
+		if (head - b.tail.load(std::memory_order_acquire) >= PROFILE_BUFFER_SIZE) {
+			b.dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
 
-		return (int)std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		b.events[head % PROFILE_BUFFER_SIZE] = { _name, _start, end, _depth, b.thread };
+		b.head.store(head + 1, std::memory_order_release);
 	}
 }
@@ -1,12 +1,17 @@
 #pragma once
 #include <chrono>
-#include <functional>
+#include <vector>
 
 namespace raytracer {
+	//nanoseconds on the steady clock, the time base for everything in here
+	inline long long now_ns() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
 	struct timer {
 		private:
-		std::chrono::time_point<std::chrono::system_clock> _startTime;
-		std::chrono::time_point<std::chrono::system_clock> _endTime;
+		long long _startTime;
+		long long _endTime;
 		bool _running;
 
 		public:
@@ -16,18 +21,76 @@ namespace raytracer {
 		void reset();
 		void start();
 		void stop();
-		int get_elapsed_ms() const;
+		long long get_elapsed_ns() const;
+		double get_elapsed_ms() const;
 	};
 
+	//calls closeFunc with the elapsed milliseconds when it goes out of scope
+	template <typename Func>
 	struct scoped_timer {
 		private:
-		std::chrono::time_point<std::chrono::system_clock> _startTime;
-		std::function<void(int)> _onClose;
+		long long _startTime;
+		Func _onClose;
+
+		public:
+		explicit scoped_timer(const Func& closeFunc) : _startTime(now_ns()), _onClose(closeFunc) { }
+		~scoped_timer() { _onClose((now_ns() - _startTime) * 1e-6); }
+	};
+
+	//runs the lambda and returns how long it took in milliseconds
+	template <typename Func>
+	double lamda_timer(const Func& lambda) {
+		const long long start = now_ns();
+		lambda();
+		return (now_ns() - start) * 1e-6;
+	}
+
+
+	//hierarchical profiler. scopes are recorded into a lock-free ring buffer owned by the recording thread,
+	//profiler_end_frame() drains all of them, aggregates the frame and optionally keeps the events for a
+	//chrome trace (chrome://tracing or ui.perfetto.dev). disabled scopes only cost a relaxed load
+	struct profile_event {
+		const char* name;
+		long long start;
+		long long end;
+		int depth;
+		int thread;
+	};
+
+	struct profile_stats {
+		const char* name;
+		int calls;
+		double totalMs;
+		double minMs;
+		double avgMs;
+		double p99Ms;
+	};
+
+	void profiler_set_enabled(const bool enabled);
+
+	//keeps every drained event in memory until the trace is written
+	void profiler_set_capture(const bool capture);
+
+	//collects the scopes recorded since the last call, safe to call while other threads keep recording
+	void profiler_end_frame();
+
+	//per scope name statistics of the last frame passed to profiler_end_frame()
+	const std::vector<profile_stats>& profiler_frame_stats();
+	void profiler_print_frame();
+
+	bool profiler_write_chrome_trace(const char* path);
+
+	struct profile_scope {
+		private:
+		const char* _name;
+		long long _start;
 
 		public:
-		explicit scoped_timer(const std::function<void(int)>& closeFunc);
-		~scoped_timer();
+		explicit profile_scope(const char* name);
+		~profile_scope();
 	};
 
-	int lamda_timer(const std::function<void()>& lambda);
+#define RAYTRACER_PROFILE_CONCAT_(a, b) a##b
+#define RAYTRACER_PROFILE_CONCAT(a, b) RAYTRACER_PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) raytracer::profile_scope RAYTRACER_PROFILE_CONCAT(_profileScope, __LINE__)(name)
 }
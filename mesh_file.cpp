@@ -0,0 +1,203 @@
+﻿#include "mesh_file.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace raytracer {
+
+	namespace {
+		bool valid_header(const mesh_file_header& header, const size_t fileSize) {
+			if (memcmp(header.magic, "RTMS", 4) != 0) return false;
+
+			const uint64_t bytes = fileSize - sizeof(mesh_file_header);
+			if (header.version == 1) return header.triangles <= bytes / (9 * sizeof(float));
+			if (header.version != MESH_FILE_VERSION || header.vertices > bytes / (3 * sizeof(float))) return false;
+			return header.triangles <= (bytes - header.vertices * 3 * sizeof(float)) / (3 * sizeof(unsigned));
+		}
+
+		//an index past the last vertex would send the bvh build and traversal outside the mapping
+		bool valid_indices(const unsigned* indices, const size_t count, const uint64_t vertices) {
+			unsigned largest = 0;
+			for (size_t i = 0; i < count; ++i) largest = indices[i] > largest ? indices[i] : largest;
+			return count == 0 || largest < vertices;
+		}
+	}
+
+
+#ifdef _WIN32
+	mapped_file::mapped_file() : _data(nullptr), _size(0), _file(INVALID_HANDLE_VALUE), _mapping(nullptr) { }
+#else
+	mapped_file::mapped_file() : _data(nullptr), _size(0), _file(-1) { }
+#endif
+
+	mapped_file::~mapped_file() {
+		close();
+	}
+
+	bool mapped_file::open(const char* path) {
+		close();
+
+#ifdef _WIN32
+		_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		LARGE_INTEGER fileSize;
+		if (_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(_file, &fileSize)) {
+			close();
+			return false;
+		}
+
+		_size = (size_t) fileSize.QuadPart;
+		_mapping = _size > 0 ? CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+		_data = _mapping ? (const uint8_t*) MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+#else
+		_file = ::open(path, O_RDONLY);
+		struct stat info;
+		if (_file < 0 || fstat(_file, &info) != 0) {
+			close();
+			return false;
+		}
+
+		_size = (size_t) info.st_size;
+		if (_size > 0) {
+			void* data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _file, 0);
+			_data = data != MAP_FAILED ? (const uint8_t*) data : nullptr;
+		}
+#endif
+
+		if (!_data) {
+			close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void mapped_file::close() {
+#ifdef _WIN32
+		if (_data) UnmapViewOfFile(_data);
+		if (_mapping) CloseHandle(_mapping);
+		if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+		_mapping = nullptr;
+		_file = INVALID_HANDLE_VALUE;
+#else
+		if (_data) munmap((void*) _data, _size);
+		if (_file >= 0) ::close(_file);
+		_file = -1;
+#endif
+		_data = nullptr;
+		_size = 0;
+	}
+
+
+	bool mesh_file::open(const char* path) {
+		if (!_file.open(path)) return false;
+
+		const mesh_file_header* header = (const mesh_file_header*) _file.data();
+		if (_file.size() < sizeof(mesh_file_header) || !valid_header(*header, _file.size())) {
+			_file.close();
+			return false;
+		}
+
+		if (header->version != 1 && !valid_indices(indices(), (size_t) (3 * header->triangles), header->vertices)) {
+			_file.close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void mesh_file::close() {
+		_file.close();
+	}
+
+	const float* mesh_file::vertices() const {
+		return _file.data() ? (const float*) (_file.data() + sizeof(mesh_file_header)) : nullptr;
+	}
+
+	const unsigned* mesh_file::indices() const {
+		const mesh_file_header* header = (const mesh_file_header*) _file.data();
+		if (!header || header->version == 1) return nullptr;
+		return (const unsigned*) (vertices() + 3 * header->vertices);
+	}
+
+	size_t mesh_file::vertex_count() const {
+		const mesh_file_header* header = (const mesh_file_header*) _file.data();
+		if (!header) return 0;
+		return (size_t) (header->version == 1 ? 3 * header->triangles : header->vertices);
+	}
+
+	size_t mesh_file::triangle_count() const {
+		return _file.data() ? (size_t) ((const mesh_file_header*) _file.data())->triangles : 0;
+	}
+
+
+	mesh_file_writer::mesh_file_writer() : _file(nullptr), _vertices(0), _indices(0), _failed(false) { }
+
+	mesh_file_writer::~mesh_file_writer() {
+		if (_file) fclose(_file);
+	}
+
+	bool mesh_file_writer::open(const char* path) {
+		if (_file) fclose(_file);
+
+		_file = fopen(path, "wb");
+		_vertices = 0;
+		_indices = 0;
+		_failed = !_file;
+		if (_failed) return false;
+
+		const mesh_file_header header = {};
+		_failed = fwrite(&header, sizeof(header), 1, _file) != 1;
+		return !_failed;
+	}
+
+	void mesh_file_writer::append_vertices(const float* vertices, const size_t count) {
+		if (!_file || count == 0) return;
+
+		//the indices start right after the last vertex
+		if (_indices > 0) _failed = true;
+		_vertices += count;
+		if (fwrite(vertices, 3 * sizeof(float), count, _file) != count) _failed = true;
+	}
+
+	void mesh_file_writer::append_indices(const unsigned* indices, const size_t count) {
+		if (!_file || count == 0) return;
+
+		_indices += count;
+		if (fwrite(indices, sizeof(unsigned), count, _file) != count) _failed = true;
+	}
+
+	bool mesh_file_writer::finish() {
+		if (!_file) return false;
+
+		mesh_file_header header = {};
+		memcpy(header.magic, "RTMS", 4);
+		header.version = MESH_FILE_VERSION;
+		header.triangles = _indices / 3;
+		header.vertices = _vertices;
+		if (_indices % 3 != 0) _failed = true;
+		if (fseek(_file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, _file) != 1) _failed = true;
+		if (fclose(_file) != 0) _failed = true;
+		_file = nullptr;
+
+		return !_failed;
+	}
+
+	bool write_mesh_file(const char* path, const float* vertices, const size_t vertexCount, const unsigned* indices, const size_t indexCount) {
+		mesh_file_writer writer;
+		if (!writer.open(path)) return false;
+
+		writer.append_vertices(vertices, vertexCount);
+		writer.append_indices(indices, indexCount);
+		return writer.finish();
+	}
+}
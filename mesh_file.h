@@ -0,0 +1,92 @@
+﻿#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+namespace raytracer {
+	//binary indexed mesh: a 32 byte header, 3 little endian floats per vertex and then 3 32 bit indices per
+	//triangle. the data is laid out exactly as add_indexed_mesh_view expects it, so a mapped file is used as scene
+	//storage in place. version 1 files hold 9 floats of triangle soup per triangle instead and are still read
+	struct mesh_file_header {
+		char magic[4]; //"RTMS"
+		uint32_t version;
+		uint64_t triangles;
+		uint64_t vertices; //0 in version 1
+		uint8_t reserved[8];
+	};
+
+	static_assert(sizeof(mesh_file_header) == 32, "the vertex data has to stay 16 byte aligned");
+
+	constexpr uint32_t MESH_FILE_VERSION = 2;
+
+	//read only memory mapping of a whole file, pages are loaded by the os on first access
+	struct mapped_file {
+		private:
+		const uint8_t* _data;
+		size_t _size;
+#ifdef _WIN32
+		void* _file;
+		void* _mapping;
+#else
+		int _file;
+#endif
+
+		public:
+		mapped_file();
+		~mapped_file();
+
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+
+		//returns false if the file does not exist, is empty or can not be mapped
+		bool open(const char* path);
+		void close();
+
+		const uint8_t* data() const { return _data; }
+		size_t size() const { return _size; }
+	};
+
+	//mapped mesh file, vertices() and indices() can be passed straight to add_indexed_mesh_view,
+	//or vertices() alone to add_mesh_view for version 1 files
+	struct mesh_file {
+		private:
+		mapped_file _file;
+
+		public:
+		//returns false if the file can not be mapped or is not a valid mesh file, which includes indices of
+		//vertices the file does not have. checking them reads the whole index array once
+		bool open(const char* path);
+		void close();
+
+		const float* vertices() const;
+		const unsigned* indices() const; //nullptr for triangle soup
+		size_t vertex_count() const; //3 per triangle for triangle soup
+		size_t triangle_count() const;
+	};
+
+	//writes the header, the vertices and then the indices, both may be appended in several parts but all
+	//vertices have to come first. the counts are patched into the header by finish()
+	struct mesh_file_writer {
+		private:
+		FILE* _file;
+		uint64_t _vertices;
+		uint64_t _indices;
+		bool _failed;
+
+		public:
+		mesh_file_writer();
+		~mesh_file_writer();
+
+		mesh_file_writer(const mesh_file_writer&) = delete;
+		mesh_file_writer& operator=(const mesh_file_writer&) = delete;
+
+		bool open(const char* path);
+		void append_vertices(const float* vertices, const size_t count);
+		void append_indices(const unsigned* indices, const size_t count);
+
+		//returns false if any write failed
+		bool finish();
+	};
+
+	bool write_mesh_file(const char* path, const float* vertices, const size_t vertexCount, const unsigned* indices, const size_t indexCount);
+}
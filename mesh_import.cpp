@@ -0,0 +1,465 @@
+﻿#include "mesh_import.h"
+#include "mesh_file.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace raytracer {
+
+	namespace {
+		constexpr size_t IMPORT_CHUNK_SIZE = 4 << 20; //bytes of obj text per parse task
+		constexpr size_t IMPORT_CHUNK_TRIANGLES = 1 << 20; //triangles per chunk of ply faces
+
+		//positions and triangle corners of a part of the input. corners are stored as 2 * index for indices into
+		//the whole file and 2 * index + 1 for indices relative to the first vertex of the chunk, which is only
+		//known once all chunks are parsed (obj allows negative indices counting back from the last vertex)
+		struct import_chunk {
+			std::vector<float> positions;
+			std::vector<long long> corners;
+			long long firstVertex = 0;
+			bool failed = false;
+		};
+
+		uint32_t vertex_bits(const float value) {
+			uint32_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			return bits == 0x80000000u ? 0u : bits; //-0 welds with 0
+		}
+
+		uint64_t hash_vertex(const uint32_t* bits) {
+			uint64_t h = bits[0] * 0x9E3779B185EBCA87ull;
+			h = (h ^ h >> 29 ^ bits[1]) * 0xC2B2AE3D27D4EB4Full;
+			h = (h ^ h >> 29 ^ bits[2]) * 0x9E3779B185EBCA87ull;
+			return h ^ h >> 32;
+		}
+
+		bool is_blank(const char c) {
+			return c == ' ' || c == '\t' || c == '\r';
+		}
+
+		bool is_digit(const char c) {
+			return c >= '0' && c <= '9';
+		}
+
+		const char* skip_blank(const char* p, const char* end) {
+			while (p < end && is_blank(*p)) ++p;
+			return p;
+		}
+
+		const char* next_line(const char* p, const char* end) {
+			const char* newline = (const char*) memchr(p, '\n', end - p);
+			return newline ? newline + 1 : end;
+		}
+
+		//decimal number without locale or a terminating zero, the input is a mapping and may end anywhere
+		bool parse_number(const char*& p, const char* end, double& result) {
+			static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16 };
+
+			p = skip_blank(p, end);
+			bool negative = false;
+			if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+			double mantissa = 0.0;
+			int exponent = 0;
+			bool digits = false;
+			for (; p < end && is_digit(*p); ++p, digits = true) mantissa = mantissa * 10.0 + (*p - '0');
+			if (p < end && *p == '.') {
+				for (++p; p < end && is_digit(*p); ++p, digits = true) {
+					mantissa = mantissa * 10.0 + (*p - '0');
+					--exponent;
+				}
+			}
+			if (!digits) return false;
+
+			if (p < end && (*p == 'e' || *p == 'E')) {
+				++p;
+				bool negativeExponent = false;
+				if (p < end && (*p == '-' || *p == '+')) negativeExponent = *p++ == '-';
+
+				int e = 0;
+				for (; p < end && is_digit(*p); ++p) e = std::min(e * 10 + (*p - '0'), 1000);
+				exponent += negativeExponent ? -e : e;
+			}
+
+			const int magnitude = exponent < 0 ? -exponent : exponent;
+			const double scale = magnitude <= 16 ? powers[magnitude] : std::pow(10.0, magnitude);
+			result = (exponent < 0 ? mantissa / scale : mantissa * scale) * (negative ? -1.0 : 1.0);
+			return true;
+		}
+
+		bool parse_integer(const char*& p, const char* end, long long& result) {
+			p = skip_blank(p, end);
+			bool negative = false;
+			if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+			if (p >= end || !is_digit(*p)) return false;
+
+			result = 0;
+			for (; p < end && is_digit(*p); ++p) result = result * 10 + (*p - '0');
+			if (negative) result = -result;
+			return true;
+		}
+
+		//first byte of the line that contains offset, or offset itself if a line starts there
+		size_t line_start(const char* text, const size_t size, size_t offset) {
+			while (offset > 0 && offset < size && text[offset - 1] != '\n') ++offset;
+			return std::min(offset, size);
+		}
+
+		void parse_obj_chunk(const char* p, const char* end, import_chunk& chunk) {
+			long long localVertices = 0;
+			long long polygon[3];
+
+			for (; p < end; p = next_line(p, end)) {
+				p = skip_blank(p, end);
+				if (end - p < 2 || !is_blank(p[1])) continue;
+
+				if (p[0] == 'v') {
+					++p;
+					double x, y, z;
+					if (!parse_number(p, end, x) || !parse_number(p, end, y) || !parse_number(p, end, z)) {
+						chunk.failed = true;
+						return;
+					}
+
+					chunk.positions.push_back((float) x);
+					chunk.positions.push_back((float) y);
+					chunk.positions.push_back((float) z);
+					++localVertices;
+				} else if (p[0] == 'f') {
+					++p;
+					int corners = 0;
+					long long index;
+					while (parse_integer(p, end, index)) {
+						//skip texture and normal indices
+						while (p < end && !is_blank(*p) && *p != '\n') ++p;
+
+						if (index == 0) {
+							chunk.failed = true;
+							return;
+						}
+
+						const long long corner = index > 0 ? 2 * (index - 1) : 2 * (localVertices + index) + 1;
+						if (corners < 2) polygon[corners] = corner;
+						else {
+							polygon[2] = corner;
+							chunk.corners.insert(chunk.corners.end(), polygon, polygon + 3);
+							polygon[1] = corner;
+						}
+						++corners;
+					}
+				}
+			}
+		}
+
+		//resolves the corners of every chunk to indices of the welded vertices and appends them to the writer.
+		//chunks are processed in batches of one per worker and released once written
+		bool write_indices(std::vector<import_chunk>& chunks, const std::vector<unsigned>& remap, mesh_file_writer& writer) {
+			thread_pool& pool = default_pool();
+			const long long vertexCount = (long long) remap.size();
+
+			std::atomic<bool> failed(false);
+			std::vector<std::vector<unsigned>> batches(pool.size());
+			for (size_t first = 0; first < chunks.size(); first += batches.size()) {
+				const int count = (int) std::min(batches.size(), chunks.size() - first);
+				pool.run(count, [&](const int task, const int) {
+					const import_chunk& c = chunks[first + task];
+					std::vector<unsigned>& indices = batches[task];
+					indices.resize(c.corners.size());
+
+					for (size_t i = 0; i < c.corners.size(); ++i) {
+						const long long corner = c.corners[i];
+						const long long index = (corner & 1) ? c.firstVertex + (corner - 1) / 2 : corner / 2;
+						if (index < 0 || index >= vertexCount) {
+							failed = true;
+							return;
+						}
+
+						indices[i] = remap[(size_t) index];
+					}
+				});
+
+				for (int i = 0; i < count; ++i) {
+					writer.append_indices(batches[i].data(), batches[i].size());
+					std::vector<long long>().swap(chunks[first + i].corners);
+				}
+			}
+
+			return !failed;
+		}
+
+		//welds the positions of all chunks and writes them out followed by the triangles
+		bool write_chunks(std::vector<import_chunk>& chunks, const char* output) {
+			long long vertexCount = 0;
+			for (import_chunk& c : chunks) {
+				if (c.failed) return false;
+
+				c.firstVertex = vertexCount;
+				vertexCount += (long long) c.positions.size() / 3;
+			}
+			if (vertexCount >= UINT_MAX) return false;
+
+			std::vector<float> positions((size_t) vertexCount * 3);
+			default_pool().run((int) chunks.size(), [&](const int task, const int) {
+				import_chunk& c = chunks[task];
+				std::copy(c.positions.begin(), c.positions.end(), positions.begin() + 3 * c.firstVertex);
+				std::vector<float>().swap(c.positions);
+			});
+
+			std::vector<float> unique;
+			std::vector<unsigned> remap;
+			weld_vertices(positions.data(), (size_t) vertexCount, unique, remap);
+			std::vector<float>().swap(positions);
+
+			mesh_file_writer writer;
+			if (!writer.open(output)) return false;
+
+			writer.append_vertices(unique.data(), unique.size() / 3);
+			std::vector<float>().swap(unique);
+			const bool resolved = write_indices(chunks, remap, writer);
+			return writer.finish() && resolved;
+		}
+
+		bool import_obj(const mapped_file& input, const char* output) {
+			const char* text = (const char*) input.data();
+			const size_t size = input.size();
+			const int chunkCount = (int) ((size + IMPORT_CHUNK_SIZE - 1) / IMPORT_CHUNK_SIZE);
+
+			std::vector<import_chunk> chunks(chunkCount);
+			default_pool().run(chunkCount, [&](const int task, const int) {
+				const size_t begin = line_start(text, size, task * IMPORT_CHUNK_SIZE);
+				const size_t end = line_start(text, size, (task + 1) * IMPORT_CHUNK_SIZE);
+				if (begin < end) parse_obj_chunk(text + begin, text + end, chunks[task]);
+			});
+
+			return write_chunks(chunks, output);
+		}
+
+
+		enum ply_type { PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64, PLY_INVALID };
+
+		struct ply_property {
+			std::string name;
+			ply_type type;
+			ply_type countType; //PLY_INVALID unless the property is a list
+		};
+
+		struct ply_element {
+			std::string name;
+			size_t count;
+			std::vector<ply_property> properties;
+		};
+
+		ply_type parse_ply_type(const std::string& name) {
+			static const char* names[][2] = {
+				{ "char", "int8" }, { "uchar", "uint8" }, { "short", "int16" }, { "ushort", "uint16" },
+				{ "int", "int32" }, { "uint", "uint32" }, { "float", "float32" }, { "double", "float64" }
+			};
+
+			for (int i = 0; i < PLY_INVALID; ++i) {
+				if (name == names[i][0] || name == names[i][1]) return (ply_type) i;
+			}
+			return PLY_INVALID;
+		}
+
+		//bytes of one value in binary files
+		int ply_type_size(const ply_type type) {
+			static const int sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+			return sizes[type];
+		}
+
+		//fewest bytes an item of the element takes in the body, one per value in ascii. lists may be empty
+		size_t ply_min_item_size(const ply_element& element, const bool binary) {
+			size_t size = 0;
+			for (const ply_property& property : element.properties) {
+				size += binary ? ply_type_size(property.countType == PLY_INVALID ? property.type : property.countType) : 1;
+			}
+			return size;
+		}
+
+		//reads one value from the body, binary is little endian
+		struct ply_reader {
+			const char* p;
+			const char* end;
+			bool binary;
+
+			bool read(const ply_type type, double& value) {
+				if (!binary) {
+					p = next_token();
+					return parse_number(p, end, value);
+				}
+
+				if (end - p < ply_type_size(type)) return false;
+
+				switch (type) {
+					case PLY_INT8: value = *(const int8_t*) p; break;
+					case PLY_UINT8: value = *(const uint8_t*) p; break;
+					case PLY_INT16: { int16_t v; memcpy(&v, p, 2); value = v; break; }
+					case PLY_UINT16: { uint16_t v; memcpy(&v, p, 2); value = v; break; }
+					case PLY_INT32: { int32_t v; memcpy(&v, p, 4); value = v; break; }
+					case PLY_UINT32: { uint32_t v; memcpy(&v, p, 4); value = v; break; }
+					case PLY_FLOAT32: { float v; memcpy(&v, p, 4); value = v; break; }
+					default: memcpy(&value, p, 8); break;
+				}
+
+				p += ply_type_size(type);
+				return true;
+			}
+
+			const char* next_token() const {
+				const char* q = p;
+				while (q < end && (is_blank(*q) || *q == '\n')) ++q;
+				return q;
+			}
+		};
+
+		bool import_ply(const mapped_file& input, const char* output) {
+			const char* p = (const char*) input.data();
+			const char* end = p + input.size();
+
+			bool binary = false;
+			std::vector<ply_element> elements;
+			for (bool header = true; header;) {
+				if (p >= end) return false;
+
+				const char* lineEnd = next_line(p, end);
+				std::string line(p, lineEnd);
+				p = lineEnd;
+				while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) line.pop_back();
+
+				std::vector<std::string> words;
+				for (size_t i = 0; i < line.size();) {
+					const size_t next = std::min(line.find(' ', i), line.size());
+					if (next > i) words.push_back(line.substr(i, next - i));
+					i = next + 1;
+				}
+				if (words.empty()) continue;
+
+				if (words[0] == "end_header") header = false;
+				else if (words[0] == "format" && words.size() >= 2) {
+					if (words[1] == "binary_little_endian") binary = true;
+					else if (words[1] != "ascii") return false;
+				} else if (words[0] == "element" && words.size() >= 3) {
+					elements.push_back({ words[1], (size_t) strtoull(words[2].c_str(), nullptr, 10), {} });
+				} else if (words[0] == "property" && !elements.empty()) {
+					ply_property property;
+					if (words.size() >= 5 && words[1] == "list") property = { words[4], parse_ply_type(words[3]), parse_ply_type(words[2]) };
+					else if (words.size() >= 3) property = { words[2], parse_ply_type(words[1]), PLY_INVALID };
+					else return false;
+
+					if (property.type == PLY_INVALID || (words[1] == "list" && property.countType == PLY_INVALID)) return false;
+					elements.back().properties.push_back(property);
+				}
+			}
+
+			ply_reader reader = { p, end, binary };
+
+			std::vector<import_chunk> chunks(1);
+			for (const ply_element& element : elements) {
+				const bool vertices = element.name == "vertex";
+				const bool faces = element.name == "face";
+
+				//a count the rest of the body cannot hold is corrupt, and reserving for it would run out of memory
+				const size_t itemSize = std::max(ply_min_item_size(element, reader.binary), (size_t) 1);
+				if (element.count > (size_t) (reader.end - reader.p) / itemSize) return false;
+				if (vertices) chunks[0].positions.reserve(3 * element.count);
+
+				for (size_t item = 0; item < element.count; ++item) {
+					float position[3] = {};
+					for (const ply_property& property : element.properties) {
+						double value;
+						if (property.countType == PLY_INVALID) {
+							if (!reader.read(property.type, value)) return false;
+							if (vertices && property.name.size() == 1 && property.name[0] >= 'x' && property.name[0] <= 'z') position[property.name[0] - 'x'] = (float) value;
+							continue;
+						}
+
+						double count;
+						if (!reader.read(property.countType, count)) return false;
+
+						const bool indices = faces && (property.name == "vertex_indices" || property.name == "vertex_index");
+						long long polygon[3];
+						for (int corner = 0; corner < (int) count; ++corner) {
+							if (!reader.read(property.type, value)) return false;
+							if (!indices) continue;
+
+							if (corner < 2) polygon[corner] = 2 * (long long) value;
+							else {
+								if (chunks.back().corners.size() >= 3 * IMPORT_CHUNK_TRIANGLES) chunks.emplace_back();
+
+								polygon[2] = 2 * (long long) value;
+								chunks.back().corners.insert(chunks.back().corners.end(), polygon, polygon + 3);
+								polygon[1] = polygon[2];
+							}
+						}
+					}
+
+					if (vertices) chunks[0].positions.insert(chunks[0].positions.end(), position, position + 3);
+				}
+			}
+
+			return write_chunks(chunks, output);
+		}
+
+		bool has_extension(const char* path, const char* extension) {
+			const size_t length = strlen(path);
+			const size_t extensionLength = strlen(extension);
+			if (length < extensionLength) return false;
+
+			for (size_t i = 0; i < extensionLength; ++i) {
+				const char c = path[length - extensionLength + i];
+				if ((c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c) != extension[i]) return false;
+			}
+			return true;
+		}
+	}
+
+
+	void weld_vertices(const float* vertices, const size_t vertexCount, std::vector<float>& unique, std::vector<unsigned>& remap) {
+		unique.clear();
+		remap.resize(vertexCount);
+
+		//open addressing over the indices of the unique vertices, at most half full
+		size_t capacity = 16;
+		while (capacity < 2 * vertexCount) capacity *= 2;
+		std::vector<unsigned> table(capacity, UINT_MAX);
+
+		for (size_t i = 0; i < vertexCount; ++i) {
+			const float* v = vertices + 3 * i;
+			const uint32_t bits[3] = { vertex_bits(v[0]), vertex_bits(v[1]), vertex_bits(v[2]) };
+
+			size_t slot = hash_vertex(bits) & (capacity - 1);
+			for (;; slot = (slot + 1) & (capacity - 1)) {
+				const unsigned candidate = table[slot];
+				if (candidate == UINT_MAX) {
+					table[slot] = (unsigned) (unique.size() / 3);
+					remap[i] = table[slot];
+					unique.insert(unique.end(), v, v + 3);
+					break;
+				}
+
+				const float* u = unique.data() + 3 * (size_t) candidate;
+				if (vertex_bits(u[0]) == bits[0] && vertex_bits(u[1]) == bits[1] && vertex_bits(u[2]) == bits[2]) {
+					remap[i] = candidate;
+					break;
+				}
+			}
+		}
+
+		unique.shrink_to_fit();
+	}
+
+	bool import_mesh(const char* path, const char* output) {
+		mapped_file input;
+		if (!input.open(path)) return false;
+
+		if (has_extension(path, ".ply")) return import_ply(input, output);
+		return import_obj(input, output);
+	}
+}
@@ -0,0 +1,16 @@
+﻿#pragma once
+#include <cstddef>
+#include <vector>
+
+namespace raytracer {
+	//converts a wavefront .obj or a .ply (ascii or binary little endian) file into a mesh file, see mesh_file.h.
+	//polygons are fan triangulated and everything but vertex positions is ignored. the input is memory mapped,
+	//obj text is parsed in parallel on the default thread pool, duplicate positions are welded and the indices are
+	//written out in batches, so the triangles are never held in memory as a whole. returns false on io or parse errors
+	bool import_mesh(const char* path, const char* output);
+
+	//merges bitwise equal vertices (and both zeros) keeping the order they first appear in. unique receives 3 floats
+	//per distinct vertex and remap the index into unique for every input vertex, so for triangle soup remap is the
+	//index buffer of the welded mesh. imports weld their vertices, and soup meshes can be converted the same way
+	void weld_vertices(const float* vertices, const size_t vertexCount, std::vector<float>& unique, std::vector<unsigned>& remap);
+}
@@ -0,0 +1,141 @@
+﻿#include "packet.h"
+#include "kernels.h"
+#include "measurements.h"
+#include "simd.h"
+
+namespace raytracer {
+
+	namespace {
+		//one triangle at a time against all rays, vectorized over the rays. the origin is shared, so the
+		//terms that only depend on origin and triangle are computed once per triangle
+		template <typename simd>
+		void intersect_block_rays(const triangle_block& block, ray_packet& p) {
+			for (int lane = 0; lane < TRIANGLE_BLOCK_WIDTH; ++lane) {
+				const int id = block.id[lane];
+				if (id < 0) break; //padding lanes are always at the end
+
+				const vec3f e1(block.e1x[lane], block.e1y[lane], block.e1z[lane]);
+				const vec3f e2(block.e2x[lane], block.e2y[lane], block.e2z[lane]);
+				const vec3f s = p.origin - vec3f(block.v0x[lane], block.v0y[lane], block.v0z[lane]);
+				const vec3f q = s.cross(e1);
+
+				const simd e1x(e1.x()), e1y(e1.y()), e1z(e1.z());
+				const simd e2x(e2.x()), e2y(e2.y()), e2z(e2.z());
+				const simd sx(s.x()), sy(s.y()), sz(s.z());
+				const simd qx(q.x()), qy(q.y()), qz(q.z());
+				const simd qe2(e2.dot(q));
+				const simd zero(0.0f), one(1.0f), eps(1e-12f);
+
+				for (int i = 0; i < PACKET_SIZE; i += simd::width) {
+					const simd dx = simd::load(p.dx + i), dy = simd::load(p.dy + i), dz = simd::load(p.dz + i);
+					const simd px = dy * e2z - dz * e2y;
+					const simd py = dz * e2x - dx * e2z;
+					const simd pz = dx * e2y - dy * e2x;
+					const simd det = e1x * px + e1y * py + e1z * pz;
+					const simd invDet = one / det;
+
+					const simd u = (sx * px + sy * py + sz * pz) * invDet;
+					const simd v = (dx * qx + dy * qy + dz * qz) * invDet;
+					const simd t = qe2 * invDet;
+					const simd tOld = simd::load(p.t + i);
+
+					const simd mask = (vabs(det) >= eps) & (u >= zero) & (v >= zero) & (u + v <= one) & (t > zero) & (t < tOld);
+					int bits = movemask(mask);
+					if (bits == 0) continue;
+
+					blend(tOld, t, mask).store(p.t + i);
+					blend(simd::load(p.u + i), u, mask).store(p.u + i);
+					blend(simd::load(p.v + i), v, mask).store(p.v + i);
+					for (; bits != 0; bits &= bits - 1) p.triangle[i + lowest_bit(bits)] = id;
+				}
+			}
+		}
+
+		//one ray at a time through the dispatched kernel, for packets too divergent to share a traversal
+		void trace_rays(const bvh8& tree, const std::vector<triangle_block>& blocks, ray_packet& p) {
+			const simd_kernels& kernel = kernels();
+			for (int i = 0; i < PACKET_SIZE; ++i) {
+				ray r;
+				r.origin = p.origin;
+				r.direction = vec3f(p.dx[i], p.dy[i], p.dz[i]);
+
+				hit h;
+				h.t = p.t[i];
+				if (!kernel.closest_hit(tree, blocks.data(), r, h)) continue;
+
+				p.t[i] = h.t;
+				p.u[i] = h.u;
+				p.v[i] = h.v;
+				p.triangle[i] = h.triangle;
+			}
+		}
+	}
+
+
+	bool init_interval(const ray_packet& p, packet_interval& interval) {
+		const float* dirs[3] = { p.dx, p.dy, p.dz };
+		for (int axis = 0; axis < 3; ++axis) {
+			float dMin = FLT_MAX, dMax = -FLT_MAX;
+			for (int i = 0; i < PACKET_SIZE; ++i) {
+				dMin = std::min(dMin, dirs[axis][i]);
+				dMax = std::max(dMax, dirs[axis][i]);
+			}
+
+			if (dMin <= 0.0f && dMax >= 0.0f) return false;
+
+			interval.origin[axis] = p.origin[axis];
+			interval.invMin[axis] = 1.0f / dMax;
+			interval.invMax[axis] = 1.0f / dMin;
+			if (interval.invMin[axis] > interval.invMax[axis]) std::swap(interval.invMin[axis], interval.invMax[axis]);
+		}
+
+		return true;
+	}
+
+	float max_distance(const ray_packet& p) {
+		simdf result(0.0f);
+		for (int i = 0; i < PACKET_SIZE; i += simdf::width) result = vmax(result, simdf::load(p.t + i));
+
+		alignas(32) float lanes[simdf::width];
+		result.store(lanes);
+		return *std::max_element(lanes, lanes + simdf::width);
+	}
+
+	void init_packet(ray_packet& p, const vec3f& origin, const vec3f& corner, const vec3f& dx, const vec3f& dy) {
+		p.origin = origin;
+
+		const simdf one(1.0f), tmax(FLT_MAX);
+		alignas(32) float column[simdf::width];
+		for (int x = 0; x < simdf::width; ++x) column[x] = (float) x;
+
+		for (int i = 0; i < PACKET_SIZE; i += simdf::width) {
+			const simdf fx = simdf::load(column) + simdf((float) (i % PACKET_WIDTH));
+			const simdf fy((float) (i / PACKET_WIDTH));
+			const simdf x = simdf(corner.x()) + fx * simdf(dx.x()) + fy * simdf(dy.x());
+			const simdf y = simdf(corner.y()) + fx * simdf(dx.y()) + fy * simdf(dy.y());
+			const simdf z = simdf(corner.z()) + fx * simdf(dx.z()) + fy * simdf(dy.z());
+			const simdf invLen = one / vsqrt(x * x + y * y + z * z);
+
+			(x * invLen).store(p.dx + i);
+			(y * invLen).store(p.dy + i);
+			(z * invLen).store(p.dz + i);
+			tmax.store(p.t + i);
+		}
+	}
+
+	void trace_packet(const bvh8& tree, const std::vector<triangle_block>& blocks, ray_packet& p) {
+		PROFILE_SCOPE("trace packet");
+		for (int i = 0; i < PACKET_SIZE; ++i) p.triangle[i] = -1;
+		if (tree.empty()) return;
+
+		packet_interval interval;
+		if (!init_interval(p, interval)) {
+			trace_rays(tree, blocks, p);
+			return;
+		}
+
+		traverse_packet(tree, interval, p, [&](const unsigned first, const unsigned count) {
+			for (unsigned b = first; b < first + count; ++b) intersect_block_rays<simdf>(blocks[b], p);
+		});
+	}
+}
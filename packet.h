@@ -0,0 +1,160 @@
+﻿#pragma once
+#include "bvh8.h"
+
+namespace raytracer {
+	constexpr int PACKET_WIDTH = 8; //packets cover 8x8 pixels
+	constexpr int PACKET_SIZE = PACKET_WIDTH * PACKET_WIDTH;
+
+	//coherent primary rays sharing one origin, directions and results stored as structure of arrays
+	struct alignas(32) ray_packet {
+		float dx[PACKET_SIZE];
+		float dy[PACKET_SIZE];
+		float dz[PACKET_SIZE];
+		float t[PACKET_SIZE]; //in: tmax per ray, out: closest hit distance
+		float u[PACKET_SIZE];
+		float v[PACKET_SIZE];
+		int triangle[PACKET_SIZE];
+		int instance[PACKET_SIZE]; //set by scene::trace, trace_packet leaves it alone
+		vec3f origin;
+	};
+
+	//bounds of the inverse directions over the whole packet, all of the same sign per axis
+	struct packet_interval {
+		float origin[3];
+		float invMin[3];
+		float invMax[3];
+	};
+
+	//returns false if the directions change sign along an axis, interval arithmetic does not hold then
+	bool init_interval(const ray_packet& packet, packet_interval& interval);
+
+	//lower bound of the entry distance of any ray in the packet, FLT_MAX if no ray can hit the node
+	inline float intersect_interval(const bvh_node& node, const packet_interval& p, const float tmax) {
+		float tmin = 0.0f;
+		float tfar = tmax;
+		for (int i = 0; i < 3; ++i) {
+			const float a = node.min[i] - p.origin[i];
+			const float b = node.max[i] - p.origin[i];
+			const bool positive = p.invMin[i] >= 0.0f;
+			const float entry = positive ? std::min(a * p.invMin[i], a * p.invMax[i]) : std::min(b * p.invMin[i], b * p.invMax[i]);
+			const float exit = positive ? std::max(b * p.invMin[i], b * p.invMax[i]) : std::max(a * p.invMin[i], a * p.invMax[i]);
+			tmin = std::max(tmin, entry);
+			tfar = std::min(tfar, exit);
+		}
+
+		return tmin <= tfar ? tmin : FLT_MAX;
+	}
+
+	//largest distance of any ray in the packet
+	float max_distance(const ray_packet& packet);
+
+	//front to back traversal of the packet as a whole, leaf(first, count) is called for every leaf the interval
+	//reaches and is expected to shorten packet.t. nodes are culled against the longest remaining ray
+	template <typename Leaf>
+	void traverse_packet(const bvh& tree, const packet_interval& interval, ray_packet& packet, Leaf&& leaf) {
+		float tmax = max_distance(packet);
+		unsigned stack[BVH_MAX_DEPTH];
+		int stackSize = 0;
+		unsigned current = 0;
+		if (intersect_interval(tree.nodes[0], interval, tmax) == FLT_MAX) return;
+
+		while (true) {
+			const bvh_node& node = tree.nodes[current];
+
+			if (node.is_leaf()) {
+				leaf(node.offset, node.count);
+				tmax = max_distance(packet);
+			} else {
+				unsigned first = current + 1;
+				unsigned second = node.offset;
+				float dFirst = intersect_interval(tree.nodes[first], interval, tmax);
+				float dSecond = intersect_interval(tree.nodes[second], interval, tmax);
+				if (dSecond < dFirst) {
+					std::swap(first, second);
+					std::swap(dFirst, dSecond);
+				}
+
+				if (dFirst != FLT_MAX) {
+					if (dSecond != FLT_MAX) stack[stackSize++] = second;
+					current = first;
+					continue;
+				}
+			}
+
+			bool found = false;
+			while (stackSize > 0) {
+				current = stack[--stackSize];
+				if (intersect_interval(tree.nodes[current], interval, tmax) != FLT_MAX) {
+					found = true;
+					break;
+				}
+			}
+
+			if (!found) return;
+		}
+	}
+
+	//interval test of the whole packet against all children of a wide node, returns the mask of the children
+	//any ray may enter before tmax together with lower bounds of their entry distances
+	template <typename simd>
+	int intersect_children(const bvh8_node& node, const packet_interval& p, const float tmax, float* distance) {
+		simd cell[3], base[3], invMin[3], invMax[3];
+		for (int axis = 0; axis < 3; ++axis) {
+			cell[axis] = simd(node.cell(axis));
+			base[axis] = simd(node.origin[axis] - p.origin[axis]);
+			invMin[axis] = simd(p.invMin[axis]);
+			invMax[axis] = simd(p.invMax[axis]);
+		}
+
+		int mask = 0;
+		for (int c = 0; c < BVH8_WIDTH; c += simd::width) {
+			simd tmin(0.0f), tfar(tmax);
+			for (int axis = 0; axis < 3; ++axis) {
+				const bool positive = p.invMin[axis] >= 0.0f;
+				const simd a = simd::load_bytes((positive ? node.lo : node.hi)[axis] + c) * cell[axis] + base[axis];
+				const simd b = simd::load_bytes((positive ? node.hi : node.lo)[axis] + c) * cell[axis] + base[axis];
+				tmin = vmax(tmin, vmin(a * invMin[axis], a * invMax[axis]));
+				tfar = vmin(tfar, vmax(b * invMin[axis], b * invMax[axis]));
+			}
+
+			tmin.store(distance + c);
+			mask |= movemask(tmin <= tfar) << c;
+		}
+
+		return mask & node.child_mask();
+	}
+
+	//traverse_packet for wide trees, leaf(first, count) is called for every leaf slot the interval reaches
+	template <typename Leaf>
+	void traverse_packet(const bvh8& tree, const packet_interval& interval, ray_packet& packet, Leaf&& leaf) {
+		float tmax = max_distance(packet);
+		bvh8_entry stack[BVH8_STACK_SIZE];
+		int stackSize = 0;
+		stack[stackSize++] = { 0, 0, 0.0f };
+
+		alignas(32) float distance[BVH8_WIDTH];
+		while (stackSize > 0) {
+			const bvh8_entry e = stack[--stackSize];
+			if (e.distance > tmax) continue;
+
+			if (e.count != 0) {
+				leaf(e.index, e.count);
+				tmax = max_distance(packet);
+				continue;
+			}
+
+			const bvh8_node& node = tree.nodes[e.index];
+			const int mask = intersect_children<simdf>(node, interval, tmax, distance);
+			push_children(node, mask, distance, stack, stackSize);
+		}
+	}
+
+	//sets up a packet of pinhole camera rays, the unnormalized direction of ray (x, y) within the
+	//packet is corner + x * dx + y * dy. distances are reset to FLT_MAX
+	void init_packet(ray_packet& packet, const vec3f& origin, const vec3f& corner, const vec3f& dx, const vec3f& dy);
+
+	//closest hit for all rays of the packet through a bvh whose leaves reference triangle blocks.
+	//the packet is culled against nodes as a whole using interval arithmetic on its directions, leaves are
+	//intersected 8 rays at a time. packets whose directions change sign along an axis are traced ray by ray
+	void trace_packet(const bvh8& tree, const std::vector<triangle_block>& blocks, ray_packet& packet);
+}
@@ -0,0 +1,355 @@
+﻿#include "path_tracer.h"
+#include "measurements.h"
+#include "radix_sort.h"
+#include "rasterizer.h"
+#include "ray_sort.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace raytracer {
+
+	namespace {
+		constexpr size_t WAVE_SIZE = 1 << 16; //paths in flight, the queues of a wave stay within the caches
+		constexpr size_t PATH_CHUNK = 1 << 10; //paths one pool task handles in every stage
+		constexpr int ROULETTE_BOUNCE = 2; //paths may end early from this bounce on
+		constexpr size_t SORT_MIN = 1 << 12; //fewer bounced rays are traced unsorted, they fit in the caches either way
+
+		//what the shade stage does in a bounce, the same for every path of it
+		enum shade_flags : unsigned {
+			SHADE_FEATURES = 1, //store the first hits for the denoiser
+			SHADE_CONTINUE = 2, //bounce, the paths did not reach maxBounces yet
+			SHADE_ROULETTE = 4, //paths may end early
+			SHADE_COMBINATIONS = 8 //sets of the flags above, one specialized shade stage each
+		};
+
+		//the shade stage that reads the flags at run time instead, no set of flags has this value
+		constexpr unsigned SHADE_GENERIC = ~0u;
+
+		constexpr float PI = 3.14159265f;
+		constexpr float ALBEDO = 0.6f;
+		const vec3f SUN_DIRECTION = vec3f(0.4f, 1.0f, 0.3f).normalized();
+		const vec3f SUN_IRRADIANCE(2.4f, 2.2f, 1.9f);
+
+		uint32_t hash(uint32_t x) {
+			x ^= x >> 16;
+			x *= 0x7FEB352Du;
+			x ^= x >> 15;
+			x *= 0x846CA68Bu;
+			x ^= x >> 16;
+			return x;
+		}
+
+		//xorshift, uniform in [0, 1)
+		float random_float(uint32_t& state) {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			return (state >> 8) * (1.0f / (1 << 24));
+		}
+
+		//cosine distributed direction around the unit normal n, the basis is the branchless one of duff et al.
+		vec3f sample_cosine(const vec3f& n, const float r1, const float r2) {
+			const float sign = std::copysign(1.0f, n.z());
+			const float a = -1.0f / (sign + n.z());
+			const float b = n.x() * n.y() * a;
+			const vec3f tangent(1.0f + sign * n.x() * n.x() * a, sign * b, -sign * n.x());
+			const vec3f bitangent(b, sign + n.y() * n.y() * a, -n.y());
+
+			const float phi = 2.0f * PI * r1;
+			const float radius = std::sqrt(r2);
+			return tangent * (radius * std::cos(phi)) + bitangent * (radius * std::sin(phi)) + n * std::sqrt(std::max(0.0f, 1.0f - r2));
+		}
+
+		template <typename F>
+		void for_each_chunk(const size_t count, thread_pool& pool, const F& fn) {
+			const int chunks = (int) ((count + PATH_CHUNK - 1) / PATH_CHUNK);
+			pool.run(chunks, [&](const int chunk, const int) {
+				const size_t first = (size_t) chunk * PATH_CHUNK;
+				fn(chunk, first, std::min(count, first + PATH_CHUNK));
+			});
+		}
+	}
+
+	vec3f sky_color(const vec3f& direction) {
+		const float s = 0.5f * (direction.y() + 1.0f);
+		return vec3f(1.0f, 1.0f, 1.0f) * (1.0f - s) + vec3f(0.5f, 0.7f, 1.0f) * s;
+	}
+
+
+	void path_tracer::path_queue::resize(const size_t size) {
+		for (std::vector<float>* v : { &ox, &oy, &oz, &dx, &dy, &dz, &r, &g, &b }) v->resize(size);
+		pixel.resize(size);
+		rng.resize(size);
+	}
+
+	void path_tracer::path_queue::move(const size_t from, path_queue& to, const size_t index) {
+		to.ox[index] = ox[from];
+		to.oy[index] = oy[from];
+		to.oz[index] = oz[from];
+		to.dx[index] = dx[from];
+		to.dy[index] = dy[from];
+		to.dz[index] = dz[from];
+		to.r[index] = r[from];
+		to.g[index] = g[from];
+		to.b[index] = b[from];
+		to.pixel[index] = pixel[from];
+		to.rng[index] = rng[from];
+	}
+
+	void path_tracer::hit_queue::resize(const size_t size) {
+		t.resize(size);
+		triangle.resize(size);
+		instance.resize(size);
+	}
+
+	void path_tracer::shadow_queue::resize(const size_t size) {
+		for (std::vector<float>* v : { &ox, &oy, &oz, &r, &g, &b }) v->resize(size);
+		pixel.resize(size);
+	}
+
+
+	void path_tracer::generate(const pinhole_camera& camera, const unsigned* pixels, const size_t first, const size_t count, vec3f* radiance, thread_pool& pool) {
+		const uint32_t seed = hash(camera.sample);
+		for_each_chunk(count, pool, [&](int, const size_t begin, const size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				const unsigned p = pixels ? pixels[first + i] : (unsigned) (first + i);
+				const int x = (int) (p % camera.width);
+				const int y = (int) (p / camera.width);
+				const vec3f d = camera.direction(x, y);
+
+				_paths.ox[i] = camera.position.x();
+				_paths.oy[i] = camera.position.y();
+				_paths.oz[i] = camera.position.z();
+				_paths.dx[i] = d.x();
+				_paths.dy[i] = d.y();
+				_paths.dz[i] = d.z();
+				_paths.r[i] = 1.0f;
+				_paths.g[i] = 1.0f;
+				_paths.b[i] = 1.0f;
+				_paths.pixel[i] = p;
+				_paths.rng[i] = hash(p ^ seed) | 1; //xorshift never leaves 0
+				radiance[p] = vec3f(0.0f, 0.0f, 0.0f);
+			}
+		});
+	}
+
+	void path_tracer::extend(const scene& s, const rasterizer* primary, const int width, const size_t count, thread_pool& pool) {
+		for_each_chunk(count, pool, [&](int, const size_t first, const size_t last) {
+			for (size_t i = first; i < last; ++i) {
+				ray r;
+				r.origin = vec3f(_paths.ox[i], _paths.oy[i], _paths.oz[i]);
+				r.direction = vec3f(_paths.dx[i], _paths.dy[i], _paths.dz[i]);
+				const unsigned pixel = _paths.pixel[i];
+				const hit h = primary ? primary->first_hit(s, r, (int) (pixel % width), (int) (pixel / width)) : s.intersect(r);
+				_hits.t[i] = h.t;
+				_hits.triangle[i] = h.triangle;
+				_hits.instance[i] = h.instance;
+			}
+		});
+	}
+
+	template <unsigned FLAGS>
+	void path_tracer::shade(const scene& s, const size_t count, const unsigned flags, const float epsilon, vec3f* radiance, pixel_features* features, thread_pool& pool) {
+		//constants in the specialized versions, which leaves their loop without these branches
+		const unsigned active = FLAGS == SHADE_GENERIC ? flags : FLAGS;
+		const bool writeFeatures = (active & SHADE_FEATURES) != 0;
+		const bool bounces = (active & SHADE_CONTINUE) != 0;
+		const bool roulette = (active & SHADE_ROULETTE) != 0;
+
+		const auto store_features = [&](const unsigned pixel, const vec3f& n, const float depth, const float albedo) {
+			features->nx[pixel] = n.x();
+			features->ny[pixel] = n.y();
+			features->nz[pixel] = n.z();
+			features->depth[pixel] = depth;
+			features->ar[pixel] = albedo;
+			features->ag[pixel] = albedo;
+			features->ab[pixel] = albedo;
+		};
+
+		for_each_chunk(count, pool, [&](const int chunk, const size_t first, const size_t last) {
+			//survivors and shadow rays are written to the front of the chunk's range, never past the path
+			//that is read, so both compact in place
+			size_t alive = first;
+			size_t shadows = first;
+			for (size_t i = first; i < last; ++i) {
+				const vec3f d(_paths.dx[i], _paths.dy[i], _paths.dz[i]);
+				vec3f throughput(_paths.r[i], _paths.g[i], _paths.b[i]);
+				const unsigned pixel = _paths.pixel[i];
+				if (_hits.triangle[i] < 0) {
+					radiance[pixel] += throughput * sky_color(d);
+					if (writeFeatures) store_features(pixel, vec3f(0.0f, 0.0f, 0.0f), 0.0f, 1.0f);
+					continue;
+				}
+
+				hit h;
+				h.triangle = _hits.triangle[i];
+				h.instance = _hits.instance[i];
+				vec3f v0, v1, v2;
+				s.triangle(h, v0, v1, v2);
+
+				//slivers that collapse to a line in world space have no normal, the path ends there
+				vec3f n = (v1 - v0).cross(v2 - v0);
+				const float len = n.len();
+				if (!(len > 0.0f)) {
+					if (writeFeatures) store_features(pixel, vec3f(0.0f, 0.0f, 0.0f), _hits.t[i], ALBEDO);
+					continue;
+				}
+
+				n /= len;
+				if (n.dot(d) > 0.0f) n = n * -1.0f;
+				if (writeFeatures) store_features(pixel, n, _hits.t[i], ALBEDO);
+
+				const vec3f origin = vec3f(_paths.ox[i], _paths.oy[i], _paths.oz[i]) + d * _hits.t[i] + n * epsilon;
+				throughput *= ALBEDO;
+
+				const float cosSun = n.dot(SUN_DIRECTION);
+				if (cosSun > 0.0f) {
+					const vec3f light = throughput * SUN_IRRADIANCE * (cosSun / PI);
+					_shadows.ox[shadows] = origin.x();
+					_shadows.oy[shadows] = origin.y();
+					_shadows.oz[shadows] = origin.z();
+					_shadows.r[shadows] = light.x();
+					_shadows.g[shadows] = light.y();
+					_shadows.b[shadows] = light.z();
+					_shadows.pixel[shadows] = pixel;
+					++shadows;
+				}
+
+				if (!bounces) continue;
+
+				//the cosine of the bounce direction cancels with its pdf, leaving the albedo
+				uint32_t rng = _paths.rng[i];
+				if (roulette) {
+					const float survive = std::min(0.95f, std::max(throughput.x(), std::max(throughput.y(), throughput.z())));
+					if (random_float(rng) >= survive) continue;
+					throughput /= survive;
+				}
+
+				const float r1 = random_float(rng);
+				const float r2 = random_float(rng);
+				const vec3f next = sample_cosine(n, r1, r2);
+
+				_paths.ox[alive] = origin.x();
+				_paths.oy[alive] = origin.y();
+				_paths.oz[alive] = origin.z();
+				_paths.dx[alive] = next.x();
+				_paths.dy[alive] = next.y();
+				_paths.dz[alive] = next.z();
+				_paths.r[alive] = throughput.x();
+				_paths.g[alive] = throughput.y();
+				_paths.b[alive] = throughput.z();
+				_paths.pixel[alive] = pixel;
+				_paths.rng[alive] = rng;
+				++alive;
+			}
+
+			_alive[chunk] = alive - first;
+			_shadowCounts[chunk] = shadows - first;
+		});
+	}
+
+	void path_tracer::connect(const scene& s, const size_t count, vec3f* radiance, thread_pool& pool) {
+		for_each_chunk(count, pool, [&](const int chunk, const size_t first, size_t) {
+			const size_t last = first + _shadowCounts[chunk];
+			for (size_t i = first; i < last; ++i) {
+				ray r;
+				r.origin = vec3f(_shadows.ox[i], _shadows.oy[i], _shadows.oz[i]);
+				r.direction = SUN_DIRECTION;
+				if (!s.occluded(r)) radiance[_shadows.pixel[i]] += vec3f(_shadows.r[i], _shadows.g[i], _shadows.b[i]);
+			}
+		});
+	}
+
+	size_t path_tracer::compact(const size_t count, const aabb* sortBounds, thread_pool& pool) {
+		const int chunks = (int) ((count + PATH_CHUNK - 1) / PATH_CHUNK);
+		std::vector<size_t> offsets((size_t) chunks + 1, 0);
+		for (int c = 0; c < chunks; ++c) offsets[c + 1] = offsets[c] + _alive[c];
+		const size_t alive = offsets[chunks];
+
+		if (!sortBounds || alive < SORT_MIN) {
+			for_each_chunk(count, pool, [&](const int chunk, const size_t first, size_t) {
+				for (size_t i = 0; i < _alive[chunk]; ++i) _paths.move(first + i, _next, offsets[chunk] + i);
+			});
+		} else {
+			//keys carry the queue index of their path below them, the sorted keys are the order to gather in
+			_keys.resize(alive);
+			for_each_chunk(count, pool, [&](const int chunk, const size_t first, size_t) {
+				for (size_t i = 0; i < _alive[chunk]; ++i) {
+					const size_t from = first + i;
+					ray r;
+					r.origin = vec3f(_paths.ox[from], _paths.oy[from], _paths.oz[from]);
+					r.direction = vec3f(_paths.dx[from], _paths.dy[from], _paths.dz[from]);
+					_keys[offsets[chunk] + i] = (uint64_t) ray_sort_key(r, *sortBounds) << 32 | from;
+				}
+			});
+
+			radix_sort(_keys, 32, 32 + RAY_SORT_KEY_BITS, &pool);
+			for_each_chunk(alive, pool, [&](int, const size_t first, const size_t last) {
+				for (size_t i = first; i < last; ++i) _paths.move((uint32_t) _keys[i], _next, i);
+			});
+		}
+
+		std::swap(_paths, _next);
+		return alive;
+	}
+
+	void path_tracer::render(const scene& s, const pinhole_camera& camera, const int maxBounces, const bool sortRays, vec3f* radiance, pixel_features* features, const rasterizer* primary, const std::vector<unsigned>* list, thread_pool& pool) {
+		const size_t pixels = list ? list->size() : (size_t) camera.width * camera.height;
+		if (pixels == 0) return;
+
+		const size_t capacity = std::min(pixels, WAVE_SIZE);
+		if (_paths.pixel.size() < capacity) {
+			_paths.resize(capacity);
+			_next.resize(capacity);
+			_hits.resize(capacity);
+			_shadows.resize(capacity);
+			_alive.resize((capacity + PATH_CHUNK - 1) / PATH_CHUNK);
+			_shadowCounts.resize(_alive.size());
+		}
+
+		//surfaces are left this far along their normal, relative to the scene so it works at any scale
+		const aabb bounds = s.bounds();
+		const float epsilon = s.empty() ? 0.0f : 1e-5f * bounds.extent().len();
+
+		typedef void (path_tracer::*shade_stage)(const scene&, const size_t, const unsigned, const float, vec3f*, pixel_features*, thread_pool&);
+		static const shade_stage SHADE_STAGES[SHADE_COMBINATIONS] = {
+			&path_tracer::shade<0>, &path_tracer::shade<1>, &path_tracer::shade<2>, &path_tracer::shade<3>,
+			&path_tracer::shade<4>, &path_tracer::shade<5>, &path_tracer::shade<6>, &path_tracer::shade<7>
+		};
+
+		for (size_t firstPixel = 0; firstPixel < pixels; firstPixel += WAVE_SIZE) {
+			size_t count = std::min(WAVE_SIZE, pixels - firstPixel);
+			{
+				PROFILE_SCOPE("generate");
+				generate(camera, list ? list->data() : nullptr, firstPixel, count, radiance, pool);
+			}
+
+			for (int bounce = 0; count > 0; ++bounce) {
+				{
+					PROFILE_SCOPE("extend");
+					extend(s, bounce == 0 ? primary : nullptr, camera.width, count, pool);
+				}
+				{
+					PROFILE_SCOPE("shade");
+					//the first hits are what the denoiser sees of each pixel, paths are still in pixel order then
+					unsigned flags = 0;
+					if (features && bounce == 0) flags |= SHADE_FEATURES;
+					if (bounce < maxBounces) flags |= SHADE_CONTINUE;
+					if (bounce >= ROULETTE_BOUNCE) flags |= SHADE_ROULETTE;
+
+					const shade_stage stage = _specialized ? SHADE_STAGES[flags] : &path_tracer::shade<SHADE_GENERIC>;
+					(this->*stage)(s, count, flags, epsilon, radiance, features, pool);
+				}
+				{
+					PROFILE_SCOPE("connect");
+					connect(s, count, radiance, pool);
+				}
+				{
+					PROFILE_SCOPE("compact");
+					count = compact(count, sortRays ? &bounds : nullptr, pool);
+				}
+			}
+		}
+	}
+}
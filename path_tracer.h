@@ -0,0 +1,90 @@
+﻿#pragma once
+#include "camera.h"
+#include "denoise.h"
+#include "scene.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace raytracer {
+	struct rasterizer;
+	struct thread_pool;
+
+	//light arriving from the sky in the given direction, a gradient from white at the horizon to blue
+	vec3f sky_color(const vec3f& direction);
+
+	//wavefront path tracer for diffuse surfaces lit by the sky and a sun. instead of following each path to its
+	//end, a wave of paths goes through one stage at a time, each stage a parallel loop over queues kept as
+	//structure of arrays:
+	//generate: camera rays for a range of pixels
+	//extend: closest hits of every queued path
+	//shade: misses collect the sky, hits queue a shadow ray towards the sun and continue with a cosine sampled bounce
+	//connect: shadow rays that reach the sun add its light
+	//surviving paths are compacted to the front of the queue before the next bounce, so later bounces only loop
+	//over live paths. bounced rays leave in all directions, optionally the compaction also sorts them by
+	//ray_sort_key so that neighbours in the queue traverse similar nodes. the pixel index travels with each path,
+	//so sorting needs no scatter afterwards
+	struct path_tracer {
+		private:
+		struct path_queue {
+			std::vector<float> ox, oy, oz;
+			std::vector<float> dx, dy, dz;
+			std::vector<float> r, g, b; //throughput
+			std::vector<unsigned> pixel;
+			std::vector<uint32_t> rng;
+
+			void resize(const size_t size);
+			void move(const size_t from, path_queue& to, const size_t index);
+		};
+
+		struct hit_queue {
+			std::vector<float> t;
+			std::vector<int> triangle;
+			std::vector<int> instance;
+
+			void resize(const size_t size);
+		};
+
+		//light each shadow ray brings to its pixel if nothing blocks it
+		struct shadow_queue {
+			std::vector<float> ox, oy, oz;
+			std::vector<float> r, g, b;
+			std::vector<unsigned> pixel;
+
+			void resize(const size_t size);
+		};
+
+		path_queue _paths;
+		path_queue _next;
+		hit_queue _hits;
+		shadow_queue _shadows;
+
+		//survivors and shadow rays of every chunk, shade packs both to the front of the chunk's range
+		std::vector<size_t> _alive;
+		std::vector<size_t> _shadowCounts;
+		std::vector<uint64_t> _keys;
+
+		bool _specialized = true;
+
+		void generate(const pinhole_camera& camera, const unsigned* pixels, const size_t first, const size_t count, vec3f* radiance, thread_pool& pool);
+		void extend(const scene& s, const rasterizer* primary, const int width, const size_t count, thread_pool& pool);
+		//FLAGS are the shade_flags of the bounce, SHADE_GENERIC tests the ones passed in flags per path instead
+		template <unsigned FLAGS>
+		void shade(const scene& s, const size_t count, const unsigned flags, const float epsilon, vec3f* radiance, pixel_features* features, thread_pool& pool);
+		void connect(const scene& s, const size_t count, vec3f* radiance, thread_pool& pool);
+		size_t compact(const size_t count, const aabb* sortBounds, thread_pool& pool);
+
+		public:
+		//writes one sample of every pixel to radiance (width * height entries), paths end after maxBounces
+		//diffuse bounces or earlier by russian roulette. sortRays orders the bounced rays for coherence. features
+		//receives the first hit of every pixel for the denoiser if it is not nullptr. with primary the camera rays
+		//are not traced, their hits come from its visibility buffer, which has to be rendered for the same camera.
+		//pixels, unless nullptr, limits the samples to the listed pixel indices and leaves radiance and features of the
+		//others as they are
+		void render(const scene& s, const pinhole_camera& camera, const int maxBounces, const bool sortRays, vec3f* radiance, pixel_features* features, const rasterizer* primary, const std::vector<unsigned>* pixels, thread_pool& pool);
+
+		//the shade stage is compiled for every combination of what a bounce does (write features, continue paths,
+		//roulette) and render picks one per bounce. off runs one generic version that tests them per path
+		void set_specialized(const bool specialized) { _specialized = specialized; }
+	};
+}
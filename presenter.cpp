@@ -0,0 +1,21 @@
+﻿#include "presenter.h"
+#include "image.h"
+
+#include <cstring>
+
+namespace raytracer {
+
+	file_presenter::file_presenter() : _width(0), _height(0) { }
+
+	void file_presenter::present(const byte* pixels, const int width, const int height) {
+		_pixels.resize((size_t) width * height * 4);
+		memcpy(_pixels.data(), pixels, _pixels.size());
+		_width = width;
+		_height = height;
+	}
+
+	bool file_presenter::write(const char* path) const {
+		if (_pixels.empty()) return false;
+		return write_image(path, _pixels.data(), _width, _height);
+	}
+}
@@ -0,0 +1,34 @@
+﻿#pragma once
+#include "maths.h"
+
+#include <vector>
+
+namespace raytracer {
+	//shows finished frames. present() is always called from the same thread, pixels are rgba8 with
+	//the first row at the bottom and stay valid until it returns
+	struct presenter {
+		virtual ~presenter() { }
+		virtual void present(const byte* pixels, const int width, const int height) = 0;
+	};
+
+	//drops every frame, for measuring the pipeline without a display
+	struct null_presenter : presenter {
+		void present(const byte*, const int, const int) override { }
+	};
+
+	//keeps a copy of the newest frame so it can be written to an image file at any point
+	struct file_presenter : presenter {
+		private:
+		std::vector<byte> _pixels;
+		int _width;
+		int _height;
+
+		public:
+		file_presenter();
+
+		void present(const byte* pixels, const int width, const int height) override;
+
+		//see write_image, returns false if nothing was presented yet or on io errors
+		bool write(const char* path) const;
+	};
+}
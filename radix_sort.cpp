@@ -0,0 +1,59 @@
+﻿#include "radix_sort.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace raytracer {
+
+	namespace {
+		constexpr size_t SORT_CHUNK = 1u << 14; //keys one pool task histograms or scatters
+		constexpr int RADIX_BITS = 10; //per pass
+	}
+
+
+	void radix_sort(std::vector<uint64_t>& keys, const int firstBit, const int lastBit, thread_pool* pool) {
+		constexpr unsigned digits = 1u << RADIX_BITS;
+		const size_t count = keys.size();
+		const int chunks = (int) ((count + SORT_CHUNK - 1) / SORT_CHUNK);
+		if (chunks < 2) pool = nullptr;
+
+		std::vector<uint64_t> scratch(count);
+		std::vector<size_t> offsets((size_t) chunks * digits);
+		const auto for_chunks = [&](const std::function<void(int, size_t, size_t)>& fn) {
+			const auto body = [&](const int chunk, const int) {
+				const size_t first = (size_t) chunk * SORT_CHUNK;
+				fn(chunk, first, std::min(count, first + SORT_CHUNK));
+			};
+
+			if (pool) pool->run(chunks, body);
+			else for (int c = 0; c < chunks; ++c) body(c, 0);
+		};
+
+		for (int shift = firstBit; shift < lastBit; shift += RADIX_BITS) {
+			const uint64_t mask = (1u << std::min(RADIX_BITS, lastBit - shift)) - 1;
+			std::fill(offsets.begin(), offsets.end(), 0);
+			for_chunks([&](const int chunk, const size_t first, const size_t last) {
+				size_t* histogram = offsets.data() + (size_t) chunk * digits;
+				for (size_t i = first; i < last; ++i) histogram[keys[i] >> shift & mask]++;
+			});
+
+			//exclusive prefix sum digit by digit, chunk by chunk, so each chunk scatters stably into its own slots
+			size_t sum = 0;
+			for (unsigned d = 0; d < digits; ++d) {
+				for (int c = 0; c < chunks; ++c) {
+					size_t& slot = offsets[(size_t) c * digits + d];
+					const size_t n = slot;
+					slot = sum;
+					sum += n;
+				}
+			}
+
+			for_chunks([&](const int chunk, const size_t first, const size_t last) {
+				size_t* slots = offsets.data() + (size_t) chunk * digits;
+				for (size_t i = first; i < last; ++i) scratch[slots[keys[i] >> shift & mask]++] = keys[i];
+			});
+			keys.swap(scratch);
+		}
+	}
+}
@@ -0,0 +1,12 @@
+﻿#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace raytracer {
+	struct thread_pool;
+
+	//stable lsd radix sort of keys by their bits [firstBit, lastBit), bits outside that range only come along.
+	//with a pool large arrays are histogrammed and scattered on all of its workers, so it can not be called
+	//from one of the pool's own tasks then
+	void radix_sort(std::vector<uint64_t>& keys, const int firstBit, const int lastBit, thread_pool* pool = nullptr);
+}
@@ -0,0 +1,521 @@
+﻿#include "rasterizer.h"
+#include "measurements.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace raytracer {
+
+	namespace {
+		constexpr int TILE = 32; //pixels on the side of a screen tile, one pool task rasterizes it
+		constexpr int BLOCK = 8; //pixels on the side of a hierarchical depth block
+		constexpr int BLOCKS = TILE / BLOCK;
+		constexpr size_t CHUNK_TRIANGLES = 1 << 12; //triangles one pool task sets up
+		constexpr unsigned NONE = ~0u;
+		constexpr int SMALL_SAMPLES = 4; //triangles with at most this many pixel samples in their bounds are tested in setup
+		static_assert(BLOCK % simdf::width == 0, "block rows must be made of whole vectors");
+
+		//homogeneous screen position, pixel coordinates are x / w and y / w and w is the depth along the view
+		struct clip_vertex {
+			float x, y, w;
+		};
+
+		struct clip_plane {
+			float a, b, c, d;
+
+			float distance(const clip_vertex& v) const { return a * v.x + b * v.y + c * v.w + d; }
+		};
+
+		//near plane, the image with a pixel of margin, and a guard band as wide as the image around it.
+		//triangles outside one of the first five planes cover no pixel, only the ones crossing the near plane or
+		//the guard band are clipped, which keeps pixel coordinates small enough for float edge functions.
+		//the planes are kept as structure of arrays to test a vertex against all of them at once, slots past
+		//the last plane hold one that nothing is outside of
+		constexpr int PLANES = 9;
+		constexpr int PLANE_SLOTS = 16;
+		constexpr int CULL_PLANES = 0x1F;
+		constexpr int CLIP_PLANES = 0x1E1;
+		constexpr int MAX_POLYGON = 3 + 5; //every clip plane adds at most one corner
+
+		struct frustum {
+			vec3f origin;
+			vec3f axisX;
+			vec3f axisY;
+			vec3f axisW;
+			alignas(32) float a[PLANE_SLOTS];
+			alignas(32) float b[PLANE_SLOTS];
+			alignas(32) float c[PLANE_SLOTS];
+			alignas(32) float d[PLANE_SLOTS];
+
+			void set_plane(const int p, const float pa, const float pb, const float pc, const float pd) {
+				a[p] = pa;
+				b[p] = pb;
+				c[p] = pc;
+				d[p] = pd;
+			}
+
+			clip_plane plane(const int p) const {
+				return clip_plane{ a[p], b[p], c[p], d[p] };
+			}
+
+			clip_vertex project(const vec3f& p) const {
+				const float dx = p.x() - origin.x(), dy = p.y() - origin.y(), dz = p.z() - origin.z();
+				return clip_vertex{
+					dx * axisX.x() + dy * axisX.y() + dz * axisX.z(),
+					dx * axisY.x() + dy * axisY.y() + dz * axisY.z(),
+					dx * axisW.x() + dy * axisW.y() + dz * axisW.z() };
+			}
+
+			void project(const simdf px, const simdf py, const simdf pz, simdf& x, simdf& y, simdf& w) const {
+				const simdf dx = px - simdf(origin.x()), dy = py - simdf(origin.y()), dz = pz - simdf(origin.z());
+				x = dx * simdf(axisX.x()) + dy * simdf(axisX.y()) + dz * simdf(axisX.z());
+				y = dx * simdf(axisY.x()) + dy * simdf(axisY.y()) + dz * simdf(axisY.z());
+				w = dx * simdf(axisW.x()) + dy * simdf(axisW.y()) + dz * simdf(axisW.z());
+			}
+
+			simdf distance(const int p, const simdf x, const simdf y, const simdf w) const {
+				return simdf(a[p]) * x + simdf(b[p]) * y + simdf(c[p]) * w + simdf(d[p]);
+			}
+
+			//bit p is set if v is outside plane p
+			int outcode(const clip_vertex& v) const {
+				const simdf x(v.x), y(v.y), w(v.w), zero(0.0f);
+				int code = 0;
+				for (int p = 0; p < PLANE_SLOTS; p += simdf::width) {
+					const simdf distance = simdf::load(a + p) * x + simdf::load(b + p) * y + simdf::load(c + p) * w + simdf::load(d + p);
+					code |= movemask(distance < zero) << p;
+				}
+
+				return code;
+			}
+
+			bool culls(const aabb& box) const {
+				int code = CULL_PLANES;
+				for (int k = 0; k < 8; ++k) {
+					const vec3f corner(k & 1 ? box.max.x() : box.min.x(), k & 2 ? box.max.y() : box.min.y(), k & 4 ? box.max.z() : box.min.z());
+					code &= outcode(project(corner));
+				}
+				return code != 0;
+			}
+		};
+
+		frustum make_frustum(const pinhole_camera& camera, const float nearDistance) {
+			//a point at depth w along forward projects to screen coordinate dot(p, right) / (|right|^2 * w) in
+			//[-1, 1], which maps to pixels so that the samples of this frame sit on whole numbers
+			const float w = (float) camera.width, h = (float) camera.height;
+			const float centerX = 0.5f * w - 0.5f - camera.jitterX;
+			const float centerY = 0.5f * h - 0.5f - camera.jitterY;
+
+			frustum f;
+			f.origin = camera.position;
+			f.axisX = camera.right * (0.5f * w / camera.right.lenSquared()) + camera.forward * centerX;
+			f.axisY = camera.up * (0.5f * h / camera.up.lenSquared()) + camera.forward * centerY;
+			f.axisW = camera.forward;
+			f.set_plane(0, 0.0f, 0.0f, 1.0f, -nearDistance);
+			f.set_plane(1, 1.0f, 0.0f, 1.0f, 0.0f);
+			f.set_plane(2, -1.0f, 0.0f, w, 0.0f);
+			f.set_plane(3, 0.0f, 1.0f, 1.0f, 0.0f);
+			f.set_plane(4, 0.0f, -1.0f, h, 0.0f);
+			f.set_plane(5, 1.0f, 0.0f, w, 0.0f);
+			f.set_plane(6, -1.0f, 0.0f, 2.0f * w, 0.0f);
+			f.set_plane(7, 0.0f, 1.0f, h, 0.0f);
+			f.set_plane(8, 0.0f, -1.0f, 2.0f * h, 0.0f);
+			for (int p = PLANES; p < PLANE_SLOTS; ++p) f.set_plane(p, 0.0f, 0.0f, 0.0f, 1.0f);
+			return f;
+		}
+
+		//sutherland-hodgman, keeps the part of the polygon on the positive side of the plane
+		int clip_polygon(const clip_vertex* in, const int count, const clip_plane& plane, clip_vertex* out) {
+			int n = 0;
+			for (int k = 0; k < count; ++k) {
+				const clip_vertex& a = in[k];
+				const clip_vertex& b = in[(k + 1) % count];
+				const float da = plane.distance(a);
+				const float db = plane.distance(b);
+				if (da >= 0.0f) out[n++] = a;
+				if ((da >= 0.0f) != (db >= 0.0f)) {
+					const float t = da / (da - db);
+					out[n++] = clip_vertex{ a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.w + (b.w - a.w) * t };
+				}
+			}
+
+			return n;
+		}
+	}
+
+
+	rasterizer::rasterizer() : _width(0), _height(0) { }
+
+	void rasterizer::setup(const scene& s, const pinhole_camera& camera, const float nearDistance, const size_t c) {
+		const frustum f = make_frustum(camera, nearDistance);
+		const chunk& work = _chunks[c];
+		std::vector<screen_triangle>& triangles = _chunkTriangles[c];
+		std::vector<uint64_t>& bins = _chunkBins[c];
+		triangles.clear();
+		bins.clear();
+
+		const int tilesX = (camera.width + TILE - 1) / TILE;
+		const auto emit = [&](const clip_vertex& v0, const clip_vertex& v1, const clip_vertex& v2, const int triangle) {
+			const clip_vertex* v[3] = { &v0, &v1, &v2 };
+			double x[3], y[3], z[3];
+			for (int k = 0; k < 3; ++k) {
+				z[k] = 1.0 / v[k]->w;
+				x[k] = v[k]->x * z[k];
+				y[k] = v[k]->y * z[k];
+			}
+
+			//triangles seen edge on and those between the pixel samples cover nothing
+			const double area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+			if (!(std::fabs(area) > 0.0)) return;
+
+			screen_triangle t;
+			t.minX = std::max(0, (int) std::ceil(std::min(x[0], std::min(x[1], x[2]))));
+			t.minY = std::max(0, (int) std::ceil(std::min(y[0], std::min(y[1], y[2]))));
+			t.maxX = std::min(camera.width - 1, (int) std::floor(std::max(x[0], std::max(x[1], x[2]))));
+			t.maxY = std::min(camera.height - 1, (int) std::floor(std::max(y[0], std::max(y[1], y[2]))));
+			if (t.minX > t.maxX || t.minY > t.maxY) return;
+
+			//edge k is opposite of corner k and positive inside for both windings, since triangles are two sided.
+			//divided by the area the edges are the barycentrics, which interpolate the inverse depth
+			const double sign = area > 0.0 ? 1.0 : -1.0;
+			double ea[3], eb[3], ec[3];
+			for (int k = 0; k < 3; ++k) {
+				const int a = (k + 1) % 3, b = (k + 2) % 3;
+				ea[k] = (y[a] - y[b]) * sign;
+				eb[k] = (x[b] - x[a]) * sign;
+				ec[k] = (x[a] * y[b] - x[b] * y[a]) * sign;
+			}
+
+			//small triangles mostly fall between the samples, testing their few samples here saves binning them
+			if ((t.maxX - t.minX + 1) * (t.maxY - t.minY + 1) <= SMALL_SAMPLES) {
+				bool covers = false;
+				for (int py = t.minY; py <= t.maxY; ++py) {
+					for (int px = t.minX; px <= t.maxX; ++px) {
+						covers |= ea[0] * px + eb[0] * py + ec[0] >= 0.0 && ea[1] * px + eb[1] * py + ec[1] >= 0.0 && ea[2] * px + eb[2] * py + ec[2] >= 0.0;
+					}
+				}
+				if (!covers) return;
+			}
+
+			const double invArea = 1.0 / std::fabs(area);
+			double depthA = 0.0, depthB = 0.0, depthC = 0.0;
+			for (int k = 0; k < 3; ++k) {
+				t.edgeA[k] = (float) ea[k];
+				t.edgeB[k] = (float) eb[k];
+				t.edgeC[k] = ec[k];
+				depthA += ea[k] * z[k];
+				depthB += eb[k] * z[k];
+				depthC += ec[k] * z[k];
+			}
+
+			t.depthA = (float) (depthA * invArea);
+			t.depthB = (float) (depthB * invArea);
+			t.depthC = depthC * invArea;
+			t.nearest = (float) std::max(z[0], std::max(z[1], z[2]));
+			t.triangle = triangle;
+			t.instance = work.instance;
+
+			const uint64_t index = triangles.size();
+			triangles.push_back(t);
+			for (int ty = t.minY / TILE; ty <= t.maxY / TILE; ++ty) {
+				for (int tx = t.minX / TILE; tx <= t.maxX / TILE; ++tx) bins.push_back((uint64_t) (ty * tilesX + tx) << 32 | index);
+			}
+		};
+
+		//triangles go through projection and culling simdf::width at a time. most of them are small, and the few
+		//that survive or need clipping are set up one by one
+		constexpr int W = simdf::width;
+		const simdf zero(0.0f);
+		const simdf maxX((float) camera.width - 1.0f), maxY((float) camera.height - 1.0f);
+		alignas(32) float corners[9][W];
+		alignas(32) float projected[9][W];
+		for (size_t first = work.first; first < work.last; first += W) {
+			//lanes past the end repeat the last triangle and are masked out
+			const int count = (int) std::min((size_t) W, work.last - first);
+			const int valid = (1 << count) - 1;
+			for (int l = 0; l < W; ++l) {
+				hit id;
+				id.triangle = (int) (first + std::min(l, count - 1));
+				id.instance = work.instance;
+				vec3f p[3];
+				s.triangle(id, p[0], p[1], p[2]);
+				for (int k = 0; k < 3; ++k) {
+					corners[3 * k][l] = p[k].x();
+					corners[3 * k + 1][l] = p[k].y();
+					corners[3 * k + 2][l] = p[k].z();
+				}
+			}
+
+			simdf x[3], y[3], w[3];
+			for (int k = 0; k < 3; ++k) {
+				f.project(simdf::load(corners[3 * k]), simdf::load(corners[3 * k + 1]), simdf::load(corners[3 * k + 2]), x[k], y[k], w[k]);
+				x[k].store(projected[3 * k]);
+				y[k].store(projected[3 * k + 1]);
+				w[k].store(projected[3 * k + 2]);
+			}
+
+			simdf culled = zero, clipped = zero;
+			for (int p = 0; p < PLANES; ++p) {
+				const simdf out0 = f.distance(p, x[0], y[0], w[0]) < zero;
+				const simdf out1 = f.distance(p, x[1], y[1], w[1]) < zero;
+				const simdf out2 = f.distance(p, x[2], y[2], w[2]) < zero;
+				if (CULL_PLANES & (1 << p)) culled = culled | (out0 & out1 & out2);
+				if (CLIP_PLANES & (1 << p)) clipped = clipped | out0 | out1 | out2;
+			}
+
+			//pixel bounds and the area of the lanes that need no clipping
+			simdf sx[3], sy[3];
+			for (int k = 0; k < 3; ++k) {
+				const simdf invW = simdf(1.0f) / w[k];
+				sx[k] = x[k] * invW;
+				sy[k] = y[k] * invW;
+			}
+
+			const simdf left = vmax(vceil(vmin(sx[0], vmin(sx[1], sx[2]))), zero);
+			const simdf right = vmin(vfloor(vmax(sx[0], vmax(sx[1], sx[2]))), maxX);
+			const simdf top = vmax(vceil(vmin(sy[0], vmin(sy[1], sy[2]))), zero);
+			const simdf bottom = vmin(vfloor(vmax(sy[0], vmax(sy[1], sy[2]))), maxY);
+			const simdf area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+			simdf empty = (left > right) | (top > bottom);
+
+			//the only sample of a triangle is tested right away, edges relative to it keep their precision. the test
+			//is in float, so it only drops clear misses and leaves the ones close to an edge to the setup in double
+			const simdf single = (left >= right) & (top >= bottom);
+			const simdf tolerance = simdf(-1e-3f) * area * area;
+			simdf missed = zero;
+			for (int k = 0; k < 3; ++k) {
+				const int a = (k + 1) % 3, b = (k + 2) % 3;
+				const simdf edge = (sx[a] - left) * (sy[b] - top) - (sx[b] - left) * (sy[a] - top);
+				missed = missed | (edge * area < tolerance);
+			}
+			empty = empty | (single & missed);
+
+			const int skip = movemask(culled) | ~valid;
+			const int clip = movemask(clipped) & ~skip;
+			const int draw = ~movemask(empty) & ~skip & ~clip;
+			for (int m = draw; m; m &= m - 1) {
+				const int l = lowest_bit((unsigned) m);
+				const clip_vertex v0{ projected[0][l], projected[1][l], projected[2][l] };
+				const clip_vertex v1{ projected[3][l], projected[4][l], projected[5][l] };
+				const clip_vertex v2{ projected[6][l], projected[7][l], projected[8][l] };
+				emit(v0, v1, v2, (int) first + l);
+			}
+
+			for (int m = clip; m; m &= m - 1) {
+				const int l = lowest_bit((unsigned) m);
+				clip_vertex polygon[2][MAX_POLYGON];
+				int n = 3, current = 0;
+				for (int k = 0; k < 3; ++k) polygon[0][k] = clip_vertex{ projected[3 * k][l], projected[3 * k + 1][l], projected[3 * k + 2][l] };
+
+				const int planes = (f.outcode(polygon[0][0]) | f.outcode(polygon[0][1]) | f.outcode(polygon[0][2])) & CLIP_PLANES;
+				for (int p = 0; p < PLANES && n >= 3; ++p) {
+					if (!(planes & (1 << p))) continue;
+					n = clip_polygon(polygon[current], n, f.plane(p), polygon[current ^ 1]);
+					current ^= 1;
+				}
+
+				for (int k = 1; k + 1 < n; ++k) emit(polygon[current][0], polygon[current][k], polygon[current][k + 1], (int) first + l);
+			}
+		}
+	}
+
+	void rasterizer::bin(const int tiles) {
+		//chunks keep the front to back order of the instances, so do the bins of every tile
+		_binStart.assign((size_t) tiles + 1, 0);
+		for (size_t c = 0; c < _chunks.size(); ++c) {
+			for (const uint64_t entry : _chunkBins[c]) ++_binStart[(entry >> 32) + 1];
+		}
+
+		for (int t = 0; t < tiles; ++t) _binStart[t + 1] += _binStart[t];
+
+		_bins.resize(_binStart[tiles]);
+		_binCursor.assign(_binStart.begin(), _binStart.end() - 1);
+		for (size_t c = 0; c < _chunks.size(); ++c) {
+			for (const uint64_t entry : _chunkBins[c]) _bins[_binCursor[entry >> 32]++] = _chunkTriangles[c][(uint32_t) entry];
+		}
+	}
+
+	void rasterizer::raster_tile(const int tile, const int tilesX) {
+		const int tileX = (tile % tilesX) * TILE;
+		const int tileY = (tile / tilesX) * TILE;
+
+		//inverse depth, 0 is infinitely far. every block keeps the farthest depth of its pixels. screen triangle
+		//ids are stored as the bits of floats, so they are blended with the same mask as the depths
+		alignas(32) float depth[TILE * TILE];
+		alignas(32) float visible[TILE * TILE];
+		float blockFar[BLOCKS * BLOCKS];
+		float none;
+		memcpy(&none, &NONE, sizeof(none));
+		std::fill(depth, depth + TILE * TILE, 0.0f);
+		std::fill(visible, visible + TILE * TILE, none);
+		std::fill(blockFar, blockFar + BLOCKS * BLOCKS, 0.0f);
+
+		alignas(32) float lanes[simdf::width];
+		for (int l = 0; l < simdf::width; ++l) lanes[l] = (float) l;
+		const simdf laneX = simdf::load(lanes);
+		const simdf zero(0.0f);
+
+		for (unsigned b = _binStart[tile]; b < _binStart[tile + 1]; ++b) {
+			const screen_triangle& t = _bins[b];
+
+			//planes moved to the tile corner, pixels are addressed within the tile from here on
+			float c[3];
+			for (int k = 0; k < 3; ++k) c[k] = (float) (t.edgeC[k] + (double) t.edgeA[k] * tileX + (double) t.edgeB[k] * tileY);
+			const float zc = (float) (t.depthC + (double) t.depthA * tileX + (double) t.depthB * tileY);
+
+			const simdf a0(t.edgeA[0]), a1(t.edgeA[1]), a2(t.edgeA[2]);
+			const simdf b0(t.edgeB[0]), b1(t.edgeB[1]), b2(t.edgeB[2]);
+			const simdf c0(c[0]), c1(c[1]), c2(c[2]);
+			const simdf za(t.depthA), zb(t.depthB), zcv(zc);
+			float idBits;
+			memcpy(&idBits, &b, sizeof(idBits));
+			const simdf idv(idBits);
+
+			const int x0 = std::max(t.minX - tileX, 0), x1 = std::min(t.maxX - tileX, TILE - 1);
+			const int y0 = std::max(t.minY - tileY, 0), y1 = std::min(t.maxY - tileY, TILE - 1);
+			for (int by = y0 / BLOCK; by <= y1 / BLOCK; ++by) {
+				for (int bx = x0 / BLOCK; bx <= x1 / BLOCK; ++bx) {
+					float& far = blockFar[by * BLOCKS + bx];
+					if (t.nearest < far) continue;
+
+					//an edge that is negative at the block corner where it is largest excludes the whole block
+					const int bx0 = bx * BLOCK, by0 = by * BLOCK;
+					bool outside = false;
+					for (int k = 0; k < 3; ++k) {
+						const float ex = t.edgeA[k] > 0.0f ? bx0 + BLOCK - 1 : bx0;
+						const float ey = t.edgeB[k] > 0.0f ? by0 + BLOCK - 1 : by0;
+						outside |= c[k] + t.edgeA[k] * ex + t.edgeB[k] * ey < 0.0f;
+					}
+					if (outside) continue;
+
+					bool written = false;
+					const int rowEnd = std::min(by0 + BLOCK - 1, y1);
+					for (int y = std::max(by0, y0); y <= rowEnd; ++y) {
+						const simdf py((float) y);
+						for (int x = bx0; x < bx0 + BLOCK; x += simdf::width) {
+							const simdf px = simdf((float) x) + laneX;
+							const simdf e0 = c0 + a0 * px + b0 * py;
+							const simdf e1 = c1 + a1 * px + b1 * py;
+							const simdf e2 = c2 + a2 * px + b2 * py;
+							const simdf z = zcv + za * px + zb * py;
+
+							float* d = depth + y * TILE + x;
+							const simdf old = simdf::load(d);
+							const simdf closer = (e0 >= zero) & (e1 >= zero) & (e2 >= zero) & (z > old);
+							if (!movemask(closer)) continue;
+
+							float* v = visible + y * TILE + x;
+							blend(old, z, closer).store(d);
+							blend(simdf::load(v), idv, closer).store(v);
+							written = true;
+						}
+					}
+
+					if (written) {
+						simdf farthest = simdf::load(depth + by0 * TILE + bx0);
+						for (int y = by0; y < by0 + BLOCK; ++y) {
+							for (int x = bx0; x < bx0 + BLOCK; x += simdf::width) farthest = vmin(farthest, simdf::load(depth + y * TILE + x));
+						}
+
+						alignas(32) float farLanes[simdf::width];
+						farthest.store(farLanes);
+						far = *std::min_element(farLanes, farLanes + simdf::width);
+					}
+				}
+			}
+		}
+
+		const int width = std::min(TILE, _width - tileX);
+		const int height = std::min(TILE, _height - tileY);
+		for (int y = 0; y < height; ++y) memcpy(&_visible[(size_t) (tileY + y) * _width + tileX], visible + y * TILE, width * sizeof(unsigned));
+	}
+
+	void rasterizer::render(const scene& s, const pinhole_camera& camera, thread_pool& pool) {
+		_width = camera.width;
+		_height = camera.height;
+		const size_t pixels = (size_t) _width * _height;
+		_chunks.clear();
+		if (pixels == 0 || s.empty()) {
+			_visible.assign(pixels, NONE);
+			return;
+		}
+
+		//geometry closer to the camera than this is clipped, relative to the scene so it works at any scale
+		const float nearDistance = 1e-5f * s.bounds().extent().len();
+
+		//instances in view, nearest first so the depth blocks fill up early
+		std::vector<std::pair<float, int>> order;
+		{
+			PROFILE_SCOPE("raster cull");
+			const frustum f = make_frustum(camera, nearDistance);
+			for (int i = 0; i < (int) s.instance_count(); ++i) {
+				const aabb b = s.instance_bounds(i);
+				if (b.min.x() > b.max.x() || f.culls(b)) continue;
+				order.emplace_back((b.center() - camera.position).lenSquared(), i);
+			}
+
+			std::sort(order.begin(), order.end());
+		}
+
+		for (const std::pair<float, int>& o : order) {
+			const size_t triangles = s.instance_triangle_count(o.second);
+			for (size_t first = 0; first < triangles; first += CHUNK_TRIANGLES) _chunks.push_back(chunk{ o.second, first, std::min(triangles, first + CHUNK_TRIANGLES) });
+		}
+
+		if (_chunkTriangles.size() < _chunks.size()) {
+			_chunkTriangles.resize(_chunks.size());
+			_chunkBins.resize(_chunks.size());
+		}
+
+		const int tilesX = (_width + TILE - 1) / TILE;
+		const int tiles = tilesX * ((_height + TILE - 1) / TILE);
+		{
+			PROFILE_SCOPE("raster setup");
+			pool.run((int) _chunks.size(), [&](const int c, const int) { setup(s, camera, nearDistance, (size_t) c); });
+		}
+		{
+			PROFILE_SCOPE("raster bin");
+			bin(tiles);
+		}
+		{
+			PROFILE_SCOPE("raster tiles");
+			_visible.resize(pixels);
+			pool.run(tiles, [&](const int tile, const int) { raster_tile(tile, tilesX); });
+		}
+	}
+
+	hit rasterizer::first_hit(const scene& s, const ray& r, const int x, const int y) const {
+		hit h;
+		h.t = r.tmax;
+		const size_t i = (size_t) y * _width + x;
+		if (_visible[i] == NONE) return h;
+
+		const screen_triangle& visible = _bins[_visible[i]];
+		h.triangle = visible.triangle;
+		h.instance = visible.instance;
+		vec3f v0, v1, v2;
+		s.triangle(h, v0, v1, v2);
+
+		//moller-trumbore without rejecting the barycentrics, samples on an edge can round to just outside the
+		//triangle that covered them. rays grazing its plane are traced instead
+		const vec3f e1 = v1 - v0, e2 = v2 - v0;
+		const vec3f p = r.direction.cross(e2);
+		const float det = e1.dot(p);
+		if (std::fabs(det) < 1e-12f) return s.intersect(r);
+
+		const float invDet = 1.0f / det;
+		const vec3f o = r.origin - v0;
+		const vec3f q = o.cross(e1);
+		const float t = e2.dot(q) * invDet;
+		if (!(t > 0.0f) || t >= r.tmax) return s.intersect(r);
+
+		const float u = std::min(std::max(o.dot(p) * invDet, 0.0f), 1.0f);
+		h.v = std::min(std::max(r.direction.dot(q) * invDet, 0.0f), 1.0f - u);
+		h.u = u;
+		h.t = t;
+		return h;
+	}
+}
@@ -0,0 +1,72 @@
+﻿#pragma once
+#include "camera.h"
+#include "scene.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace raytracer {
+	struct thread_pool;
+
+	//primary visibility by rasterization instead of a ray per pixel. the triangles of every instance in view are
+	//projected, clipped and binned into screen tiles in parallel chunks, then every tile is rasterized on its own
+	//with simd edge functions over rows of pixels into a visibility buffer holding the closest triangle of each
+	//pixel. a hierarchical depth buffer keeps the farthest depth of every 8x8 block of a tile, triangles behind it
+	//skip the block without touching its pixels, and instances are drawn front to back so that happens often.
+	//first_hit turns a pixel's triangle back into the hit of its camera ray, so shading and further rays start
+	//from the same point tracing would find
+	struct rasterizer {
+		private:
+		//edge functions and inverse depth as planes a * x + b * y + c over pixel coordinates, with pixel centers at
+		//whole numbers. c is kept in double and only rounded once moved to the corner of a tile, so edges far
+		//from the origin do not lose their subpixel precision
+		struct screen_triangle {
+			double edgeC[3];
+			float edgeA[3];
+			float edgeB[3];
+			double depthC;
+			float depthA;
+			float depthB;
+			float nearest; //largest inverse depth over the triangle
+			int minX, minY, maxX, maxY; //pixels it may cover, inclusive and within the image
+			int triangle;
+			int instance;
+		};
+
+		//range of an instance's triangles set up by one pool task
+		struct chunk {
+			int instance;
+			size_t first;
+			size_t last;
+		};
+
+		std::vector<chunk> _chunks;
+		std::vector<std::vector<screen_triangle>> _chunkTriangles;
+		std::vector<std::vector<uint64_t>> _chunkBins; //tile << 32 | index into the chunk's triangles
+
+		//copies of the screen triangles overlapping every tile in drawing order, so a tile reads its triangles
+		//front to back from one range instead of gathering them from all over the chunks
+		std::vector<unsigned> _binStart; //tiles + 1 entries, bins of tile t are [_binStart[t], _binStart[t + 1])
+		std::vector<unsigned> _binCursor;
+		std::vector<screen_triangle> _bins;
+
+		//visibility buffer, the bin entry every pixel sees or ~0u
+		int _width;
+		int _height;
+		std::vector<unsigned> _visible;
+
+		void setup(const scene& s, const pinhole_camera& camera, const float nearDistance, const size_t c);
+		void bin(const int tiles);
+		void raster_tile(const int tile, const int tilesX);
+
+		public:
+		rasterizer();
+
+		//fills the visibility buffer for the samples of camera
+		void render(const scene& s, const pinhole_camera& camera, thread_pool& pool);
+
+		//closest hit of r, the camera ray of pixel (x, y) in the last render, with the exact t and barycentrics of
+		//the triangle the pixel sees. misses keep triangle -1 and t at r.tmax
+		hit first_hit(const scene& s, const ray& r, const int x, const int y) const;
+	};
+}
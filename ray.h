@@ -0,0 +1,75 @@
+﻿#pragma once
+#include "maths.h"
+
+#include <cfloat>
+
+namespace raytracer {
+	struct ray {
+		vec3f origin;
+		vec3f direction;
+		float tmax = FLT_MAX;
+	};
+
+	struct hit {
+		float t = FLT_MAX;
+		float u = 0.0f;
+		float v = 0.0f;
+		int triangle = -1;
+		int instance = -1; //-1 for primitives that are not part of a scene
+	};
+
+	struct aabb {
+		vec3f min = vec3f(FLT_MAX, FLT_MAX, FLT_MAX);
+		vec3f max = vec3f(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+		void grow(const vec3f& p) {
+			min = component_min(min, p);
+			max = component_max(max, p);
+		}
+
+		void grow(const aabb& b) {
+			min = component_min(min, b.min);
+			max = component_max(max, b.max);
+		}
+
+		vec3f center() const {
+			return (min + max) * 0.5f;
+		}
+
+		vec3f extent() const {
+			return max - min;
+		}
+
+		float area() const {
+			const vec3f e = extent();
+			if (e.x() < 0.0f) return 0.0f; //empty box
+			return 2.0f * (e.x() * e.y() + e.y() * e.z() + e.z() * e.x());
+		}
+	};
+
+
+	//moller-trumbore, updates h if the triangle is closer than h.t
+	inline bool intersect_triangle(const ray& r, const vec3f& v0, const vec3f& e1, const vec3f& e2, const int id, hit& h) {
+		const vec3f p = r.direction.cross(e2);
+		const float det = e1.dot(p);
+		if (std::fabs(det) < 1e-12f) return false;
+
+		const float invDet = 1.0f / det;
+		const vec3f s = r.origin - v0;
+		const float u = s.dot(p) * invDet;
+		if (u < 0.0f || u > 1.0f) return false;
+
+		const vec3f q = s.cross(e1);
+		const float v = r.direction.dot(q) * invDet;
+		if (v < 0.0f || u + v > 1.0f) return false;
+
+		const float t = e2.dot(q) * invDet;
+		if (t <= 0.0f || t >= h.t) return false;
+
+		h.t = t;
+		h.u = u;
+		h.v = v;
+		h.triangle = id;
+		return true;
+	}
+}
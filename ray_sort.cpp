@@ -0,0 +1,87 @@
+﻿#include "ray_sort.h"
+#include "radix_sort.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace raytracer {
+
+	namespace {
+		constexpr int ORIGIN_BITS = 5; //per axis
+		constexpr int DIRECTION_BITS = 4; //per axis, fewer than ORIGIN_BITS
+		static_assert(RAY_SORT_KEY_BITS == 3 + 3 * ORIGIN_BITS + 3 * DIRECTION_BITS, "the key layout changed");
+		constexpr size_t KEY_CHUNK = 1u << 14; //rays one pool task computes keys for
+
+		uint32_t quantize(const float f, const int bits) {
+			return (uint32_t) std::min(std::max(f * (1 << bits), 0.0f), (float) ((1 << bits) - 1));
+		}
+
+		//spreads the low 10 bits so two zero bits follow each of them
+		uint32_t expand_bits(uint32_t v) {
+			v = (v * 0x00010001u) & 0xFF0000FFu;
+			v = (v * 0x00000101u) & 0x0F00F00Fu;
+			v = (v * 0x00000011u) & 0xC30C30C3u;
+			v = (v * 0x00000005u) & 0x49249249u;
+			return v;
+		}
+
+		uint32_t morton_code(const uint32_t x, const uint32_t y, const uint32_t z) {
+			return expand_bits(x) << 2 | expand_bits(y) << 1 | expand_bits(z);
+		}
+
+		//origin scaled by the inverse of the largest extent of the bounds, one scale for all axes keeps the
+		//cells cubic like the morton codes of the lbvh builder
+		uint32_t sort_key(const ray& r, const vec3f& min, const float scale) {
+			const vec3f o = (r.origin - min) * scale;
+			const uint32_t origin = morton_code(quantize(o.x(), ORIGIN_BITS), quantize(o.y(), ORIGIN_BITS), quantize(o.z(), ORIGIN_BITS));
+
+			//direction within its octant, the components are normalized to sum to 1
+			const vec3f d = r.direction;
+			const vec3f a(std::fabs(d.x()), std::fabs(d.y()), std::fabs(d.z()));
+			const float length = a.x() + a.y() + a.z();
+			const float inverse = length > 0.0f ? 1.0f / length : 0.0f;
+			const uint32_t direction = morton_code(quantize(a.x() * inverse, DIRECTION_BITS), quantize(a.y() * inverse, DIRECTION_BITS), quantize(a.z() * inverse, DIRECTION_BITS));
+
+			//the octant, then the 3 bit levels of both codes interleaved from the top, so rays sharing an origin
+			//are still ordered by direction and rays spread over the scene mostly by where they start
+			uint32_t key = (d.x() < 0.0f ? 4u : 0u) | (d.y() < 0.0f ? 2u : 0u) | (d.z() < 0.0f ? 1u : 0u);
+			for (int level = ORIGIN_BITS - 1; level >= 0; --level) {
+				key = key << 3 | (origin >> 3 * level & 7);
+				if (level < DIRECTION_BITS) key = key << 3 | (direction >> 3 * level & 7);
+			}
+
+			return key;
+		}
+
+		float sort_scale(const aabb& bounds) {
+			const vec3f e = bounds.extent();
+			const float extent = std::max(e.x(), std::max(e.y(), e.z()));
+			return extent > 0.0f ? 1.0f / extent : 0.0f;
+		}
+	}
+
+
+	uint32_t ray_sort_key(const ray& r, const aabb& bounds) {
+		return sort_key(r, bounds.min, sort_scale(bounds));
+	}
+
+	void sort_rays(const ray* rays, const size_t count, const aabb& bounds, std::vector<unsigned>& order, thread_pool* pool) {
+		//the ray index below the key keeps equal keys in order and comes out of the sort as the permutation
+		std::vector<uint64_t> keys(count);
+		const int chunks = (int) ((count + KEY_CHUNK - 1) / KEY_CHUNK);
+		const float scale = sort_scale(bounds);
+		const auto key_chunk = [&](const int chunk, const int) {
+			const size_t first = (size_t) chunk * KEY_CHUNK;
+			const size_t last = std::min(count, first + KEY_CHUNK);
+			for (size_t i = first; i < last; ++i) keys[i] = (uint64_t) sort_key(rays[i], bounds.min, scale) << 32 | i;
+		};
+
+		if (pool && chunks > 1) pool->run(chunks, key_chunk);
+		else for (int c = 0; c < chunks; ++c) key_chunk(c, 0);
+
+		radix_sort(keys, 32, 32 + RAY_SORT_KEY_BITS, pool);
+
+		order.resize(count);
+		for (size_t i = 0; i < count; ++i) order[i] = (unsigned) keys[i];
+	}
+}
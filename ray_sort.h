@@ -0,0 +1,21 @@
+﻿#pragma once
+#include "ray.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace raytracer {
+	struct thread_pool;
+
+	//coherence key of a ray: the octant of its direction followed by a morton code over its origin inside bounds
+	//(5 bits per axis) and its direction (4 bits per axis). rays that start close to each other and head the
+	//same way get close keys, so tracing them in key order revisits the same nodes
+	uint32_t ray_sort_key(const ray& r, const aabb& bounds);
+
+	//bits of a key, for radix sorting keys made elsewhere
+	constexpr int RAY_SORT_KEY_BITS = 3 + 3 * 5 + 3 * 4;
+
+	//indices of the rays in key order, rays with equal keys keep their order. with a pool large batches are
+	//keyed and sorted on all of its workers, so it can not be called from one of the pool's own tasks then
+	void sort_rays(const ray* rays, const size_t count, const aabb& bounds, std::vector<unsigned>& order, thread_pool* pool = nullptr);
+}
@@ -1,28 +1,644 @@
 ﻿#include "raytracer.h"
+#include "adaptive_sampler.h"
+#include "denoise.h"
+#include "kernels.h"
+#include "measurements.h"
+#include "packet.h"
+#include "path_tracer.h"
+#include "rasterizer.h"
+#include "scene_publisher.h"
+#include "thread_pool.h"
 
 #include <vector>
 
 namespace raytracer {
-	static std::vector<float> _vertices;
-	static std::vector<int> _meshes;
+	//meshes and their instances. edits are staged in the publisher's pending scene and published between frames,
+	//run() and the ray queries trace immutable snapshots
+	static scene_publisher _scenes;
 
-	void add_mesh( const float* vertices, const size_t size ) {
-		const int start = _vertices.size();
-		_vertices.resize(start + size);
-		memcpy(_vertices.data() + start, vertices, size * sizeof(float));
-		_meshes.push_back(start);
+	//snapshot traced by the last frame, accumulation restarts when a newer one is published
+	static std::shared_ptr<const scene> _frameScene;
+
+	struct camera {
+		vec3f position;
+		vec3f target;
+		float fov = 60.0f;
+		bool set = false;
+	};
+
+	static camera _camera;
+	static render_settings _settings;
+
+	//running sum of the samples of every pixel, resolved to bytes after each frame
+	static std::vector<vec3f> _accumulation;
+	static int _samples = 0;
+	static int _accumulationWidth = 0;
+	static int _accumulationHeight = 0;
+
+	//error estimates of the accumulated tiles with adaptive sampling, and the pixels of a pass for the path tracer
+	static adaptive_sampler _sampler;
+	static std::vector<unsigned> _passPixels;
+	static std::vector<vec3f> _means;
+	static size_t _frameSamples = 0;
+
+	//path traced samples of the current frame, before they are accumulated
+	static path_tracer _pathTracer;
+	static std::vector<vec3f> _radiance;
+
+	//first hits of the path traced frame and the filtered image, kept to resolve converged frames
+	static denoiser _denoiser;
+	static pixel_features _features;
+	static std::vector<vec3f> _denoised;
+
+	//visibility buffer of the frame when first hits are rasterized
+	static rasterizer _rasterizer;
+
+	//frames are split into square tiles that are distributed over the thread pool
+	constexpr int TILE_SIZE = 16;
+	static_assert(TILE_SIZE % PACKET_WIDTH == 0, "tiles must be made of whole packets");
+
+	int add_mesh( const float* vertices, const size_t size ) {
+		const int mesh = create_mesh(vertices, size);
+		add_instance(mesh, transform());
+		return mesh;
+	}
+
+	int add_mesh_view(const float* vertices, const size_t size) {
+		const int mesh = create_mesh_view(vertices, size);
+		add_instance(mesh, transform());
+		return mesh;
+	}
+
+	int create_mesh(const float* vertices, const size_t size) {
+		return _scenes.edit([&](scene& s) { return s.add_mesh(vertices, size, true); });
+	}
+
+	int create_mesh_view(const float* vertices, const size_t size) {
+		return _scenes.edit([&](scene& s) { return s.add_mesh(vertices, size, false); });
+	}
+
+	int add_indexed_mesh(const float* vertices, const size_t vertexCount, const unsigned* indices, const size_t indexCount, const bool quantize) {
+		const int mesh = create_indexed_mesh(vertices, vertexCount, indices, indexCount, quantize);
+		if (mesh >= 0) add_instance(mesh, transform());
+		return mesh;
+	}
+
+	int add_indexed_mesh_view(const float* vertices, const size_t vertexCount, const unsigned* indices, const size_t indexCount) {
+		const int mesh = create_indexed_mesh_view(vertices, vertexCount, indices, indexCount);
+		if (mesh >= 0) add_instance(mesh, transform());
+		return mesh;
+	}
+
+	int create_indexed_mesh(const float* vertices, const size_t vertexCount, const unsigned* indices, const size_t indexCount, const bool quantize) {
+		return _scenes.edit([&](scene& s) { return s.add_indexed_mesh(vertices, vertexCount, indices, indexCount, true, quantize); });
+	}
+
+	int create_indexed_mesh_view(const float* vertices, const size_t vertexCount, const unsigned* indices, const size_t indexCount) {
+		return _scenes.edit([&](scene& s) { return s.add_indexed_mesh(vertices, vertexCount, indices, indexCount, false, false); });
+	}
+
+	int add_instance(const int mesh, const transform& toWorld) {
+		return _scenes.edit([&](scene& s) { return s.add_instance(mesh, toWorld); });
+	}
+
+	void set_instance_transform(const int instance, const transform& toWorld) {
+		_scenes.edit([&](scene& s) { s.set_transform(instance, toWorld); });
+	}
+
+	void remove_instance(const int instance) {
+		_scenes.edit([&](scene& s) { s.remove_instance(instance); });
+	}
+
+	void remove_mesh(const int mesh, std::function<void()> released) {
+		_scenes.edit([&](scene& s) { s.remove_mesh(mesh, std::move(released)); });
+	}
+
+	void set_camera(const vec3f& position, const vec3f& target, const float fov) {
+		const bool changed = !_camera.set || position != _camera.position || target != _camera.target || fov != _camera.fov;
+		if (changed) _samples = 0;
+
+		_camera.position = position;
+		_camera.target = target;
+		_camera.fov = fov;
+		_camera.set = true;
+	}
+
+	void set_render_settings(const render_settings& settings) {
+		if (settings.packets != _settings.packets || settings.rasterize != _settings.rasterize || settings.accumulate != _settings.accumulate || settings.maxSamples != _settings.maxSamples) _samples = 0;
+		if (settings.pathTrace != _settings.pathTrace || settings.maxBounces != _settings.maxBounces || settings.denoise != _settings.denoise) _samples = 0;
+		if (settings.adaptiveError != _settings.adaptiveError) _samples = 0;
+		if (settings.builder != _settings.builder) _scenes.edit([&](scene& s) { s.set_builder(settings.builder); });
+		_settings = settings;
+	}
+
+	render_settings get_render_settings() {
+		return _settings;
+	}
+
+	void reset_accumulation() {
+		_samples = 0;
+	}
+
+	void set_bvh_cache(const char* directory) {
+		_scenes.edit([&](scene& s) { s.set_cache_directory(directory); });
+	}
+
+	build_stats get_build_stats() {
+		const std::shared_ptr<const scene> s = _scenes.snapshot();
+		return s ? s->last_build() : build_stats();
+	}
+
+	int get_sample_count() {
+		return _settings.accumulate ? _samples : 1;
+	}
+
+	size_t get_frame_sample_count() {
+		return _frameSamples;
+	}
+
+	//snapshot to trace. with wait every edit made so far is in it, otherwise pending edits are published in the
+	//background and the newest finished snapshot is used, only waiting if none was published yet
+	static std::shared_ptr<const scene> scene_snapshot(const bool wait) {
+		static const std::shared_ptr<const scene> empty = std::make_shared<scene>();
+
+		if (wait) _scenes.flush();
+		else _scenes.publish();
+
+		std::shared_ptr<const scene> s = _scenes.snapshot();
+		if (!s) {
+			_scenes.flush();
+			s = _scenes.snapshot();
+		}
+
+		return s ? s : empty;
+	}
+
+	void trace(const ray* rays, hit* hits, const size_t count, const bool sort) {
+		PROFILE_SCOPE("trace rays");
+		scene_snapshot(true)->trace(rays, hits, count, sort, default_pool());
+	}
+
+	void occluded(const ray* rays, bool* results, const size_t count, const bool sort) {
+		PROFILE_SCOPE("occluded rays");
+		scene_snapshot(true)->occluded(rays, results, count, sort, default_pool());
+	}
+
+
+	static camera frame_scene(const scene& world) {
+		camera c;
+		if (world.empty()) {
+			c.position = vec3f(0.0f, 0.0f, 1.0f);
+			return c;
+		}
+
+		const aabb b = world.bounds();
+		const float radius = 0.5f * b.extent().len();
+		c.target = b.center();
+		c.position = c.target + vec3f(0.0f, 0.6f * radius, 1.4f * radius);
+		return c;
+	}
+
+	static vec3f shade(const scene& world, const ray& r, const hit& h) {
+		if (h.triangle < 0) return sky_color(r.direction);
+
+		vec3f v0, v1, v2;
+		world.triangle(h, v0, v1, v2);
+		//slivers that collapse to a line in world space have no normal, hits on their corners still happen
+		const vec3f n = (v1 - v0).cross(v2 - v0);
+		const float len = n.len();
+		const float facing = len > 0.0f ? std::fabs(n.dot(r.direction)) / len : 1.0f;
+		return vec3f(1.0f, 1.0f, 1.0f) * (0.1f + 0.9f * facing);
+	}
+
+	static byte to_byte(const float f) {
+		return (byte) (255.0f * std::min(1.0f, std::max(0.0f, f)) + 0.5f);
+	}
+
+	//where the tiles of a frame get their colors from
+	enum tile_source {
+		TILE_RAYS, //camera rays traced one by one
+		TILE_PACKETS, //camera rays traced as 8x8 packets
+		TILE_RASTERIZED, //first hits from the visibility buffer
+		TILE_RADIANCE, //path traced samples
+		TILE_FILTERED, //path traced samples that are only accumulated, the denoiser writes the pixels
+		TILE_ANY //read from the frame, for the generic kernel
+	};
+
+	//what happens to the samples of a frame
+	enum accumulation_mode {
+		ACCUMULATION_OFF, //written straight to the pixels
+		ACCUMULATION_UNIFORM, //added to the accumulation, every pixel has the frame's sample count
+		ACCUMULATION_ADAPTIVE, //same, and the adaptive sampler sees them, every tile has its own sample count
+		ACCUMULATION_ANY //read from the frame, for the generic kernel
+	};
+
+	struct frame_setup {
+		const scene* world;
+		vec3f position;
+		vec3f forward;
+		vec3f right;
+		vec3f up;
+		int width;
+		int height;
+
+		//subpixel offset of this frame's samples from the pixel centers
+		float jitterX;
+		float jitterY;
+
+		//nullptr if samples are written straight to the pixels
+		vec3f* accumulation;
+		float invSamples;
+
+		//nullptr without adaptive sampling, which gives every tile its own invSamples
+		adaptive_sampler* sampler;
+
+		tile_source source;
+	};
+
+	//the source and mode of a tile kernel, compile time constants unless it is the generic one
+	template <tile_source SOURCE>
+	static tile_source source_of(const frame_setup& frame) {
+		return SOURCE == TILE_ANY ? frame.source : SOURCE;
+	}
+
+	template <accumulation_mode MODE>
+	static accumulation_mode mode_of(const frame_setup& frame) {
+		if (MODE != ACCUMULATION_ANY) return MODE;
+		return frame.sampler ? ACCUMULATION_ADAPTIVE : frame.accumulation ? ACCUMULATION_UNIFORM : ACCUMULATION_OFF;
+	}
+
+	static pinhole_camera frame_camera(const frame_setup& frame, const uint32_t sample) {
+		pinhole_camera c;
+		c.position = frame.position;
+		c.forward = frame.forward;
+		c.right = frame.right;
+		c.up = frame.up;
+		c.width = frame.width;
+		c.height = frame.height;
+		c.jitterX = frame.jitterX;
+		c.jitterY = frame.jitterY;
+		c.sample = sample;
+		return c;
+	}
+
+	//radical inverse of index in the given base, spreads consecutive samples evenly over [0, 1)
+	static float halton(int index, const int base) {
+		float result = 0.0f;
+		float f = 1.0f;
+		for (; index > 0; index /= base) {
+			f /= base;
+			result += f * (index % base);
+		}
+
+		return result;
+	}
+
+	static vec3f primary_direction(const frame_setup& frame, const int x, const int y) {
+		const float px = 2.0f * (x + 0.5f + frame.jitterX) / frame.width - 1.0f;
+		const float py = 2.0f * (y + 0.5f + frame.jitterY) / frame.height - 1.0f;
+		return (frame.forward + frame.right * px + frame.up * py).normalized();
+	}
+
+	//hdr color to display bytes, colors are clamped to [0, 1]
+	static void resolve_pixel(byte* p, const vec3f& color) {
+		p[0] = to_byte(color.x());
+		p[1] = to_byte(color.y());
+		p[2] = to_byte(color.z());
+		p[3] = 255;
+	}
+
+	template <accumulation_mode MODE>
+	static void write_pixel(const frame_setup& frame, byte* pixels, const int x, const int y, const vec3f& color) {
+		const int i = y * frame.width + x;
+		const accumulation_mode mode = mode_of<MODE>(frame);
+		if (mode == ACCUMULATION_OFF) {
+			resolve_pixel(pixels + 4 * i, color);
+			return;
+		}
+
+		frame.accumulation[i] += color;
+		if (mode == ACCUMULATION_ADAPTIVE) frame.sampler->add(i, color);
+		resolve_pixel(pixels + 4 * i, frame.accumulation[i] * frame.invSamples);
+	}
+
+	static void resolve_tile(const frame_setup& frame, byte* pixels, const int x0, const int y0, const int x1, const int y1) {
+		const simd_kernels& kernel = kernels();
+		for (int y = y0; y < y1; ++y) {
+			const int i = y * frame.width + x0;
+			kernel.resolve(frame.accumulation + i, frame.invSamples, x1 - x0, pixels + 4 * i);
+		}
+	}
+
+	static void resolve_colors(const frame_setup& frame, byte* pixels, const vec3f* colors, const int x0, const int y0, const int x1, const int y1) {
+		const simd_kernels& kernel = kernels();
+		for (int y = y0; y < y1; ++y) {
+			const int i = y * frame.width + x0;
+			kernel.resolve(colors + i, 1.0f, x1 - x0, pixels + 4 * i);
+		}
+	}
+
+	//adds count colors from pixel i on to the accumulation. the sums are a loop of their own, so that it vectorizes
+	template <accumulation_mode MODE>
+	static void accumulate_row(const frame_setup& frame, const vec3f* colors, const int i, const int count) {
+		vec3f* sums = frame.accumulation + i;
+		for (int k = 0; k < count; ++k) sums[k] += colors[i + k];
+		if (mode_of<MODE>(frame) == ACCUMULATION_ADAPTIVE) {
+			for (int k = 0; k < count; ++k) frame.sampler->add(i + k, colors[i + k]);
+		}
+	}
+
+	template <accumulation_mode MODE>
+	static void accumulate_tile(const frame_setup& frame, const vec3f* colors, const int x0, const int y0, const int x1, const int y1) {
+		if (mode_of<MODE>(frame) == ACCUMULATION_OFF) return;
+		for (int y = y0; y < y1; ++y) accumulate_row<MODE>(frame, colors, y * frame.width + x0, x1 - x0);
+	}
+
+	static void average_tile(const frame_setup& frame, vec3f* means, const int x0, const int y0, const int x1, const int y1) {
+		for (int y = y0; y < y1; ++y) {
+			for (int x = x0; x < x1; ++x) means[y * frame.width + x] = frame.accumulation[y * frame.width + x] * frame.invSamples;
+		}
+	}
+
+	//accumulates and resolves a tile of samples row by row, with the resolve kernel of the cpu
+	template <accumulation_mode MODE>
+	static void write_tile(const frame_setup& frame, byte* pixels, const vec3f* colors, const int x0, const int y0, const int x1, const int y1) {
+		const simd_kernels& kernel = kernels();
+		const accumulation_mode mode = mode_of<MODE>(frame);
+		for (int y = y0; y < y1; ++y) {
+			const int i = y * frame.width + x0;
+			if (mode == ACCUMULATION_OFF) kernel.resolve(colors + i, 1.0f, x1 - x0, pixels + 4 * i);
+			else {
+				accumulate_row<MODE>(frame, colors, i, x1 - x0);
+				kernel.resolve(frame.accumulation + i, frame.invSamples, x1 - x0, pixels + 4 * i);
+			}
+		}
+	}
+
+	template <accumulation_mode MODE>
+	static void render_tile(const frame_setup& frame, byte* pixels, const int x0, const int y0, const int x1, const int y1) {
+		for (int y = y0; y < y1; ++y) {
+			for (int x = x0; x < x1; ++x) {
+				ray r;
+				r.origin = frame.position;
+				r.direction = primary_direction(frame, x, y);
+				write_pixel<MODE>(frame, pixels, x, y, shade(*frame.world, r, frame.world->intersect(r)));
+			}
+		}
+	}
+
+	template <accumulation_mode MODE>
+	static void render_tile_rasterized(const frame_setup& frame, byte* pixels, const int x0, const int y0, const int x1, const int y1) {
+		for (int y = y0; y < y1; ++y) {
+			for (int x = x0; x < x1; ++x) {
+				ray r;
+				r.origin = frame.position;
+				r.direction = primary_direction(frame, x, y);
+				write_pixel<MODE>(frame, pixels, x, y, shade(*frame.world, r, _rasterizer.first_hit(*frame.world, r, x, y)));
+			}
+		}
+	}
+
+	template <accumulation_mode MODE>
+	static void render_tile_packets(const frame_setup& frame, byte* pixels, const int x0, const int y0, const int x1, const int y1) {
+		ray_packet packet;
+		const vec3f dx = frame.right * (2.0f / frame.width);
+		const vec3f dy = frame.up * (2.0f / frame.height);
+
+		for (int py = y0; py < y1; py += PACKET_WIDTH) {
+			for (int px = x0; px < x1; px += PACKET_WIDTH) {
+				//rays past the image edge just continue the image plane and are not written back
+				const vec3f corner = frame.forward + frame.right * (2.0f * (px + 0.5f + frame.jitterX) / frame.width - 1.0f) + frame.up * (2.0f * (py + 0.5f + frame.jitterY) / frame.height - 1.0f);
+				init_packet(packet, frame.position, corner, dx, dy);
+				frame.world->trace(packet);
+
+				for (int i = 0; i < PACKET_SIZE; ++i) {
+					const int x = px + i % PACKET_WIDTH;
+					const int y = py + i / PACKET_WIDTH;
+					if (x >= x1 || y >= y1) continue;
+
+					ray r;
+					r.origin = packet.origin;
+					r.direction = vec3f(packet.dx[i], packet.dy[i], packet.dz[i]);
+
+					hit h;
+					h.t = packet.t[i];
+					h.u = packet.u[i];
+					h.v = packet.v[i];
+					h.triangle = packet.triangle[i];
+					h.instance = packet.instance[i];
+					write_pixel<MODE>(frame, pixels, x, y, shade(*frame.world, r, h));
+				}
+			}
+		}
+	}
+
+	//one tile of a frame. every source and mode is compiled as a kernel of its own, so that the pixel loops have no
+	//branches on the settings. the generic kernel, <TILE_ANY, ACCUMULATION_ANY>, tests them per pixel instead
+	template <tile_source SOURCE, accumulation_mode MODE>
+	static void tile_kernel(const frame_setup& frame, byte* pixels, const int x0, const int y0, const int x1, const int y1) {
+		switch (source_of<SOURCE>(frame)) {
+		case TILE_RAYS: render_tile<MODE>(frame, pixels, x0, y0, x1, y1); break;
+		case TILE_PACKETS: render_tile_packets<MODE>(frame, pixels, x0, y0, x1, y1); break;
+		case TILE_RASTERIZED: render_tile_rasterized<MODE>(frame, pixels, x0, y0, x1, y1); break;
+		case TILE_RADIANCE: write_tile<MODE>(frame, pixels, _radiance.data(), x0, y0, x1, y1); break;
+		case TILE_FILTERED: accumulate_tile<MODE>(frame, _radiance.data(), x0, y0, x1, y1); break;
+		default: break;
+		}
+	}
+
+	typedef void (*tile_function)(const frame_setup& frame, byte* pixels, const int x0, const int y0, const int x1, const int y1);
+
+	template <tile_source SOURCE>
+	static tile_function tile_kernel_for(const accumulation_mode mode) {
+		switch (mode) {
+		case ACCUMULATION_OFF: return &tile_kernel<SOURCE, ACCUMULATION_OFF>;
+		case ACCUMULATION_UNIFORM: return &tile_kernel<SOURCE, ACCUMULATION_UNIFORM>;
+		default: return &tile_kernel<SOURCE, ACCUMULATION_ADAPTIVE>;
+		}
+	}
+
+	//picks the kernel for the tiles of a frame
+	static tile_function select_tile_kernel(const frame_setup& frame, const bool specialize) {
+		if (!specialize) return &tile_kernel<TILE_ANY, ACCUMULATION_ANY>;
+
+		const accumulation_mode mode = mode_of<ACCUMULATION_ANY>(frame);
+		switch (frame.source) {
+		case TILE_RAYS: return tile_kernel_for<TILE_RAYS>(mode);
+		case TILE_PACKETS: return tile_kernel_for<TILE_PACKETS>(mode);
+		case TILE_RASTERIZED: return tile_kernel_for<TILE_RASTERIZED>(mode);
+		case TILE_RADIANCE: return tile_kernel_for<TILE_RADIANCE>(mode);
+		default: return tile_kernel_for<TILE_FILTERED>(mode);
+		}
+	}
+
+	static void tile_rect(const int tile, const int tilesX, const int width, const int height, int& x0, int& y0, int& x1, int& y1) {
+		x0 = (tile % tilesX) * TILE_SIZE;
+		y0 = (tile / tilesX) * TILE_SIZE;
+		x1 = std::min(x0 + TILE_SIZE, width);
+		y1 = std::min(y0 + TILE_SIZE, height);
+	}
+
+	//indices of the pixels of the given tiles, tile by tile
+	static void tile_pixels(const std::vector<int>& tiles, const int tilesX, const int width, const int height, std::vector<unsigned>& result) {
+		result.clear();
+		for (const int tile : tiles) {
+			int x0, y0, x1, y1;
+			tile_rect(tile, tilesX, width, height, x0, y0, x1, y1);
+			for (int y = y0; y < y1; ++y) {
+				for (int x = x0; x < x1; ++x) result.push_back((unsigned) (y * width + x));
+			}
+		}
 	}
 
 	void run( byte* pixels, const int width, const int height ) {
-		//our code goes here
+		PROFILE_SCOPE("run");
+		const std::shared_ptr<const scene> world = scene_snapshot(false);
+		if (world != _frameScene) {
+			_frameScene = world;
+			_samples = 0;
+		}
 
+		const camera cam = _camera.set ? _camera : frame_scene(*world);
+		const float tanHalf = std::tan(0.5f * cam.fov * 3.14159265f / 180.0f);
+		const float aspect = (float) width / (float) height;
 
-		//default screen fill - remove this
-		for (int i = 0; i < width * height; ++i) {
-			pixels[4 * i + 0] = 255;
-			pixels[4 * i + 1] = 0;
-			pixels[4 * i + 2] = 255;
-			pixels[4 * i + 3] = 255;
+		//right and up are prescaled so that screen coordinates in [-1, 1] map onto the image plane
+		frame_setup frame;
+		frame.world = world.get();
+		frame.position = cam.position;
+		frame.forward = (cam.target - cam.position).normalized();
+		frame.right = frame.forward.cross(vec3f(0.0f, 1.0f, 0.0f)).normalized();
+		frame.up = frame.right.cross(frame.forward) * tanHalf;
+		frame.right *= tanHalf * aspect;
+		frame.width = width;
+		frame.height = height;
+		frame.jitterX = 0.0f;
+		frame.jitterY = 0.0f;
+		frame.accumulation = nullptr;
+		frame.invSamples = 1.0f;
+		frame.sampler = nullptr;
+
+		const int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+		const int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+		const int tiles = tilesX * tilesY;
+
+		//the first sample goes through the pixel centers, later ones are jittered over the pixel. a frame is one
+		//pass over all tiles until maxSamples, adaptive sampling plans it as passes over the tiles that still
+		//need samples instead
+		const bool adaptive = _settings.accumulate && _settings.adaptiveError > 0.0f;
+		const std::vector<std::vector<int>>* plan = nullptr;
+		int passes = 1;
+		if (_settings.accumulate) {
+			if (width != _accumulationWidth || height != _accumulationHeight) {
+				_accumulationWidth = width;
+				_accumulationHeight = height;
+				_samples = 0;
+			}
+
+			if (_samples == 0) {
+				_accumulation.assign((size_t) width * height, vec3f(0.0f, 0.0f, 0.0f));
+				if (adaptive) _sampler.reset(width, height, TILE_SIZE);
+			}
+
+			const int maxSamples = std::max(1, _settings.maxSamples);
+			if (adaptive) {
+				plan = &_sampler.plan(_settings.adaptiveError, maxSamples, (size_t) width * height);
+				passes = (int) plan->size();
+				frame.sampler = &_sampler;
+			}
+			else if (_samples >= maxSamples) passes = 0;
+
+			frame.accumulation = _accumulation.data();
+			frame.invSamples = 1.0f / std::max(1, _samples);
+		}
+
+		//the visibility buffer and the path tracer cover the whole pass first, the tiles then read their results
+		const bool converged = passes == 0;
+		const bool pathTrace = _settings.pathTrace && !converged;
+		const bool denoise = _settings.pathTrace && _settings.denoise;
+		const bool rasterize = _settings.rasterize && !converged;
+		if (denoise) frame.source = TILE_FILTERED;
+		else if (pathTrace) frame.source = TILE_RADIANCE;
+		else if (rasterize) frame.source = TILE_RASTERIZED;
+		else frame.source = _settings.packets ? TILE_PACKETS : TILE_RAYS;
+		const tile_function render_tile_kernel = select_tile_kernel(frame, _settings.specialize);
+
+		_frameSamples = 0;
+		for (int pass = 0; pass < passes; ++pass) {
+			if (frame.accumulation) {
+				frame.jitterX = _samples > 0 ? halton(_samples, 2) - 0.5f : 0.0f;
+				frame.jitterY = _samples > 0 ? halton(_samples, 3) - 0.5f : 0.0f;
+				++_samples;
+				frame.invSamples = 1.0f / _samples;
+			}
+
+			//nullptr for all tiles
+			const std::vector<int>* passTiles = plan ? &(*plan)[pass] : nullptr;
+			_frameSamples += passTiles ? _sampler.begin_pass(pass) : (size_t) width * height;
+
+			const pinhole_camera pc = frame_camera(frame, (uint32_t) _samples);
+			if (rasterize) {
+				PROFILE_SCOPE("rasterize");
+				_rasterizer.render(*world, pc, default_pool());
+			}
+
+			if (pathTrace) {
+				PROFILE_SCOPE("path trace");
+				_radiance.resize((size_t) width * height);
+				if (denoise) _features.resize((size_t) width * height);
+				if (passTiles) tile_pixels(*passTiles, tilesX, width, height, _passPixels);
+				_pathTracer.set_specialized(_settings.specialize);
+				_pathTracer.render(*world, pc, std::max(0, _settings.maxBounces), _settings.sortRays, _radiance.data(), denoise ? &_features : nullptr, rasterize ? &_rasterizer : nullptr,
+					passTiles ? &_passPixels : nullptr, default_pool());
+			}
+
+			default_pool().run(passTiles ? (int) passTiles->size() : tiles, [&](const int index, const int) {
+				PROFILE_SCOPE("tile");
+				const int tile = passTiles ? (*passTiles)[index] : index;
+				int x0, y0, x1, y1;
+				tile_rect(tile, tilesX, width, height, x0, y0, x1, y1);
+
+				frame_setup f = frame;
+				if (passTiles) f.invSamples = 1.0f / _sampler.samples(tile);
+				render_tile_kernel(f, pixels, x0, y0, x1, y1);
+			});
+		}
+
+		//tiles no pass sampled still have to be resolved, and adaptive sampling updates the error of those it sampled
+		if (adaptive || (converged && !denoise)) {
+			if (adaptive && pathTrace && denoise) _means.resize((size_t) width * height);
+			default_pool().run(tiles, [&](const int tile, const int) {
+				int x0, y0, x1, y1;
+				tile_rect(tile, tilesX, width, height, x0, y0, x1, y1);
+
+				frame_setup f = frame;
+				bool sampled = false;
+				if (adaptive) {
+					sampled = _sampler.end_frame(tile);
+					f.invSamples = 1.0f / _sampler.samples(tile);
+				}
+
+				if (denoise) {
+					if (adaptive && pathTrace) average_tile(f, _means.data(), x0, y0, x1, y1);
+				}
+				else if (!sampled) resolve_tile(f, pixels, x0, y0, x1, y1);
+			});
 		}
+
+		//denoised images are filtered in high dynamic range and only then turned into bytes
+		if (!denoise) return;
+		if (pathTrace) {
+			PROFILE_SCOPE("denoise");
+			_denoised.resize((size_t) width * height);
+			if (adaptive) _denoiser.run(_means.data(), 1.0f, (int) _sampler.average_samples(), _features, width, height, _denoised.data(), default_pool());
+			else if (frame.accumulation) _denoiser.run(_accumulation.data(), frame.invSamples, _samples, _features, width, height, _denoised.data(), default_pool());
+			else _denoiser.run(_radiance.data(), 1.0f, 1, _features, width, height, _denoised.data(), default_pool());
+		}
+
+		default_pool().run(tiles, [&](const int tile, const int) {
+			int x0, y0, x1, y1;
+			tile_rect(tile, tilesX, width, height, x0, y0, x1, y1);
+			resolve_colors(frame, pixels, _denoised.data(), x0, y0, x1, y1);
+		});
 	}
 }
@@ -1,8 +1,95 @@
 ﻿#pragma once
 #include "maths.h"
+#include "scene.h"
 
 namespace raytracer {
-	void add_mesh(const float* vertices, const size_t size);
+	struct render_settings {
+		bool packets = true; //trace primary rays as 8x8 packets instead of one by one
+		bool rasterize = false; //find the first hits by rasterizing the scene into a visibility buffer, no camera rays
+		bool accumulate = true; //average jittered samples over frames while nothing changes
+		int maxSamples = 256; //once accumulated, frames only resolve the stored image
+		float adaptiveError = 0.0f; //with accumulation, retire tiles once the standard error of their pixels is below this (1 is white), 0 samples every pixel every frame
+		bvh_builder builder = BVH_BUILDER_SAH; //lbvh trades trace speed for a shorter time to the first frame
+		bool pathTrace = false; //diffuse path tracing lit by sky and sun instead of shading primary hits by their facing
+		int maxBounces = 4; //bounces a path traced sample follows at most, 0 is direct light only
+		bool sortRays = false; //order bounced rays by origin and direction before tracing them, see --bench paths
+		bool denoise = false; //filter path traced images guided by normal, depth and albedo of the first hits
+		bool specialize = true; //render with kernels compiled for these settings instead of generic ones that test them per pixel, see --bench kernels
+	};
+
+	//meshes and instances can be added and moved from any thread, also while run() renders. edits are staged and
+	//published to the renderer between frames, the acceleration structures of a publish are built in the
+	//background while frames keep showing the previous state
+
+	//vertices is triangle soup, 9 floats (3 xyz vertices) per triangle. the mesh is placed once as it is,
+	//returns the mesh id for placing more instances of it
+	int add_mesh(const float* vertices, const size_t size);
+
+	//same as add_mesh without copying, the vertices have to stay valid and unchanged while the scene is used
+	int add_mesh_view(const float* vertices, const size_t size);
+
+	//same as add_mesh and add_mesh_view, but the mesh only appears where it is placed with add_instance
+	int create_mesh(const float* vertices, const size_t size);
+	int create_mesh_view(const float* vertices, const size_t size);
+
+	//indexed mesh, 3 floats per vertex and 3 vertex indices per triangle. shared vertices are stored once, which
+	//takes a fraction of the memory of triangle soup (see weld_vertices in mesh_import.h to convert soup). with
+	//quantize the vertices are kept as 16 bit fixed point over the mesh bounds, halving them again. the bvh
+	//still traces its own triangle blocks of about 46 bytes per triangle, so the whole mesh only gets about
+	//1.3x smaller than soup. returns -1 and adds nothing if an index is not below vertexCount
+	int add_indexed_mesh(const float* vertices, const size_t vertexCount, const unsigned* indices, const size_t indexCount, const bool quantize = false);
+	int create_indexed_mesh(const float* vertices, const size_t vertexCount, const unsigned* indices, const size_t indexCount, const bool quantize = false);
+
+	//indexed meshes that reference vertices and indices, both have to stay valid and unchanged while the scene is used
+	int add_indexed_mesh_view(const float* vertices, const size_t vertexCount, const unsigned* indices, const size_t indexCount);
+	int create_indexed_mesh_view(const float* vertices, const size_t vertexCount, const unsigned* indices, const size_t indexCount);
+
+	//places a mesh in the world without copying its triangles, returns the instance id, or -1 if mesh is not the
+	//id of a mesh that is still there. moving instances only refits the top level acceleration structure
+	int add_instance(const int mesh, const transform& toWorld);
+	void set_instance_transform(const int instance, const transform& toWorld);
+
+	//removals are staged like every other edit, later adds may hand out the ids again. moving or removing an
+	//instance or mesh that is not there does nothing
+	void remove_instance(const int instance);
+
+	//removes the mesh and every instance of it. frames and queries still tracing an older snapshot keep its
+	//triangles, released runs once the last of them is done: a copied mesh is freed then and the data of a view
+	//may be freed from then on. released can run on any thread and must not call the raytracer
+	void remove_mesh(const int mesh, std::function<void()> released = nullptr);
+
+	//fov is the vertical field of view in degrees, without a camera the scene is framed automatically
+	void set_camera(const vec3f& position, const vec3f& target, const float fov);
+
+	void set_render_settings(const render_settings& settings);
+	render_settings get_render_settings();
+
+	//starts accumulating from scratch, needed for changes the raytracer can not see itself.
+	//published scene edits, the camera, the settings and the frame size already reset it
+	void reset_accumulation();
+
+	//directory to keep built bottom levels in across runs, a warm start then maps them instead of building.
+	//the directory has to exist, nullptr or an empty string disables the cache
+	void set_bvh_cache(const char* directory);
+
+	//build times and bvh quality of the last run that had to update the scene
+	build_stats get_build_stats();
+
+	//closest hits of independent rays against the scene, for queries that do not render. misses keep triangle -1
+	//and t at the ray's tmax, hits[i].instance is the instance id. batches are traced on all threads, so per call
+	//overhead only pays off for many rays. with sort large batches are traced in the order of their origin and
+	//direction, which only pays off for incoherent rays over scenes larger than the caches, see --bench rays.
+	//every edit made before the call is published first
+	void trace(const ray* rays, hit* hits, const size_t count, const bool sort = false);
+
+	//results[i] is true if rays[i] hits anything closer than its tmax, every ray stops at the first hit it finds
+	void occluded(const ray* rays, bool* results, const size_t count, const bool sort = false);
+
+	//samples per pixel in the image of the last run, the most any pixel got with adaptive sampling
+	int get_sample_count();
+
+	//pixel samples the last run traced, width * height unless adaptive sampling moved them around or the image converged
+	size_t get_frame_sample_count();
 
 	void run(byte* pixels, const int width, const int height);
 }
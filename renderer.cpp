@@ -2,7 +2,9 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <GL/glew.h>
+#include <GLFW/glfw3.h>
 
 namespace raytracer {
 
@@ -36,6 +38,8 @@ namespace raytracer {
 	static GLuint _textureId = -1;
 	static GLuint _programId = -1;
 	static GLuint _screenBuffer = -1;
+	static GLuint _pixelBuffers[2] = {};
+	static int _pixelBuffer = 0;
 	static int _width = -1;
 	static int _height = -1;
 
@@ -52,6 +56,14 @@ namespace raytracer {
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
+		//texture storage is allocated once, frames are uploaded with glTexSubImage2D from alternating pbos
+		glGenBuffers(2, _pixelBuffers);
+		for (const GLuint pixelBuffer : _pixelBuffers) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr) _width * _height * 4, nullptr, GL_STREAM_DRAW);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
 		const GLuint vs = glCreateShader(GL_VERTEX_SHADER);
 		const GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
 		_programId = glCreateProgram();
@@ -97,13 +109,53 @@ namespace raytracer {
 
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 		glDeleteBuffers(1, &_screenBuffer);
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glDeleteBuffers(2, _pixelBuffers);
 	}
 
 	void draw_screen(const byte* pixels) {
+		const GLsizeiptr size = (GLsizeiptr) _width * _height * 4;
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _pixelBuffers[_pixelBuffer]);
+		_pixelBuffer ^= 1;
+
+		//orphan the old storage so the copy does not wait for the upload of an earlier frame
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+		void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (mapped) {
+			memcpy(mapped, pixels, size);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		} else {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+
 		glBindTexture(GL_TEXTURE_2D, _textureId);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, _width, _height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, _width, _height, GL_RGBA, GL_UNSIGNED_BYTE, mapped ? nullptr : pixels);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 		glUseProgram(_programId);
 
 		glDrawArrays(GL_TRIANGLES, 0, 6);
 	}
+
+
+	gl_presenter::gl_presenter(GLFWwindow* window, const int width, const int height) : _window(window), _width(width), _height(height) {
+		init_screen(width, height);
+	}
+
+	gl_presenter::~gl_presenter() {
+		terminate_screen();
+	}
+
+	void gl_presenter::present(const byte* pixels, const int width, const int height) {
+		if (width != _width || height != _height) {
+			terminate_screen();
+			init_screen(width, height);
+			_width = width;
+			_height = height;
+		}
+
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		draw_screen(pixels);
+		glfwSwapBuffers(_window);
+	}
 }
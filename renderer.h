@@ -1,8 +1,28 @@
 ﻿#pragma once
 #include "maths.h"
+#include "presenter.h"
+
+struct GLFWwindow;
 
 namespace raytracer {
 	void init_screen(const int width, const int height);
 	void terminate_screen();
+
+	//streams the pixels into the screen texture through a pixel buffer object and draws it
 	void draw_screen(const byte* pixels);
-}
\ No newline at end of file
+
+	//draws frames into the window and swaps, the window's gl context has to be current on the presenting thread.
+	//the screen texture follows the size of the presented frames
+	struct gl_presenter : presenter {
+		private:
+		GLFWwindow* _window;
+		int _width;
+		int _height;
+
+		public:
+		gl_presenter(GLFWwindow* window, const int width, const int height);
+		~gl_presenter();
+
+		void present(const byte* pixels, const int width, const int height) override;
+	};
+}
@@ -0,0 +1,40 @@
+﻿#include "resolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace raytracer {
+
+	namespace {
+		constexpr double SMOOTHING = 0.2; //weight of the newest frame in the pixel cost
+		constexpr double DEADBAND = 0.1; //relative change of the scale below which it is kept
+		constexpr double MAX_STEP = 1.25; //largest change of the scale per frame, a single slow frame only nudges it
+	}
+
+	resolution_controller::resolution_controller(const double targetMs, const float minScale) :
+		_targetMs(targetMs), _msPerPixel(0.0), _minScale(std::min(std::max(minScale, 0.01f), 1.0f)), _scale(1.0f) { }
+
+	void resolution_controller::set_target(const double targetMs) {
+		_targetMs = targetMs;
+		if (_targetMs <= 0.0) _scale = 1.0f;
+	}
+
+	void resolution_controller::render_size(const int width, const int height, int& renderWidth, int& renderHeight) const {
+		renderWidth = std::max(1, (int) (width * _scale + 0.5f));
+		renderHeight = std::max(1, (int) (height * _scale + 0.5f));
+	}
+
+	void resolution_controller::update(const double frameMs, const int renderWidth, const int renderHeight, const int width, const int height) {
+		if (_targetMs <= 0.0 || renderWidth <= 0 || renderHeight <= 0 || width <= 0 || height <= 0) return;
+
+		const double msPerPixel = frameMs / ((double) renderWidth * renderHeight);
+		_msPerPixel = _msPerPixel > 0.0 ? _msPerPixel + (msPerPixel - _msPerPixel) * SMOOTHING : msPerPixel;
+		if (_msPerPixel <= 0.0) return;
+
+		//the cost of a frame grows with its pixels, so with the square of the scale
+		double wanted = std::sqrt(_targetMs / (_msPerPixel * width * height));
+		wanted = std::min(std::max(wanted, _scale / MAX_STEP), _scale * MAX_STEP);
+		wanted = std::min(std::max(wanted, (double) _minScale), 1.0);
+		if (std::fabs(wanted - _scale) > DEADBAND * _scale || (wanted == 1.0 && _scale != 1.0f)) _scale = (float) wanted;
+	}
+}
@@ -0,0 +1,29 @@
+﻿#pragma once
+
+namespace raytracer {
+	//picks the resolution to render at so frames hold a target time, as a scale of the output size. it tracks the
+	//smoothed cost of a rendered pixel and sizes the next frames so their pixels fit in the target. changes
+	//smaller than a deadband are ignored, since every new size restarts accumulation
+	struct resolution_controller {
+		private:
+		double _targetMs;
+		double _msPerPixel; //0 until the first frame is measured
+		float _minScale;
+		float _scale;
+
+		public:
+		explicit resolution_controller(const double targetMs = 0.0, const float minScale = 0.25f);
+
+		//0 renders at the output size
+		void set_target(const double targetMs);
+		double target() const { return _targetMs; }
+		float scale() const { return _scale; }
+
+		//render size for an output size at the current scale, at least 1x1
+		void render_size(const int width, const int height, int& renderWidth, int& renderHeight) const;
+
+		//feeds back a frame that traced renderWidth x renderHeight pixels for an output of width x height.
+		//frames that did not trace anything, like resolved accumulation, should not be fed back
+		void update(const double frameMs, const int renderWidth, const int renderHeight, const int width, const int height);
+	};
+}
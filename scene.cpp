@@ -0,0 +1,524 @@
+﻿#include "scene.h"
+#include "bvh_cache.h"
+#include "kernels.h"
+#include "measurements.h"
+#include "ray_sort.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+#include <atomic>
+
+namespace raytracer {
+
+	namespace {
+		//a refit top level is rebuilt once its cost grew by this factor over the last build
+		constexpr float TLAS_REFIT_LIMIT = 1.5f;
+		//meshes this large are built one after another on the whole pool, smaller ones side by side
+		constexpr size_t PARALLEL_MESH_TRIANGLES = 1 << 16;
+		//rays one pool task traces out of a batch
+		constexpr size_t RAY_CHUNK = 1 << 10;
+		//batches below this are traced in the order given, sorting them would cost more than it saves
+		constexpr size_t RAY_SORT_MIN = 1 << 14;
+		//distance an any hit query sets once it found something, every remaining node and triangle misses then
+		constexpr float OCCLUDED = -1.0f;
+
+		void triangle_bounds(const triangle_mesh& mesh, const size_t first, const size_t last, aabb* bounds) {
+			for (size_t i = first; i < last; ++i) {
+				vec3f v0, v1, v2;
+				mesh.corners(i, v0, v1, v2);
+				bounds[i].grow(v0);
+				bounds[i].grow(v1);
+				bounds[i].grow(v2);
+			}
+		}
+
+		//pool is null when called from a pool task, returns true if the cache had the mesh
+		bool build_mesh_bvh(bvh8& tree, std::vector<triangle_block>& blocks, const triangle_mesh& mesh, const bvh_builder builder,
+			const std::string& cacheDirectory, thread_pool* pool) {
+			const size_t triangles = mesh.triangles;
+			uint64_t key = 0;
+			if (!cacheDirectory.empty()) {
+				key = mesh_cache_key(mesh, builder, pool);
+				if (load_cached_bvh(cacheDirectory.c_str(), key, tree, blocks)) return true;
+			}
+
+			std::vector<aabb> bounds(triangles);
+			if (pool) {
+				const int tasks = pool->size();
+				pool->run(tasks, [&](const int task, const int) {
+					triangle_bounds(mesh, triangles * task / tasks, triangles * (task + 1) / tasks, bounds.data());
+				});
+			} else {
+				triangle_bounds(mesh, 0, triangles, bounds.data());
+			}
+
+			bvh binary;
+			build_bvh(binary, bounds.data(), triangles, TRIANGLE_BLOCK_WIDTH, builder, pool);
+			std::vector<aabb>().swap(bounds);
+			build_triangle_blocks(binary, mesh, blocks);
+			collapse_bvh8(binary, blocks, tree);
+
+			//a failed store only costs the next start a rebuild
+			if (!cacheDirectory.empty()) store_cached_bvh(cacheDirectory.c_str(), key, tree, blocks);
+			return false;
+		}
+	}
+
+
+	scene::scene() : _tlasCost(0.0f), _rebuild(false), _refit(false), _builder(BVH_BUILDER_SAH) { }
+
+	const scene::mesh& scene::empty_mesh() {
+		static const mesh empty = []() {
+			mesh m;
+			m.geometry = std::make_shared<mesh_geometry>();
+			m.bvh = std::make_shared<mesh_bvh>();
+			m.built = true;
+			return m;
+		}();
+		return empty;
+	}
+
+	int scene::add_geometry(std::shared_ptr<const mesh_geometry> geometry) {
+		mesh m;
+		m.geometry = std::move(geometry);
+		m.bvh = empty_mesh().bvh;
+		if (!_freeMeshes.empty()) {
+			const int id = _freeMeshes.back();
+			_freeMeshes.pop_back();
+			_meshes[id] = std::move(m);
+			return id;
+		}
+
+		_meshes.push_back(std::move(m));
+		return (int) _meshes.size() - 1;
+	}
+
+	int scene::add_mesh(const float* vertices, const size_t size, const bool copy) {
+		std::shared_ptr<mesh_geometry> geometry = std::make_shared<mesh_geometry>();
+		mesh_geometry& m = *geometry;
+		if (copy) {
+			m.storage.assign(vertices, vertices + size);
+			vertices = m.storage.data();
+		}
+
+		m.data.vertices = vertices;
+		m.data.vertexCount = size / 9 * 3;
+		m.data.triangles = size / 9;
+		return add_geometry(std::move(geometry));
+	}
+
+	int scene::add_indexed_mesh(const float* vertices, const size_t vertexCount, const unsigned* indices, const size_t indexCount, const bool copy, const bool quantize) {
+		for (size_t i = 0; i < indexCount / 3 * 3; ++i) {
+			if (indices[i] >= vertexCount) return -1;
+		}
+
+		std::shared_ptr<mesh_geometry> geometry = std::make_shared<mesh_geometry>();
+		mesh_geometry& m = *geometry;
+		if (quantize) {
+			quantize_vertices(vertices, vertexCount, m.quantized, m.data);
+		} else {
+			if (copy) {
+				m.storage.assign(vertices, vertices + 3 * vertexCount);
+				vertices = m.storage.data();
+			}
+			m.data.vertices = vertices;
+			m.data.vertexCount = vertexCount;
+		}
+
+		if (copy || quantize) {
+			m.indexStorage.assign(indices, indices + indexCount / 3 * 3);
+			indices = m.indexStorage.data();
+		}
+
+		m.data.indices = indices;
+		m.data.triangles = indexCount / 3;
+		return add_geometry(std::move(geometry));
+	}
+
+	bool scene::live_mesh(const int mesh) const {
+		return mesh >= 0 && mesh < (int) _meshes.size() && _meshes[mesh].geometry != empty_mesh().geometry;
+	}
+
+	bool scene::live_instance(const int instance) const {
+		return instance >= 0 && instance < (int) _instances.size() && _instances[instance].mesh >= 0;
+	}
+
+	int scene::add_instance(const int mesh, const transform& toWorld) {
+		//a removed mesh id may be handed to the next mesh added, an instance of it would show that one
+		if (!live_mesh(mesh)) return -1;
+
+		instance inst;
+		inst.mesh = mesh;
+		inst.toWorld = toWorld;
+		inst.toObject = toWorld.inverse();
+		_rebuild = true;
+		if (!_freeInstances.empty()) {
+			const int id = _freeInstances.back();
+			_freeInstances.pop_back();
+			_instances[id] = inst;
+			return id;
+		}
+
+		_instances.push_back(inst);
+		return (int) _instances.size() - 1;
+	}
+
+	void scene::set_transform(const int instance, const transform& toWorld) {
+		if (!live_instance(instance)) return;
+
+		_instances[instance].toWorld = toWorld;
+		_instances[instance].toObject = toWorld.inverse();
+		_refit = true;
+	}
+
+	void scene::remove_instance(const int instance) {
+		if (!live_instance(instance)) return;
+
+		_instances[instance].mesh = -1;
+		_instances[instance].bounds = aabb();
+		_freeInstances.push_back(instance);
+		_rebuild = true;
+	}
+
+	void scene::remove_mesh(const int mesh, std::function<void()> released) {
+		if (!live_mesh(mesh)) return;
+
+		for (size_t i = 0; i < _instances.size(); ++i) {
+			if (_instances[i].mesh == mesh) remove_instance((int) i);
+		}
+
+		//the geometry is shared with older copies, whichever of them goes last runs released
+		_meshes[mesh].geometry->released = std::move(released);
+		_meshes[mesh] = empty_mesh();
+		_freeMeshes.push_back(mesh);
+	}
+
+	void scene::set_builder(const bvh_builder builder) {
+		if (builder == _builder) return;
+
+		_builder = builder;
+		for (mesh& m : _meshes) {
+			if (m.geometry != empty_mesh().geometry) m.built = false;
+		}
+		_rebuild = true;
+	}
+
+	bvh_builder scene::builder() const {
+		return _builder;
+	}
+
+	void scene::set_cache_directory(const char* directory) {
+		_cacheDirectory = directory ? directory : "";
+	}
+
+	bool scene::dirty() const {
+		return _rebuild || _refit;
+	}
+
+	void scene::build_meshes(thread_pool& pool) {
+		std::vector<int> small;
+		std::vector<int> large;
+		for (size_t i = 0; i < _meshes.size(); ++i) {
+			if (_meshes[i].built) continue;
+			(_meshes[i].geometry->data.triangles >= PARALLEL_MESH_TRIANGLES ? large : small).push_back((int) i);
+		}
+		if (small.empty() && large.empty()) return;
+
+		PROFILE_SCOPE("blas build");
+		const long long start = now_ns();
+		//the bottom levels are built as new objects, copies of the scene may still be tracing the old ones
+		std::atomic<int> cached(0);
+		std::vector<std::shared_ptr<mesh_bvh>> built(_meshes.size());
+		for (const int index : large) {
+			built[index] = std::make_shared<mesh_bvh>();
+			if (build_mesh_bvh(built[index]->tree, built[index]->blocks, _meshes[index].geometry->data, _builder, _cacheDirectory, &pool)) cached++;
+		}
+
+		for (const int index : small) built[index] = std::make_shared<mesh_bvh>();
+		pool.run((int) small.size(), [&](const int task, const int) {
+			const int index = small[task];
+			if (build_mesh_bvh(built[index]->tree, built[index]->blocks, _meshes[index].geometry->data, _builder, _cacheDirectory, nullptr)) cached++;
+		});
+		_stats.cachedMeshes = cached;
+		_stats.blasMs = (now_ns() - start) * 1e-6;
+
+		double cost = 0.0;
+		for (const std::vector<int>* indices : { &small, &large }) {
+			for (const int index : *indices) {
+				const triangle_mesh& data = _meshes[index].geometry->data;
+				const mesh_bvh& m = *built[index];
+				_meshes[index].bvh = built[index];
+				_meshes[index].built = true;
+				cost += (double) sah_cost(m.tree) * data.triangles;
+				_stats.blasTriangles += data.triangles;
+				_stats.blasVertexBytes += data.vertex_bytes() + data.index_bytes();
+				_stats.blasNodeBytes += m.tree.nodes.size() * sizeof(bvh8_node);
+				_stats.blasBlockBytes += m.blocks.size() * sizeof(triangle_block);
+			}
+		}
+		_stats.blasCost = _stats.blasTriangles > 0 ? (float) (cost / _stats.blasTriangles) : 0.0f;
+	}
+
+	void scene::update_instance(instance& inst) {
+		if (inst.mesh < 0) return;
+
+		const bvh8& tree = _meshes[inst.mesh].bvh->tree;
+		inst.bounds = tree.empty() ? aabb() : inst.toWorld.apply_bounds(tree.bounds());
+	}
+
+	void scene::update() {
+		update(default_pool());
+	}
+
+	void scene::update(thread_pool& pool) {
+		_stats = build_stats();
+		build_meshes(pool);
+		if (!_rebuild && !_refit) return;
+
+		const long long start = now_ns();
+
+		std::vector<aabb> bounds(_instances.size());
+		for (size_t i = 0; i < _instances.size(); ++i) {
+			update_instance(_instances[i]);
+			bounds[i] = _instances[i].bounds;
+		}
+
+		if (!_rebuild) {
+			PROFILE_SCOPE("tlas refit");
+			refit_bvh(_tlas, bounds.data());
+			_rebuild = sah_cost(_tlas) > TLAS_REFIT_LIMIT * _tlasCost;
+		}
+
+		if (_rebuild) {
+			PROFILE_SCOPE("tlas build");
+			std::vector<unsigned> live;
+			std::vector<aabb> liveBounds;
+			for (size_t i = 0; i < _instances.size(); ++i) {
+				if (_instances[i].mesh < 0) continue;
+				live.push_back((unsigned) i);
+				liveBounds.push_back(bounds[i]);
+			}
+
+			//leaves hold instance ids, so refits read the bounds of every instance by id
+			build_bvh(_tlas, liveBounds.data(), liveBounds.size());
+			for (unsigned& index : _tlas.indices) index = live[index];
+			_tlasCost = sah_cost(_tlas);
+		}
+
+		_stats.tlasMs = (now_ns() - start) * 1e-6;
+		_rebuild = false;
+		_refit = false;
+	}
+
+	void scene::adopt_bottom_levels(const scene& updated) {
+		if (updated._builder != _builder) return;
+
+		const size_t count = std::min(_meshes.size(), updated._meshes.size());
+		for (size_t i = 0; i < count; ++i) {
+			const mesh& other = updated._meshes[i];
+			if (!_meshes[i].built && other.built && other.geometry == _meshes[i].geometry) {
+				_meshes[i].bvh = other.bvh;
+				_meshes[i].built = true;
+			}
+		}
+	}
+
+	const build_stats& scene::last_build() const {
+		return _stats;
+	}
+
+	bool scene::empty() const {
+		return _tlas.empty();
+	}
+
+	aabb scene::bounds() const {
+		return _tlas.bounds();
+	}
+
+	size_t scene::triangle_count() const {
+		size_t count = 0;
+		for (const mesh& m : _meshes) count += m.geometry->data.triangles;
+		return count;
+	}
+
+	size_t scene::instance_count() const {
+		return _instances.size();
+	}
+
+	aabb scene::instance_bounds(const int instance) const {
+		return _instances[instance].bounds;
+	}
+
+	size_t scene::instance_triangle_count(const int instance) const {
+		const int mesh = _instances[instance].mesh;
+		return mesh < 0 ? 0 : _meshes[mesh].geometry->data.triangles;
+	}
+
+	size_t scene::instanced_triangle_count() const {
+		size_t count = 0;
+		for (const instance& inst : _instances) {
+			if (inst.mesh >= 0) count += _meshes[inst.mesh].geometry->data.triangles;
+		}
+		return count;
+	}
+
+	size_t scene::geometry_bytes() const {
+		size_t bytes = 0;
+		for (const mesh& m : _meshes) {
+			bytes += m.geometry->data.vertex_bytes() + m.geometry->data.index_bytes();
+			bytes += m.bvh->tree.nodes.size() * sizeof(bvh8_node);
+			bytes += m.bvh->blocks.size() * sizeof(triangle_block);
+		}
+		return bytes;
+	}
+
+	size_t scene::instance_bytes() const {
+		return _instances.size() * sizeof(instance) + _tlas.nodes.size() * sizeof(bvh_node) + _tlas.indices.size() * sizeof(unsigned);
+	}
+
+	hit scene::intersect(const ray& r) const {
+		const simd_kernels& kernel = kernels();
+		hit h;
+		h.t = r.tmax;
+		traverse(_tlas, r, h, [&](const unsigned first, const unsigned count, hit& current) {
+			for (unsigned k = first; k < first + count; ++k) {
+				const int index = (int) _tlas.indices[k];
+				const instance& inst = _instances[index];
+				const mesh_bvh& m = *_meshes[inst.mesh].bvh;
+
+				//affine transforms keep the ray parameter, so distances compare across instances
+				ray local;
+				local.origin = inst.toObject.apply_point(r.origin);
+				local.direction = inst.toObject.apply_vector(r.direction);
+				if (kernel.closest_hit(m.tree, m.blocks.data(), local, current)) current.instance = index;
+			}
+		});
+
+		return h;
+	}
+
+	bool scene::occluded(const ray& r) const {
+		const simd_kernels& kernel = kernels();
+		hit h;
+		h.t = r.tmax;
+		traverse(_tlas, r, h, [&](const unsigned first, const unsigned count, hit& current) {
+			for (unsigned k = first; k < first + count && current.t != OCCLUDED; ++k) {
+				const instance& inst = _instances[_tlas.indices[k]];
+				const mesh_bvh& m = *_meshes[inst.mesh].bvh;
+
+				ray local;
+				local.origin = inst.toObject.apply_point(r.origin);
+				local.direction = inst.toObject.apply_vector(r.direction);
+				if (kernel.any_hit(m.tree, m.blocks.data(), local, current.t)) current.t = OCCLUDED;
+			}
+		});
+
+		return h.t == OCCLUDED;
+	}
+
+	void scene::trace_instance(const int index, ray_packet& p) const {
+		const instance& inst = _instances[index];
+		const mesh_bvh& m = *_meshes[inst.mesh].bvh;
+		if (m.tree.empty()) return;
+
+		ray_packet local;
+		const transform& t = inst.toObject;
+		local.origin = t.apply_point(p.origin);
+
+		const simdf xx(t.x.x()), xy(t.x.y()), xz(t.x.z());
+		const simdf yx(t.y.x()), yy(t.y.y()), yz(t.y.z());
+		const simdf zx(t.z.x()), zy(t.z.y()), zz(t.z.z());
+		for (int i = 0; i < PACKET_SIZE; i += simdf::width) {
+			const simdf dx = simdf::load(p.dx + i), dy = simdf::load(p.dy + i), dz = simdf::load(p.dz + i);
+			(xx * dx + yx * dy + zx * dz).store(local.dx + i);
+			(xy * dx + yy * dy + zy * dz).store(local.dy + i);
+			(xz * dx + yz * dy + zz * dz).store(local.dz + i);
+			simdf::load(p.t + i).store(local.t + i);
+		}
+
+		//every hit trace_packet reports is closer than the distance the ray came in with
+		trace_packet(m.tree, m.blocks, local);
+		for (int i = 0; i < PACKET_SIZE; ++i) {
+			if (local.triangle[i] < 0) continue;
+
+			p.t[i] = local.t[i];
+			p.u[i] = local.u[i];
+			p.v[i] = local.v[i];
+			p.triangle[i] = local.triangle[i];
+			p.instance[i] = index;
+		}
+	}
+
+	void scene::trace(ray_packet& p) const {
+		for (int i = 0; i < PACKET_SIZE; ++i) {
+			p.triangle[i] = -1;
+			p.instance[i] = -1;
+		}
+		if (_tlas.empty()) return;
+
+		packet_interval interval;
+		if (!init_interval(p, interval)) {
+			for (int i = 0; i < PACKET_SIZE; ++i) {
+				ray r;
+				r.origin = p.origin;
+				r.direction = vec3f(p.dx[i], p.dy[i], p.dz[i]);
+				r.tmax = p.t[i];
+
+				const hit h = intersect(r);
+				p.t[i] = h.t;
+				p.u[i] = h.u;
+				p.v[i] = h.v;
+				p.triangle[i] = h.triangle;
+				p.instance[i] = h.instance;
+			}
+			return;
+		}
+
+		traverse_packet(_tlas, interval, p, [&](const unsigned first, const unsigned count) {
+			for (unsigned k = first; k < first + count; ++k) trace_instance((int) _tlas.indices[k], p);
+		});
+	}
+
+	template <typename F>
+	void scene::for_each_ray(const ray* rays, const size_t count, const bool sort, thread_pool& pool, const F& fn) const {
+		std::vector<unsigned> order;
+		std::vector<std::vector<ray>> batches; //one per worker, gathered sorted rays
+		if (sort && count >= RAY_SORT_MIN) {
+			PROFILE_SCOPE("ray sort");
+			sort_rays(rays, count, bounds(), order, &pool);
+			batches.resize(pool.size());
+		}
+
+		const int chunks = (int) ((count + RAY_CHUNK - 1) / RAY_CHUNK);
+		pool.run(chunks, [&](const int chunk, const int worker) {
+			const size_t first = (size_t) chunk * RAY_CHUNK;
+			const size_t last = std::min(count, first + RAY_CHUNK);
+			if (order.empty()) {
+				for (size_t i = first; i < last; ++i) fn(rays[i], i);
+				return;
+			}
+
+			//gathered up front, the loads overlap here but would stall every traversal when done one by one
+			std::vector<ray>& batch = batches[worker];
+			batch.resize(RAY_CHUNK);
+			for (size_t i = first; i < last; ++i) batch[i - first] = rays[order[i]];
+			for (size_t i = first; i < last; ++i) fn(batch[i - first], order[i]);
+		});
+	}
+
+	void scene::trace(const ray* rays, hit* hits, const size_t count, const bool sort, thread_pool& pool) const {
+		for_each_ray(rays, count, sort, pool, [&](const ray& r, const size_t i) { hits[i] = intersect(r); });
+	}
+
+	void scene::occluded(const ray* rays, bool* results, const size_t count, const bool sort, thread_pool& pool) const {
+		for_each_ray(rays, count, sort, pool, [&](const ray& r, const size_t i) { results[i] = occluded(r); });
+	}
+
+	void scene::triangle(const hit& h, vec3f& v0, vec3f& v1, vec3f& v2) const {
+		const instance& inst = _instances[h.instance];
+		_meshes[inst.mesh].geometry->data.corners((size_t) h.triangle, v0, v1, v2);
+		v0 = inst.toWorld.apply_point(v0);
+		v1 = inst.toWorld.apply_point(v1);
+		v2 = inst.toWorld.apply_point(v2);
+	}
+}
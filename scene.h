@@ -0,0 +1,165 @@
+﻿#pragma once
+#include "packet.h"
+#include "transform.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace raytracer {
+	//what the last scene::update spent building and how good the new bottom levels are
+	struct build_stats {
+		double blasMs = 0.0; //bottom level builds, 0 when every mesh was already built
+		double tlasMs = 0.0; //top level refit or rebuild
+		float blasCost = 0.0f; //sah cost of the new bottom levels, averaged over their triangles
+		size_t blasTriangles = 0;
+		size_t blasVertexBytes = 0; //vertices and indices
+		size_t blasNodeBytes = 0;
+		size_t blasBlockBytes = 0;
+		int cachedMeshes = 0; //bottom levels loaded from the cache instead of being built
+	};
+
+	//two level acceleration structure: every mesh has its own 8 wide bvh over its triangles (bottom level) and the
+	//instances placing meshes in the world are kept in a top level bvh. moving instances only refits the top
+	//level, adding instances or meshes rebuilds it, and bottom levels are built once per mesh.
+	//triangles and bottom levels never change once they exist and are shared between copies of a scene, so a copy
+	//only duplicates the instances and the top level. a copy can be updated while the original is traced
+	struct scene {
+		private:
+		struct mesh_geometry {
+			//copies of the caller's data, empty for meshes that reference it
+			std::vector<float> storage;
+			std::vector<uint16_t> quantized;
+			std::vector<unsigned> indexStorage;
+			triangle_mesh data;
+			//set by remove_mesh, runs once the last copy of the scene using the mesh is gone
+			mutable std::function<void()> released;
+
+			~mesh_geometry() {
+				if (released) released();
+			}
+		};
+
+		struct mesh_bvh {
+			bvh8 tree;
+			std::vector<triangle_block> blocks;
+		};
+
+		struct mesh {
+			std::shared_ptr<const mesh_geometry> geometry;
+			std::shared_ptr<const mesh_bvh> bvh; //empty until built
+			bool built = false;
+		};
+
+		struct instance {
+			int mesh; //-1 once removed
+			transform toWorld;
+			transform toObject;
+			aabb bounds;
+		};
+
+		std::vector<mesh> _meshes;
+		std::vector<instance> _instances;
+		std::vector<int> _freeMeshes; //ids of removed meshes and instances, handed out again by the next adds
+		std::vector<int> _freeInstances;
+
+		bvh _tlas;
+		float _tlasCost; //sah cost right after the last rebuild
+		bool _rebuild;
+		bool _refit;
+
+		bvh_builder _builder;
+		build_stats _stats;
+		std::string _cacheDirectory;
+
+		//what unbuilt bottom levels and removed meshes point at
+		static const mesh& empty_mesh();
+
+		//ids that were handed out and not removed since
+		bool live_mesh(const int mesh) const;
+		bool live_instance(const int instance) const;
+
+		int add_geometry(std::shared_ptr<const mesh_geometry> geometry);
+		void build_meshes(thread_pool& pool);
+		void update_instance(instance& inst);
+		void trace_instance(const int index, ray_packet& packet) const;
+		template <typename F>
+		void for_each_ray(const ray* rays, const size_t count, const bool sort, thread_pool& pool, const F& fn) const;
+
+		public:
+		scene();
+
+		//vertices is triangle soup, 9 floats per triangle. with copy false the vertices are referenced
+		//and have to stay valid while the scene is used. returns the mesh id
+		int add_mesh(const float* vertices, const size_t size, const bool copy);
+
+		//3 floats per vertex and 3 indices into them per triangle, referenced like add_mesh when copy is false.
+		//quantize keeps 16 bit fixed point vertices instead of floats and implies a copy. returns the mesh id, or
+		//-1 without adding anything if an index is not below vertexCount
+		int add_indexed_mesh(const float* vertices, const size_t vertexCount, const unsigned* indices, const size_t indexCount, const bool copy, const bool quantize);
+
+		//places a mesh in the world, returns the instance id, or -1 if mesh is not a live mesh id
+		int add_instance(const int mesh, const transform& toWorld);
+		void set_transform(const int instance, const transform& toWorld);
+
+		//removes an instance, later add_instance calls may hand out its id again
+		void remove_instance(const int instance);
+
+		//removes a mesh and every instance of it, later adds may hand out the ids again. copies of the scene
+		//that still have the mesh keep its triangles and bottom level, released runs on whichever thread drops
+		//the last of them. it must not edit the scene, the lock of a scene_publisher can be held then.
+		//set_transform and the removals ignore ids that are not live, released then never runs
+		void remove_mesh(const int mesh, std::function<void()> released);
+
+		//builder for the bottom levels, changing it rebuilds every mesh on the next update
+		void set_builder(const bvh_builder builder);
+		bvh_builder builder() const;
+
+		//bottom levels are loaded from and stored to this directory, keyed by a hash of their vertices and
+		//the builder. empty disables the cache
+		void set_cache_directory(const char* directory);
+
+		bool dirty() const;
+
+		//builds new bottom levels and refits or rebuilds the top level, a refit that made the top level
+		//much worse than its last build is redone as a full build. the builds run on pool, update() uses
+		//the default pool
+		void update(thread_pool& pool);
+		void update();
+
+		//takes over the bottom levels of an updated copy for meshes that are still unbuilt here, so edits made
+		//while the copy was updated do not build them again
+		void adopt_bottom_levels(const scene& updated);
+		const build_stats& last_build() const;
+
+		bool empty() const;
+		aabb bounds() const;
+
+		size_t triangle_count() const; //unique triangles over all meshes
+		size_t instance_count() const; //ids handed out so far, removed instances included
+		aabb instance_bounds(const int instance) const; //world space, as of the last update, empty once removed
+		size_t instance_triangle_count(const int instance) const; //triangles of its mesh, numbered like hit::triangle
+		size_t instanced_triangle_count() const; //triangles in the world, counting every instance
+		size_t geometry_bytes() const; //vertices, indices, bottom level nodes and triangle blocks
+		size_t instance_bytes() const; //instances and the top level
+
+		//closest hit, h.instance and h.triangle identify the triangle
+		hit intersect(const ray& r) const;
+
+		//true if anything is closer than r.tmax, both levels stop at the first hit found
+		bool occluded(const ray& r) const;
+
+		//closest hits for a whole packet, rays are culled as a packet through both levels
+		void trace(ray_packet& packet) const;
+
+		//intersect and occluded for independent rays, split into chunks over the pool, which can not be busy
+		//otherwise. with sort large batches are traced in the order of ray_sort_key so consecutive rays visit
+		//similar nodes
+		void trace(const ray* rays, hit* hits, const size_t count, const bool sort, thread_pool& pool) const;
+		void occluded(const ray* rays, bool* results, const size_t count, const bool sort, thread_pool& pool) const;
+
+		//world space corners of a hit triangle
+		void triangle(const hit& h, vec3f& v0, vec3f& v1, vec3f& v2) const;
+	};
+}
@@ -0,0 +1,75 @@
+﻿#include "scene_publisher.h"
+#include "measurements.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace raytracer {
+
+	scene_publisher::scene_publisher() : _edits(0), _requested(0), _published(0), _stop(false) { }
+
+	scene_publisher::~scene_publisher() {
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			_stop = true;
+		}
+
+		_wake.notify_all();
+		if (_thread.joinable()) _thread.join();
+	}
+
+	void scene_publisher::publish() {
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			if (_requested == _edits) return;
+
+			_requested = _edits;
+			if (!_thread.joinable()) _thread = std::thread(&scene_publisher::worker_main, this);
+		}
+
+		_wake.notify_all();
+	}
+
+	void scene_publisher::flush() {
+		publish();
+
+		std::unique_lock<std::mutex> lock(_lock);
+		const uint64_t edits = _requested;
+		_done.wait(lock, [&]() { return _published >= edits; });
+	}
+
+	std::shared_ptr<const scene> scene_publisher::snapshot() const {
+		return std::atomic_load(&_snapshot);
+	}
+
+	void scene_publisher::worker_main() {
+		//builds get a pool of their own, on the default pool every frame would queue behind them. half the
+		//threads leave the renderer room while a large mesh is built
+		thread_pool pool(std::max(1, (int) std::thread::hardware_concurrency() / 2));
+
+		std::unique_lock<std::mutex> lock(_lock);
+		while (true) {
+			_wake.wait(lock, [this]() { return _stop || _published != _requested; });
+			if (_stop) return;
+
+			//the copy only duplicates instances and the top level, edits can go on while it is updated
+			const uint64_t edits = _requested;
+			std::shared_ptr<scene> next = std::make_shared<scene>(_pending);
+			lock.unlock();
+			{
+				PROFILE_SCOPE("scene update");
+				next->update(pool);
+			}
+			lock.lock();
+
+			//without edits in the meantime the updated copy is the new pending scene, otherwise it still has
+			//the bottom levels that were built
+			if (_edits == edits) _pending = *next;
+			else _pending.adopt_bottom_levels(*next);
+
+			std::atomic_store(&_snapshot, std::shared_ptr<const scene>(std::move(next)));
+			_published = edits;
+			_done.notify_all();
+		}
+	}
+}
@@ -0,0 +1,63 @@
+﻿#pragma once
+#include "scene.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace raytracer {
+	//read-copy-update publication of a scene. edits go to a pending scene under a lock, a background thread copies
+	//it when asked to, updates the copy's acceleration structures and publishes it as an immutable snapshot.
+	//readers hold a snapshot for as long as they trace, so edits never touch what is being traced, and the last
+	//reader of an old snapshot frees it. copies share meshes and their bottom levels (see scene). the thread
+	//builds on a pool of its own, so frames rendered on the default pool meanwhile do not wait for it
+	struct scene_publisher {
+		private:
+		scene _pending;
+		uint64_t _edits; //edits made to _pending so far
+		uint64_t _requested; //edits the worker was asked to publish
+		uint64_t _published; //edits in the newest snapshot
+		std::shared_ptr<const scene> _snapshot; //only accessed through std::atomic_load and std::atomic_store
+
+		std::mutex _lock;
+		std::condition_variable _wake;
+		std::condition_variable _done;
+		std::thread _thread;
+		bool _stop;
+
+		void worker_main();
+
+		public:
+		scene_publisher();
+		~scene_publisher();
+
+		scene_publisher(const scene_publisher&) = delete;
+		scene_publisher& operator=(const scene_publisher&) = delete;
+
+		//runs fn on the pending scene and returns its result, the edit shows up in the snapshot after the next publish
+		template <typename F>
+		auto edit(const F& fn) -> decltype(fn(_pending)) {
+			std::lock_guard<std::mutex> lock(_lock);
+			++_edits;
+			return fn(_pending);
+		}
+
+		//the pending scene, for queries that do not need acceleration structures
+		template <typename F>
+		auto read(const F& fn) -> decltype(fn(_pending)) {
+			std::lock_guard<std::mutex> lock(_lock);
+			return fn(_pending);
+		}
+
+		//starts building a snapshot of all edits so far in the background, unless one is already up to date
+		void publish();
+
+		//publishes and waits until the snapshot holds every edit made so far
+		void flush();
+
+		//newest published snapshot, nullptr before the first publish finished
+		std::shared_ptr<const scene> snapshot() const;
+	};
+}
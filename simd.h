@@ -0,0 +1,166 @@
+﻿#pragma once
+#include "maths.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+namespace raytracer {
+	//thin wrappers around sse/avx registers so wide kernels can be written once as templates over the lane type.
+	//comparisons return all-ones/all-zero lanes that can be combined with & | and used in blend()
+
+	//one lane in plain floats, for builds without sse (RAYTRACER_SCALAR_MATHS or other targets). masks are floats
+	//with all bits set, so the bitwise operators and blend() work the same as on the registers
+	struct simd1f {
+		static constexpr int width = 1;
+		float m;
+
+		simd1f() = default;
+		explicit simd1f(const float f) : m(f) { }
+
+		static simd1f load(const float* p) { return simd1f(*p); }
+		static simd1f load_unaligned(const float* p) { return simd1f(*p); }
+		void store(float* p) const { *p = m; }
+		void store_unaligned(float* p) const { *p = m; }
+
+		static simd1f load_bytes(const uint8_t* p) { return simd1f((float) *p); }
+
+		static simd1f from_bits(const uint32_t bits) {
+			simd1f r;
+			memcpy(&r.m, &bits, 4);
+			return r;
+		}
+
+		uint32_t bits() const {
+			uint32_t b;
+			memcpy(&b, &m, 4);
+			return b;
+		}
+
+		static simd1f mask(const bool set) { return from_bits(set ? 0xFFFFFFFFu : 0u); }
+	};
+
+	inline simd1f operator+ (const simd1f a, const simd1f b) { return simd1f(a.m + b.m); }
+	inline simd1f operator- (const simd1f a, const simd1f b) { return simd1f(a.m - b.m); }
+	inline simd1f operator* (const simd1f a, const simd1f b) { return simd1f(a.m * b.m); }
+	inline simd1f operator/ (const simd1f a, const simd1f b) { return simd1f(a.m / b.m); }
+	inline simd1f operator< (const simd1f a, const simd1f b) { return simd1f::mask(a.m < b.m); }
+	inline simd1f operator<= (const simd1f a, const simd1f b) { return simd1f::mask(a.m <= b.m); }
+	inline simd1f operator> (const simd1f a, const simd1f b) { return simd1f::mask(a.m > b.m); }
+	inline simd1f operator>= (const simd1f a, const simd1f b) { return simd1f::mask(a.m >= b.m); }
+	inline simd1f operator& (const simd1f a, const simd1f b) { return simd1f::from_bits(a.bits() & b.bits()); }
+	inline simd1f operator| (const simd1f a, const simd1f b) { return simd1f::from_bits(a.bits() | b.bits()); }
+	//same operand order as minps/maxps, b is returned when either is nan
+	inline simd1f vmin(const simd1f a, const simd1f b) { return simd1f(a.m < b.m ? a.m : b.m); }
+	inline simd1f vmax(const simd1f a, const simd1f b) { return simd1f(a.m > b.m ? a.m : b.m); }
+	inline simd1f vabs(const simd1f a) { return simd1f(std::fabs(a.m)); }
+	inline simd1f vsqrt(const simd1f a) { return simd1f(std::sqrt(a.m)); }
+	inline simd1f blend(const simd1f a, const simd1f b, const simd1f mask) { return simd1f::from_bits((mask.bits() & b.bits()) | (~mask.bits() & a.bits())); }
+	inline int movemask(const simd1f a) { return (int) (a.bits() >> 31); }
+	inline simd1f vfloor(const simd1f a) { return simd1f(std::floor(a.m)); }
+	inline simd1f vceil(const simd1f a) { return simd1f(std::ceil(a.m)); }
+
+#ifdef RAYTRACER_SIMD_MATHS
+	struct simd4f {
+		static constexpr int width = 4;
+		__m128 m;
+
+		simd4f() = default;
+		simd4f(const __m128 v) : m(v) { }
+		explicit simd4f(const float f) : m(_mm_set1_ps(f)) { }
+
+		static simd4f load(const float* p) { return _mm_load_ps(p); }
+		static simd4f load_unaligned(const float* p) { return _mm_loadu_ps(p); }
+		void store(float* p) const { _mm_store_ps(p, m); }
+		void store_unaligned(float* p) const { _mm_storeu_ps(p, m); }
+
+		//4 unsigned bytes converted to floats
+		static simd4f load_bytes(const uint8_t* p) {
+			int bytes;
+			memcpy(&bytes, p, 4);
+			const __m128i zero = _mm_setzero_si128();
+			return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero));
+		}
+	};
+
+	inline simd4f operator+ (const simd4f a, const simd4f b) { return _mm_add_ps(a.m, b.m); }
+	inline simd4f operator- (const simd4f a, const simd4f b) { return _mm_sub_ps(a.m, b.m); }
+	inline simd4f operator* (const simd4f a, const simd4f b) { return _mm_mul_ps(a.m, b.m); }
+	inline simd4f operator/ (const simd4f a, const simd4f b) { return _mm_div_ps(a.m, b.m); }
+	inline simd4f operator< (const simd4f a, const simd4f b) { return _mm_cmplt_ps(a.m, b.m); }
+	inline simd4f operator<= (const simd4f a, const simd4f b) { return _mm_cmple_ps(a.m, b.m); }
+	inline simd4f operator> (const simd4f a, const simd4f b) { return _mm_cmpgt_ps(a.m, b.m); }
+	inline simd4f operator>= (const simd4f a, const simd4f b) { return _mm_cmpge_ps(a.m, b.m); }
+	inline simd4f operator& (const simd4f a, const simd4f b) { return _mm_and_ps(a.m, b.m); }
+	inline simd4f operator| (const simd4f a, const simd4f b) { return _mm_or_ps(a.m, b.m); }
+	inline simd4f vmin(const simd4f a, const simd4f b) { return _mm_min_ps(a.m, b.m); }
+	inline simd4f vmax(const simd4f a, const simd4f b) { return _mm_max_ps(a.m, b.m); }
+	inline simd4f vabs(const simd4f a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.m); }
+	inline simd4f vsqrt(const simd4f a) { return _mm_sqrt_ps(a.m); }
+	inline simd4f blend(const simd4f a, const simd4f b, const simd4f mask) { return _mm_or_ps(_mm_and_ps(mask.m, b.m), _mm_andnot_ps(mask.m, a.m)); }
+	inline int movemask(const simd4f a) { return _mm_movemask_ps(a.m); }
+
+	//sse2 has no rounding instruction, truncation is corrected for negative values. only for |a| < 2^31
+	inline simd4f vfloor(const simd4f a) {
+		const __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.m));
+		return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.m), _mm_set1_ps(1.0f)));
+	}
+	inline simd4f vceil(const simd4f a) { return simd4f(0.0f) - vfloor(simd4f(0.0f) - a); }
+#endif
+
+#if defined(__AVX__)
+	struct simd8f {
+		static constexpr int width = 8;
+		__m256 m;
+
+		simd8f() = default;
+		simd8f(const __m256 v) : m(v) { }
+		explicit simd8f(const float f) : m(_mm256_set1_ps(f)) { }
+
+		static simd8f load(const float* p) { return _mm256_load_ps(p); }
+		static simd8f load_unaligned(const float* p) { return _mm256_loadu_ps(p); }
+		void store(float* p) const { _mm256_store_ps(p, m); }
+		void store_unaligned(float* p) const { _mm256_storeu_ps(p, m); }
+
+		//8 unsigned bytes converted to floats
+		static simd8f load_bytes(const uint8_t* p) {
+			const __m128i bytes = _mm_loadl_epi64((const __m128i*) p);
+			const __m128i low = _mm_cvtepu8_epi32(bytes);
+			const __m128i high = _mm_cvtepu8_epi32(_mm_srli_si128(bytes, 4));
+			return _mm256_cvtepi32_ps(_mm256_insertf128_si256(_mm256_castsi128_si256(low), high, 1));
+		}
+	};
+
+	inline simd8f operator+ (const simd8f a, const simd8f b) { return _mm256_add_ps(a.m, b.m); }
+	inline simd8f operator- (const simd8f a, const simd8f b) { return _mm256_sub_ps(a.m, b.m); }
+	inline simd8f operator* (const simd8f a, const simd8f b) { return _mm256_mul_ps(a.m, b.m); }
+	inline simd8f operator/ (const simd8f a, const simd8f b) { return _mm256_div_ps(a.m, b.m); }
+	inline simd8f operator< (const simd8f a, const simd8f b) { return _mm256_cmp_ps(a.m, b.m, _CMP_LT_OQ); }
+	inline simd8f operator<= (const simd8f a, const simd8f b) { return _mm256_cmp_ps(a.m, b.m, _CMP_LE_OQ); }
+	inline simd8f operator> (const simd8f a, const simd8f b) { return _mm256_cmp_ps(a.m, b.m, _CMP_GT_OQ); }
+	inline simd8f operator>= (const simd8f a, const simd8f b) { return _mm256_cmp_ps(a.m, b.m, _CMP_GE_OQ); }
+	inline simd8f operator& (const simd8f a, const simd8f b) { return _mm256_and_ps(a.m, b.m); }
+	inline simd8f operator| (const simd8f a, const simd8f b) { return _mm256_or_ps(a.m, b.m); }
+	inline simd8f vmin(const simd8f a, const simd8f b) { return _mm256_min_ps(a.m, b.m); }
+	inline simd8f vmax(const simd8f a, const simd8f b) { return _mm256_max_ps(a.m, b.m); }
+	inline simd8f vabs(const simd8f a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.m); }
+	inline simd8f vsqrt(const simd8f a) { return _mm256_sqrt_ps(a.m); }
+	inline simd8f blend(const simd8f a, const simd8f b, const simd8f mask) { return _mm256_blendv_ps(a.m, b.m, mask.m); }
+	inline int movemask(const simd8f a) { return _mm256_movemask_ps(a.m); }
+	inline simd8f vfloor(const simd8f a) { return _mm256_floor_ps(a.m); }
+	inline simd8f vceil(const simd8f a) { return _mm256_ceil_ps(a.m); }
+#endif
+
+	//widest float type the build targets
+#if defined(__AVX__)
+	typedef simd8f simdf;
+#elif defined(RAYTRACER_SIMD_MATHS)
+	typedef simd4f simdf;
+#else
+	typedef simd1f simdf;
+#endif
+}
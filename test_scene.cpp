@@ -0,0 +1,99 @@
+﻿#include "test_scene.h"
+#include "mesh_import.h"
+#include "raytracer.h"
+
+#include <vector>
+
+namespace raytracer {
+
+	namespace {
+		constexpr int SPHERE_SEGMENTS = 32;
+		constexpr int SPHERE_RINGS = 16;
+		constexpr float PI = 3.14159265f;
+
+		void push(std::vector<float>& out, const vec3f& v) {
+			out.push_back(v.x());
+			out.push_back(v.y());
+			out.push_back(v.z());
+		}
+
+		vec3f sphere_point(const vec3f& center, const float radius, const int ring, const int segment) {
+			const float theta = PI * ring / SPHERE_RINGS;
+			const float phi = 2.0f * PI * segment / SPHERE_SEGMENTS;
+			return center + vec3f(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)) * radius;
+		}
+
+		void add_sphere(std::vector<float>& out, const vec3f& center, const float radius) {
+			for (int r = 0; r < SPHERE_RINGS; ++r) {
+				for (int s = 0; s < SPHERE_SEGMENTS; ++s) {
+					const vec3f a = sphere_point(center, radius, r, s);
+					const vec3f b = sphere_point(center, radius, r + 1, s);
+					const vec3f c = sphere_point(center, radius, r + 1, s + 1);
+					const vec3f d = sphere_point(center, radius, r, s + 1);
+					push(out, a); push(out, b); push(out, c);
+					push(out, a); push(out, c); push(out, d);
+				}
+			}
+		}
+
+		void add_ground(const int detail) {
+			const float size = (float) std::max(detail, 1);
+			const float ground[18] = {
+				-size, 0.0f, -size,  size, 0.0f, -size,  size, 0.0f,  size,
+				-size, 0.0f, -size,  size, 0.0f,  size, -size, 0.0f,  size
+			};
+			add_mesh(ground, 18);
+		}
+
+		float sphere_radius(const int i, const int j) {
+			return 0.3f + 0.15f * ((i * 7 + j * 13) % 5) / 4.0f;
+		}
+
+		vec3f sphere_center(const int detail, const int i, const int j) {
+			return vec3f(2.0f * i - detail + 1.0f, sphere_radius(i, j), 2.0f * j - detail + 1.0f);
+		}
+
+		int create_welded_mesh(const std::vector<float>& soup, const bool quantize) {
+			std::vector<float> vertices;
+			std::vector<unsigned> indices;
+			weld_vertices(soup.data(), soup.size() / 3, vertices, indices);
+			return create_indexed_mesh(vertices.data(), vertices.size() / 3, indices.data(), indices.size(), quantize);
+		}
+	}
+
+
+	std::vector<float> test_sphere() {
+		std::vector<float> sphere;
+		add_sphere(sphere, vec3f(0.0f, 0.0f, 0.0f), 1.0f);
+		return sphere;
+	}
+
+	std::vector<float> test_spheres(const int detail) {
+		std::vector<float> spheres;
+		spheres.reserve((size_t) detail * detail * SPHERE_RINGS * SPHERE_SEGMENTS * 18);
+		for (int i = 0; i < detail; ++i) {
+			for (int j = 0; j < detail; ++j) add_sphere(spheres, sphere_center(detail, i, j), sphere_radius(i, j));
+		}
+		return spheres;
+	}
+
+	size_t add_test_scene(const int detail, const bool quantize) {
+		add_ground(detail);
+
+		const std::vector<float> spheres = test_spheres(detail);
+		if (!spheres.empty()) add_instance(create_welded_mesh(spheres, quantize), transform());
+		return 2 + spheres.size() / 9;
+	}
+
+	size_t add_instanced_test_scene(const int detail, const bool quantize) {
+		add_ground(detail);
+
+		const std::vector<float> sphere = test_sphere();
+		const int mesh = create_welded_mesh(sphere, quantize);
+		for (int i = 0; i < detail; ++i) {
+			for (int j = 0; j < detail; ++j) add_instance(mesh, transform::translate(sphere_center(detail, i, j)) * transform::scale(sphere_radius(i, j)));
+		}
+
+		return 2 + (size_t) detail * detail * sphere.size() / 9;
+	}
+}
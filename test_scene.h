@@ -0,0 +1,21 @@
+﻿#pragma once
+#include "maths.h"
+
+#include <vector>
+
+namespace raytracer {
+	//procedural scene for headless runs and benchmarks: a ground plane with a detail x detail grid
+	//of tessellated spheres, roughly 1k triangles per sphere. the spheres are welded into an indexed mesh,
+	//quantize stores its vertices as 16 bit fixed point. returns the number of triangles added
+	size_t add_test_scene(const int detail, const bool quantize = false);
+
+	//the same layout with a single unit sphere mesh placed detail x detail times through add_instance,
+	//returns the number of triangles in the world
+	size_t add_instanced_test_scene(const int detail, const bool quantize = false);
+
+	//unit sphere triangle soup as used by the test scenes
+	std::vector<float> test_sphere();
+
+	//the detail x detail spheres of add_test_scene as one triangle soup, without the ground
+	std::vector<float> test_spheres(const int detail);
+}
@@ -0,0 +1,117 @@
+﻿#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace raytracer {
+
+	thread_pool::thread_pool(const int threadCount) :
+		_workerCount(threadCount > 0 ? threadCount : std::max(1, (int) std::thread::hardware_concurrency())),
+		_job(nullptr), _remaining(0), _generation(0), _stop(false) {
+		_queues.reset(new worker_queue[_workerCount]);
+
+		//worker 0 is whichever thread calls run()
+		for (int i = 1; i < _workerCount; ++i) {
+			_threads.emplace_back(&thread_pool::worker_main, this, i);
+		}
+	}
+
+	thread_pool::~thread_pool() {
+		{
+			std::lock_guard<std::mutex> guard(_wakeLock);
+			_stop = true;
+		}
+
+		_wake.notify_all();
+		for (std::thread& t : _threads) t.join();
+	}
+
+	int thread_pool::size() const {
+		return _workerCount;
+	}
+
+	bool thread_pool::pop_or_steal(const int worker, int& task) {
+		{
+			worker_queue& own = _queues[worker];
+			std::lock_guard<std::mutex> guard(own.lock);
+			if (!own.tasks.empty()) {
+				task = own.tasks.front();
+				own.tasks.pop_front();
+				return true;
+			}
+		}
+
+		//steal from the back of the other deques, the opposite end from where their owners work
+		for (int i = 1; i < _workerCount; ++i) {
+			worker_queue& victim = _queues[(worker + i) % _workerCount];
+			std::lock_guard<std::mutex> guard(victim.lock);
+			if (!victim.tasks.empty()) {
+				task = victim.tasks.back();
+				victim.tasks.pop_back();
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void thread_pool::execute(const int worker) {
+		int task;
+		while (pop_or_steal(worker, task)) {
+			(*_job)(task, worker);
+
+			if (_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				std::lock_guard<std::mutex> guard(_wakeLock);
+				_done.notify_all();
+			}
+		}
+	}
+
+	void thread_pool::worker_main(const int worker) {
+		unsigned seen = 0;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> guard(_wakeLock);
+				_wake.wait(guard, [&]() { return _stop || _generation != seen; });
+				if (_stop) return;
+				seen = _generation;
+			}
+
+			execute(worker);
+		}
+	}
+
+	void thread_pool::run(const int taskCount, const std::function<void(int task, int worker)>& job) {
+		if (taskCount <= 0) return;
+
+		std::lock_guard<std::mutex> caller(_runLock);
+		_job = &job;
+		_remaining.store(taskCount, std::memory_order_release);
+
+		//contiguous ranges per worker keep neighbouring tasks on the same core
+		for (int w = 0; w < _workerCount; ++w) {
+			const int begin = (int) ((long long) taskCount * w / _workerCount);
+			const int end = (int) ((long long) taskCount * (w + 1) / _workerCount);
+
+			std::lock_guard<std::mutex> guard(_queues[w].lock);
+			for (int i = begin; i < end; ++i) _queues[w].tasks.push_back(i);
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(_wakeLock);
+			++_generation;
+		}
+
+		_wake.notify_all();
+		execute(0);
+
+		std::unique_lock<std::mutex> guard(_wakeLock);
+		_done.wait(guard, [&]() { return _remaining.load(std::memory_order_acquire) == 0; });
+		_job = nullptr;
+	}
+
+
+	thread_pool& default_pool() {
+		static thread_pool pool;
+		return pool;
+	}
+}
@@ -0,0 +1,56 @@
+﻿#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace raytracer {
+	//persistent pool of workers, each owning a task deque. workers pop from the front of their own deque
+	//and steal from the back of the others once they run dry, so uneven tasks still keep every core busy
+	struct thread_pool {
+		private:
+		struct alignas(64) worker_queue {
+			std::mutex lock;
+			std::deque<int> tasks;
+		};
+
+		std::vector<std::thread> _threads;
+		std::unique_ptr<worker_queue[]> _queues;
+		int _workerCount;
+
+		const std::function<void(int, int)>* _job;
+		std::atomic<int> _remaining;
+
+		std::mutex _wakeLock;
+		std::condition_variable _wake;
+		std::condition_variable _done;
+		std::mutex _runLock; //one job at a time, callers on other threads wait for their turn
+		unsigned _generation;
+		bool _stop;
+
+		void worker_main(const int worker);
+		bool pop_or_steal(const int worker, int& task);
+		void execute(const int worker);
+
+		public:
+		//threadCount <= 0 uses all hardware threads, the calling thread counts as worker 0
+		explicit thread_pool(const int threadCount = 0);
+		~thread_pool();
+
+		thread_pool(const thread_pool&) = delete;
+		thread_pool& operator=(const thread_pool&) = delete;
+
+		int size() const;
+
+		//runs job(task, worker) for every task in [0, taskCount) and blocks until all are done. may be called from
+		//several threads, their jobs run one after another, but not from within a job
+		void run(const int taskCount, const std::function<void(int task, int worker)>& job);
+	};
+
+	//pool shared by the renderer, created on first use and kept for the lifetime of the program
+	thread_pool& default_pool();
+}
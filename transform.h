@@ -0,0 +1,74 @@
+﻿#pragma once
+#include "ray.h"
+
+namespace raytracer {
+	//affine transform p' = x * p.x + y * p.y + z * p.z + translation, the columns x, y and z are the images
+	//of the unit axes
+	struct transform {
+		vec3f x = vec3f(1.0f, 0.0f, 0.0f);
+		vec3f y = vec3f(0.0f, 1.0f, 0.0f);
+		vec3f z = vec3f(0.0f, 0.0f, 1.0f);
+		vec3f translation = vec3f(0.0f, 0.0f, 0.0f);
+
+		transform() = default;
+		transform(const vec3f& x, const vec3f& y, const vec3f& z, const vec3f& translation) : x(x), y(y), z(z), translation(translation) { }
+
+		vec3f apply_point(const vec3f& p) const {
+			return x * p.x() + y * p.y() + z * p.z() + translation;
+		}
+
+		vec3f apply_vector(const vec3f& v) const {
+			return x * v.x() + y * v.y() + z * v.z();
+		}
+
+		//applies b first, then this
+		transform operator* (const transform& b) const {
+			return transform(apply_vector(b.x), apply_vector(b.y), apply_vector(b.z), apply_point(b.translation));
+		}
+
+		transform inverse() const {
+			//rows of the inverse of the linear part are the cross products of its columns
+			const vec3f r0 = y.cross(z);
+			const vec3f r1 = z.cross(x);
+			const vec3f r2 = x.cross(y);
+			const float invDet = 1.0f / x.dot(r0);
+
+			transform inv(vec3f(r0.x(), r1.x(), r2.x()) * invDet, vec3f(r0.y(), r1.y(), r2.y()) * invDet, vec3f(r0.z(), r1.z(), r2.z()) * invDet, vec3f(0.0f, 0.0f, 0.0f));
+			inv.translation = inv.apply_vector(translation) * -1.0f;
+			return inv;
+		}
+
+		//world space bounds of the transformed box
+		aabb apply_bounds(const aabb& b) const {
+			const vec3f center = apply_point(b.center());
+			const vec3f half = b.extent() * 0.5f;
+			const vec3f radius(
+				std::fabs(x.x()) * half.x() + std::fabs(y.x()) * half.y() + std::fabs(z.x()) * half.z(),
+				std::fabs(x.y()) * half.x() + std::fabs(y.y()) * half.y() + std::fabs(z.y()) * half.z(),
+				std::fabs(x.z()) * half.x() + std::fabs(y.z()) * half.y() + std::fabs(z.z()) * half.z());
+
+			aabb result;
+			result.min = center - radius;
+			result.max = center + radius;
+			return result;
+		}
+
+		static transform translate(const vec3f& t) {
+			transform result;
+			result.translation = t;
+			return result;
+		}
+
+		static transform scale(const float s) {
+			return transform(vec3f(s, 0.0f, 0.0f), vec3f(0.0f, s, 0.0f), vec3f(0.0f, 0.0f, s), vec3f(0.0f, 0.0f, 0.0f));
+		}
+
+		//counter clockwise rotation by angle radians around the normalized axis
+		static transform rotate(const vec3f& axis, const float angle) {
+			const float c = std::cos(angle);
+			const float s = std::sin(angle);
+			const auto column = [&](const vec3f& v) { return v * c + axis.cross(v) * s + axis * (axis.dot(v) * (1.0f - c)); };
+			return transform(column(vec3f(1.0f, 0.0f, 0.0f)), column(vec3f(0.0f, 1.0f, 0.0f)), column(vec3f(0.0f, 0.0f, 1.0f)), vec3f(0.0f, 0.0f, 0.0f));
+		}
+	};
+}
@@ -0,0 +1,141 @@
+﻿#include "triangles.h"
+#include "simd.h"
+
+#include <algorithm>
+
+namespace raytracer {
+
+	void quantize_vertices(const float* vertices, const size_t vertexCount, std::vector<uint16_t>& quantized, triangle_mesh& mesh) {
+		aabb bounds;
+		for (size_t i = 0; i < vertexCount; ++i) bounds.grow(vec3f(vertices[3 * i], vertices[3 * i + 1], vertices[3 * i + 2]));
+
+		vec3f scale, inverse;
+		for (int axis = 0; axis < 3; ++axis) {
+			const float extent = vertexCount > 0 ? bounds.max[axis] - bounds.min[axis] : 0.0f;
+			scale[axis] = extent / 65535.0f;
+			inverse[axis] = extent > 0.0f ? 65535.0f / extent : 0.0f;
+		}
+
+		quantized.resize(3 * vertexCount);
+		for (size_t i = 0; i < 3 * vertexCount; ++i) {
+			const int axis = (int) (i % 3);
+			const float q = (vertices[i] - bounds.min[axis]) * inverse[axis] + 0.5f;
+			quantized[i] = (uint16_t) std::min(std::max(q, 0.0f), 65535.0f);
+		}
+
+		mesh.vertices = nullptr;
+		mesh.quantized = quantized.data();
+		mesh.vertexCount = vertexCount;
+		mesh.origin = vertexCount > 0 ? bounds.min : vec3f(0.0f, 0.0f, 0.0f);
+		mesh.scale = scale;
+	}
+
+	void build_triangle_blocks(bvh& tree, const triangle_mesh& mesh, std::vector<triangle_block>& blocks) {
+		blocks.clear();
+
+		size_t blockCount = 0;
+		for (const bvh_node& node : tree.nodes) {
+			if (node.is_leaf()) blockCount += (node.count + TRIANGLE_BLOCK_WIDTH - 1) / TRIANGLE_BLOCK_WIDTH;
+		}
+		blocks.reserve(blockCount);
+
+		for (bvh_node& node : tree.nodes) {
+			if (!node.is_leaf()) continue;
+
+			const unsigned first = (unsigned) blocks.size();
+			for (unsigned i = 0; i < node.count; i += TRIANGLE_BLOCK_WIDTH) {
+				triangle_block block = {};
+				for (int lane = 0; lane < TRIANGLE_BLOCK_WIDTH; ++lane) {
+					if (i + lane >= node.count) {
+						block.id[lane] = -1;
+						continue;
+					}
+
+					const unsigned tri = tree.indices[node.offset + i + lane];
+					vec3f v0, v1, v2;
+					mesh.corners(tri, v0, v1, v2);
+					const vec3f e1 = v1 - v0;
+					const vec3f e2 = v2 - v0;
+					block.v0x[lane] = v0.x();
+					block.v0y[lane] = v0.y();
+					block.v0z[lane] = v0.z();
+					block.e1x[lane] = e1.x();
+					block.e1y[lane] = e1.y();
+					block.e1z[lane] = e1.z();
+					block.e2x[lane] = e2.x();
+					block.e2y[lane] = e2.y();
+					block.e2z[lane] = e2.z();
+					block.id[lane] = (int) tri;
+				}
+
+				blocks.push_back(block);
+			}
+
+			node.offset = first;
+			node.count = (unsigned) blocks.size() - first;
+		}
+	}
+
+	namespace {
+		//moller-trumbore for the lanes [offset, offset + width) of the block, returns a bitmask of the lanes
+		//that hit closer than tmax and writes their distances and barycentrics to t, u and v
+		template <typename simd>
+		int intersect_lanes(const triangle_block& block, const int offset, const ray& r, const float tmax, float* t, float* u, float* v) {
+			const simd ox(r.origin.x()), oy(r.origin.y()), oz(r.origin.z());
+			const simd dx(r.direction.x()), dy(r.direction.y()), dz(r.direction.z());
+
+			const simd e1x = simd::load(block.e1x + offset), e1y = simd::load(block.e1y + offset), e1z = simd::load(block.e1z + offset);
+			const simd e2x = simd::load(block.e2x + offset), e2y = simd::load(block.e2y + offset), e2z = simd::load(block.e2z + offset);
+
+			//p = d x e2
+			const simd px = dy * e2z - dz * e2y;
+			const simd py = dz * e2x - dx * e2z;
+			const simd pz = dx * e2y - dy * e2x;
+			const simd det = e1x * px + e1y * py + e1z * pz;
+			const simd invDet = simd(1.0f) / det;
+
+			const simd sx = ox - simd::load(block.v0x + offset);
+			const simd sy = oy - simd::load(block.v0y + offset);
+			const simd sz = oz - simd::load(block.v0z + offset);
+			const simd lu = (sx * px + sy * py + sz * pz) * invDet;
+
+			//q = s x e1
+			const simd qx = sy * e1z - sz * e1y;
+			const simd qy = sz * e1x - sx * e1z;
+			const simd qz = sx * e1y - sy * e1x;
+			const simd lv = (dx * qx + dy * qy + dz * qz) * invDet;
+			const simd lt = (e2x * qx + e2y * qy + e2z * qz) * invDet;
+
+			const simd zero(0.0f);
+			const simd mask = (vabs(det) >= simd(1e-12f)) & (lu >= zero) & (lv >= zero) & (lu + lv <= simd(1.0f)) & (lt > zero) & (lt < simd(tmax));
+			const int bits = movemask(mask);
+			if (bits == 0) return 0;
+
+			lt.store(t + offset);
+			lu.store(u + offset);
+			lv.store(v + offset);
+			return bits << offset;
+		}
+	}
+
+	bool intersect_block(const triangle_block& block, const ray& r, hit& h) {
+		alignas(32) float t[TRIANGLE_BLOCK_WIDTH], u[TRIANGLE_BLOCK_WIDTH], v[TRIANGLE_BLOCK_WIDTH];
+
+		int bits = 0;
+		for (int offset = 0; offset < TRIANGLE_BLOCK_WIDTH; offset += simdf::width) {
+			bits |= intersect_lanes<simdf>(block, offset, r, h.t, t, u, v);
+		}
+		if (bits == 0) return false;
+
+		int lane = lowest_bit(bits);
+		for (int i = lane + 1; i < TRIANGLE_BLOCK_WIDTH; ++i) {
+			if ((bits >> i & 1) && t[i] < t[lane]) lane = i;
+		}
+
+		h.t = t[lane];
+		h.u = u[lane];
+		h.v = v[lane];
+		h.triangle = block.id[lane];
+		return true;
+	}
+}
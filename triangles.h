@@ -0,0 +1,67 @@
+﻿#pragma once
+#include "bvh.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace raytracer {
+	constexpr int TRIANGLE_BLOCK_WIDTH = 8;
+
+	//the triangles of a mesh as the scene stores them: triangle soup with 9 floats per triangle, or vertices shared
+	//through 3 indices per triangle. indexed vertices are either 3 floats or 3 16 bit fixed point coordinates
+	//decoding to origin + q * scale, which halves their memory at a precision of 1/65535 of the mesh extent
+	struct triangle_mesh {
+		const float* vertices = nullptr;
+		const uint16_t* quantized = nullptr;
+		const unsigned* indices = nullptr; //nullptr for triangle soup
+		size_t vertexCount = 0; //3 per triangle for soup
+		size_t triangles = 0;
+		vec3f origin = vec3f(0.0f, 0.0f, 0.0f);
+		vec3f scale = vec3f(1.0f, 1.0f, 1.0f);
+
+		vec3f vertex(const size_t index) const {
+			if (quantized) {
+				const uint16_t* q = quantized + 3 * index;
+				return origin + vec3f(q[0] * scale.x(), q[1] * scale.y(), q[2] * scale.z());
+			}
+			const float* v = vertices + 3 * index;
+			return vec3f(v[0], v[1], v[2]);
+		}
+
+		void corners(const size_t triangle, vec3f& v0, vec3f& v1, vec3f& v2) const {
+			if (indices) {
+				const unsigned* i = indices + 3 * triangle;
+				v0 = vertex(i[0]);
+				v1 = vertex(i[1]);
+				v2 = vertex(i[2]);
+			} else {
+				v0 = vertex(3 * triangle);
+				v1 = vertex(3 * triangle + 1);
+				v2 = vertex(3 * triangle + 2);
+			}
+		}
+
+		size_t vertex_bytes() const { return vertexCount * 3 * (quantized ? sizeof(uint16_t) : sizeof(float)); }
+		size_t index_bytes() const { return indices ? triangles * 3 * sizeof(unsigned) : 0; }
+	};
+
+	//16 bit fixed point copy of vertices for triangle_mesh, sets origin and scale of mesh
+	void quantize_vertices(const float* vertices, const size_t vertexCount, std::vector<uint16_t>& quantized, triangle_mesh& mesh);
+
+	//structure of arrays storage for 8 triangles: first vertex and the two edges leaving it,
+	//so a whole block can be tested against a ray with one pass of 8 wide simd. unused lanes have id -1
+	//and zero edges, which makes their determinant zero so they never report a hit
+	struct alignas(32) triangle_block {
+		float v0x[TRIANGLE_BLOCK_WIDTH], v0y[TRIANGLE_BLOCK_WIDTH], v0z[TRIANGLE_BLOCK_WIDTH];
+		float e1x[TRIANGLE_BLOCK_WIDTH], e1y[TRIANGLE_BLOCK_WIDTH], e1z[TRIANGLE_BLOCK_WIDTH];
+		float e2x[TRIANGLE_BLOCK_WIDTH], e2y[TRIANGLE_BLOCK_WIDTH], e2z[TRIANGLE_BLOCK_WIDTH];
+		int id[TRIANGLE_BLOCK_WIDTH];
+	};
+
+	//packs the triangles of every leaf into consecutive blocks (in depth first order) and rewrites the leaves
+	//so that offset/count refer to a range of blocks instead of bvh::indices
+	void build_triangle_blocks(bvh& tree, const triangle_mesh& mesh, std::vector<triangle_block>& blocks);
+
+	//closest hit against all triangles of the block, updates h and returns true if one is closer than h.t
+	bool intersect_block(const triangle_block& block, const ray& r, hit& h);
+}